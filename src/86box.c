@@ -102,6 +102,8 @@
 #include <86box/gdbstub.h>
 #include <86box/cli.h>
 #include <86box/vfio.h>
+#include <86box/capture.h>
+#include <86box/fbexport.h>
 
 // Disable c99-designator to avoid the warnings about int ng
 #ifdef __clang__
@@ -143,6 +145,9 @@ char	rom_path[1024] = { '\0'};		/* (O) full path to ROMs */
 rom_path_t rom_paths = { "", NULL };    /* (O) full paths to ROMs */
 char	log_path[1024] = { '\0'};		/* (O) full path of logfile */
 char	vm_name[1024]  = { '\0'};		/* (O) display name of the VM */
+static char	capture_arg[1024] = { '\0' };	/* (O) audio/video capture path */
+static char	net_capture_arg[1024] = { '\0' };	/* (O) network capture path */
+static char	fbexport_arg[256] = { '\0' };	/* (O) framebuffer shared memory name */
 
 /* Configuration values. */
 int	window_w;   /* (C) window size and */
@@ -173,6 +178,10 @@ int isamem_type[ISAMEM_MAX] = { 0,0,0,0 };	/* (C) enable ISA mem cards */
 int isartc_type = 0;				/* (C) enable ISA RTC card */
 int	gfxcard = 0;				/* (C) graphics/video card */
 int	sound_is_float = 1;			/* (C) sound uses FP values */
+int	sound_buffer_ms = 20;			/* (C) sound buffer length */
+int	sound_buffers = 4;			/* (C) sound buffers queued */
+int	sound_out_rate = 48000;			/* (C) sound output rate */
+int	sound_adaptive = 1;			/* (C) adapt queue to underruns */
 int GAMEBLASTER = 0;				/* (C) sound option */
 int GUS = 0;					/* (C) sound option */
 int SSI2001 = 0;				/* (C) sound option */
@@ -181,6 +190,8 @@ int ibm8514_enabled = 0;			/* (C) video option */
 int xga_enabled = 0;			/* (C) video option */
 uint32_t mem_size = 0;				/* (C) memory size (Installed on system board)*/
 uint32_t isa_mem_size = 0;	/* (C) memory size (ISA Memory Cards) */
+int	mem_huge_pages = 0;			/* (C) back guest RAM with huge pages */
+int	mem_reclaim = 0;			/* (C) give zeroed guest RAM back to the host */
 int	cpu_use_dynarec = 0;			/* (C) cpu uses/needs Dyna */
 int cpu = 0;					/* (C) cpu type */
 int fpu_type = 0;				/* (C) fpu type */
@@ -470,6 +481,7 @@ usage:
 			printf("\nUsage: 86box [options] [cfg-file]\n\n");
 			printf("Valid options are:\n\n");
 			printf("-? or --help         - show this information\n");
+			printf("-A or --capture path - record audio/video in emulated time to 'path'\n");
 			printf("-C or --config path  - set 'path' to be config file\n");
 #ifdef _WIN32
 			printf("-D or --debug        - force debug output logging\n");
@@ -489,6 +501,8 @@ usage:
 			printf("-R or --rompath path - set 'path' to be ROM path\n");
 			printf("-S or --settings     - show only the settings dialog\n");
 			printf("-V or --vmname name  - overrides the name of the running VM\n");
+			printf("-W or --netcapture path - capture network frames in emulated time to 'path' (pcapng)\n");
+			printf("-X or --fbexport name - publish every frame in shared memory object 'name'\n");
 			printf("-Z or --lastvmpath   - the last parameter is VM path rather than config\n");
 			printf("\nA config file can be specified. If none is, the default file will be used.\n");
 			return(0);
@@ -529,6 +543,21 @@ usage:
 
 			rpath = argv[++c];
 			rom_add_path(rpath);
+		} else if (!strcasecmp(argv[c], "--capture") ||
+			   !strcasecmp(argv[c], "-A")) {
+			if ((c+1) == argc) goto usage;
+
+			strncpy(capture_arg, argv[++c], sizeof(capture_arg) - 1);
+		} else if (!strcasecmp(argv[c], "--netcapture") ||
+			   !strcasecmp(argv[c], "-W")) {
+			if ((c+1) == argc) goto usage;
+
+			strncpy(net_capture_arg, argv[++c], sizeof(net_capture_arg) - 1);
+		} else if (!strcasecmp(argv[c], "--fbexport") ||
+			   !strcasecmp(argv[c], "-X")) {
+			if ((c+1) == argc) goto usage;
+
+			strncpy(fbexport_arg, argv[++c], sizeof(fbexport_arg) - 1);
 		} else if (!strcasecmp(argv[c], "--config") ||
 			   !strcasecmp(argv[c], "-C")) {
 			if ((c+1) == argc || plat_dir_check(argv[c + 1])) goto usage;
@@ -895,6 +924,15 @@ pc_init_modules(void)
 
 	sound_init();
 
+	if ((capture_arg[0] != '\0') && !capture_start(capture_arg))
+		pclog("Could not start capturing to %s\n", capture_arg);
+
+	if ((net_capture_arg[0] != '\0') && !net_capture_start(net_capture_arg))
+		pclog("Could not start capturing network frames to %s\n", net_capture_arg);
+
+	if ((fbexport_arg[0] != '\0') && !fbexport_start(fbexport_arg))
+		pclog("Could not export the framebuffer to %s\n", fbexport_arg);
+
 	hdc_init();
 
 	video_reset_close();
@@ -969,6 +1007,8 @@ pc_reset_hard_close(void)
 
 	scsi_disk_close();
 
+	sound_mix_flush();
+
 	closeal();
 
 	video_reset_close();
@@ -1196,6 +1236,14 @@ pc_close(thread_t *ptr)
 
 	network_close();
 
+	net_capture_stop();
+
+	capture_stop();
+
+	fbexport_stop();
+
+	sound_mix_thread_end();
+
 	sound_cd_thread_end();
 
 	cdrom_close();
@@ -1242,6 +1290,11 @@ pc_run(void)
 	joystick_process();
 	endblit();
 
+	/* Give some of the zeroed guest RAM back to the host. This would
+	   split the huge pages, so the two options do not go together. */
+	if (mem_reclaim && !mem_huge_pages)
+		mem_reclaim_zero_pages(256);
+
 	/* Done with this frame, update statistics. */
 	framecount++;
 	if (++framecountx >= 100) {
@@ -0,0 +1,545 @@
+/*
+ * 86Box	A hypervisor and IBM PC system emulator that specializes in
+ *		running old operating systems and software designed for IBM
+ *		PC systems and compatibles from 1981 through fairly recent
+ *		system designs based on the PCI bus.
+ *
+ *		This file is part of the 86Box distribution.
+ *
+ *		Audio/video capture in emulated time.
+ *
+ *		The mixed sound buffers and every blitted frame are copied on
+ *		the emulation thread and written out by a worker thread, so
+ *		the recording follows emulated time regardless of how fast
+ *		the emulation actually runs. Timestamps are in 48 kHz sample
+ *		frames since the start of the capture.
+ *
+ *		CD audio and the MT-32 or FluidSynth output do not go through
+ *		the mix; their threads hand their blocks over separately, at
+ *		their own rates, stamped with the same 48 kHz clock.
+ *
+ *		A directory path produces audio.wav, cd.wav and midi.wav, one
+ *		PNG per frame and a frames.txt index. The CD and MIDI files
+ *		start with silence up to their first block, so all three line
+ *		up. A path ending in ".86cap" produces a single raw container
+ *		with the same data. Each WAV continues in <name>_001.wav and
+ *		so on whenever a file reaches the 4 GB limit of the format.
+ *		The capture keeps running across hard resets and ends when
+ *		the emulator exits.
+ */
+#include <png.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+#include <86box/86box.h>
+#include <86box/path.h>
+#include <86box/plat.h>
+#include <86box/thread.h>
+#include <86box/video.h>
+#include <86box/sound.h>
+#include <86box/capture.h>
+
+/* Video frames are dropped rather than stalling the emulation once this
+   much data is waiting for the worker. */
+#define CAPTURE_MAX_PENDING (256ULL << 20)
+
+/* Largest data chunk a WAV file can describe, in whole sample frames. */
+#define CAPTURE_WAV_MAX ((0xffffffffU - 36U) & ~3U)
+
+enum {
+    CAPTURE_AUDIO = 0x49445541, /* "AUDI" */
+    CAPTURE_VIDEO = 0x45444956, /* "VIDE" */
+    CAPTURE_CD    = 0x55414443, /* "CDAU", w is the sample rate */
+    CAPTURE_MIDI  = 0x4944494d  /* "MIDI", w is the sample rate */
+};
+
+/* One WAV output, indexed by CAPTURE_STREAM_xxx. */
+typedef struct {
+    const char *name;
+    FILE       *fp;
+    int         rate;
+    uint32_t    bytes, part;
+} capture_wav_t;
+
+typedef struct capture_item_t {
+    struct capture_item_t *next;
+
+    uint32_t type;
+    uint64_t ts;
+    int      w, h;
+    size_t   size;
+    uint8_t  data[];
+} capture_item_t;
+
+volatile int capture_on = 0;
+
+static char            capture_path[1024];
+static int             capture_raw;
+static FILE           *capture_index, *capture_file;
+static capture_wav_t   capture_wavs[CAPTURE_STREAMS] = { { "audio" }, { "cd" }, { "midi" } };
+static uint32_t        capture_frames, capture_dropped;
+static atomic_ullong   capture_samples;
+static atomic_ullong   capture_pending;
+static capture_item_t *capture_head, *capture_tail;
+static mutex_t        *capture_mutex;
+static event_t        *capture_event;
+static thread_t       *capture_thread_h;
+static volatile int    capture_thread_on;
+
+#ifdef ENABLE_CAPTURE_LOG
+int capture_do_log = ENABLE_CAPTURE_LOG;
+
+static void
+capture_log(const char *fmt, ...)
+{
+    va_list ap;
+
+    if (capture_do_log) {
+        va_start(ap, fmt);
+        pclog_ex(fmt, ap);
+        va_end(ap);
+    }
+}
+#else
+#    define capture_log(fmt, ...)
+#endif
+
+static void
+capture_put32(uint8_t *p, uint32_t v)
+{
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+    p[2] = (v >> 16) & 0xff;
+    p[3] = (v >> 24) & 0xff;
+}
+
+static void
+capture_wav_header(FILE *fp, int rate, uint32_t bytes)
+{
+    uint8_t hdr[44];
+
+    memcpy(&hdr[0], "RIFF", 4);
+    capture_put32(&hdr[4], 36 + bytes);
+    memcpy(&hdr[8], "WAVEfmt ", 8);
+    capture_put32(&hdr[16], 16);
+    capture_put32(&hdr[20], 1 | (2 << 16));  /* PCM, stereo */
+    capture_put32(&hdr[24], rate);
+    capture_put32(&hdr[28], rate * 4);
+    capture_put32(&hdr[32], 4 | (16 << 16)); /* block align, bits */
+    memcpy(&hdr[36], "data", 4);
+    capture_put32(&hdr[40], bytes);
+
+    fseek(fp, 0, SEEK_SET);
+    fwrite(hdr, 1, sizeof(hdr), fp);
+    fseek(fp, 0, SEEK_END);
+}
+
+static int
+capture_wav_open(capture_wav_t *wav)
+{
+    char fn[1024 + 32];
+
+    if (wav->part)
+        snprintf(fn, sizeof(fn), "%s%s_%03u.wav", capture_path, wav->name, wav->part);
+    else
+        snprintf(fn, sizeof(fn), "%s%s.wav", capture_path, wav->name);
+
+    wav->fp    = plat_fopen(fn, "wb");
+    wav->bytes = 0;
+    if (!wav->fp) {
+        capture_log("CAPTURE: could not open %s, %s audio stops here\n", fn, wav->name);
+        return 0;
+    }
+
+    capture_wav_header(wav->fp, wav->rate, 0);
+    return 1;
+}
+
+static void
+capture_wav_close(capture_wav_t *wav)
+{
+    if (wav->fp) {
+        capture_wav_header(wav->fp, wav->rate, wav->bytes);
+        fclose(wav->fp);
+        wav->fp = NULL;
+    }
+}
+
+/* Append to a WAV, continuing in the next file when this one is full. */
+static void
+capture_wav_write(capture_wav_t *wav, const void *data, uint32_t size)
+{
+    if (wav->fp && ((CAPTURE_WAV_MAX - wav->bytes) < size)) {
+        capture_wav_close(wav);
+        wav->part++;
+        capture_wav_open(wav);
+    }
+    if (!wav->fp)
+        return;
+
+    fwrite(data, 1, size, wav->fp);
+    wav->bytes += size;
+}
+
+/* Open a CD or MIDI WAV on its first block, with silence up to it. */
+static void
+capture_wav_start(capture_wav_t *wav, int rate, uint64_t ts)
+{
+    static const uint8_t zero[4096] = { 0 };
+    uint64_t             pad;
+
+    wav->rate = rate;
+    if (!capture_wav_open(wav))
+        return;
+
+    pad = ((ts * rate) / 48000) * 4;
+    while (pad) {
+        capture_wav_write(wav, zero, (pad > sizeof(zero)) ? sizeof(zero) : (uint32_t) pad);
+        pad -= (pad > sizeof(zero)) ? sizeof(zero) : pad;
+    }
+}
+
+static void
+capture_write_png(const char *fn, const uint32_t *pixels, int w, int h)
+{
+    png_structp png_ptr;
+    png_infop   info_ptr;
+    png_bytep   row;
+    FILE       *fp;
+    int         x, y;
+
+    fp = plat_fopen((char *) fn, "wb");
+    if (!fp)
+        return;
+
+    png_ptr  = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    info_ptr = png_ptr ? png_create_info_struct(png_ptr) : NULL;
+    row      = malloc(w * 3);
+    if (!png_ptr || !info_ptr || !row || setjmp(png_jmpbuf(png_ptr))) {
+        capture_log("CAPTURE: could not write %s\n", fn);
+        png_destroy_write_struct(&png_ptr, &info_ptr);
+        free(row);
+        fclose(fp);
+        return;
+    }
+
+    png_init_io(png_ptr, fp);
+    /* Lossless either way; favour the worker keeping up. */
+    png_set_compression_level(png_ptr, 1);
+    png_set_IHDR(png_ptr, info_ptr, w, h, 8, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
+                 PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+    png_write_info(png_ptr, info_ptr);
+
+    for (y = 0; y < h; y++) {
+        for (x = 0; x < w; x++) {
+            row[x * 3]       = (pixels[x] >> 16) & 0xff;
+            row[(x * 3) + 1] = (pixels[x] >> 8) & 0xff;
+            row[(x * 3) + 2] = pixels[x] & 0xff;
+        }
+        png_write_row(png_ptr, row);
+        pixels += w;
+    }
+
+    png_write_end(png_ptr, NULL);
+    png_destroy_write_struct(&png_ptr, &info_ptr);
+    free(row);
+    fclose(fp);
+}
+
+static void
+capture_write(capture_item_t *item)
+{
+    char           fn[1024 + 32];
+    uint8_t        hdr[24];
+    capture_wav_t *wav;
+
+    if (capture_raw) {
+        capture_put32(&hdr[0], item->type);
+        capture_put32(&hdr[4], (uint32_t) item->ts);
+        capture_put32(&hdr[8], (uint32_t) (item->ts >> 32));
+        capture_put32(&hdr[12], item->w);
+        capture_put32(&hdr[16], item->h);
+        capture_put32(&hdr[20], (uint32_t) item->size);
+        fwrite(hdr, 1, sizeof(hdr), capture_file);
+        fwrite(item->data, 1, item->size, capture_file);
+        return;
+    }
+
+    if (item->type == CAPTURE_AUDIO)
+        capture_wav_write(&capture_wavs[CAPTURE_STREAM_MIX], item->data, (uint32_t) item->size);
+    else if ((item->type == CAPTURE_CD) || (item->type == CAPTURE_MIDI)) {
+        wav = &capture_wavs[item->h];
+        if (!wav->rate)
+            capture_wav_start(wav, item->w, item->ts);
+        capture_wav_write(wav, item->data, (uint32_t) item->size);
+    } else {
+        snprintf(fn, sizeof(fn), "%sframe_%08u.png", capture_path, capture_frames);
+        capture_write_png(fn, (uint32_t *) item->data, item->w, item->h);
+        fprintf(capture_index, "%u %llu %i %i\n", capture_frames,
+                (unsigned long long) item->ts, item->w, item->h);
+        capture_frames++;
+    }
+}
+
+static void
+capture_thread(void *param)
+{
+    capture_item_t *item;
+
+    while (1) {
+        thread_wait_event(capture_event, -1);
+        thread_reset_event(capture_event);
+
+        while (1) {
+            thread_wait_mutex(capture_mutex);
+            item = capture_head;
+            if (item) {
+                capture_head = item->next;
+                if (!capture_head)
+                    capture_tail = NULL;
+                atomic_fetch_sub(&capture_pending, item->size);
+            }
+            thread_release_mutex(capture_mutex);
+
+            if (!item)
+                break;
+
+            capture_write(item);
+            free(item);
+        }
+
+        if (!capture_thread_on)
+            break;
+    }
+}
+
+static void
+capture_queue(capture_item_t *item)
+{
+    thread_wait_mutex(capture_mutex);
+    /* The CD and MIDI threads can race capture_stop(). */
+    if (!capture_on) {
+        thread_release_mutex(capture_mutex);
+        free(item);
+        return;
+    }
+    item->next = NULL;
+    if (capture_tail)
+        capture_tail->next = item;
+    else
+        capture_head = item;
+    capture_tail = item;
+    atomic_fetch_add(&capture_pending, item->size);
+    thread_set_event(capture_event);
+    thread_release_mutex(capture_mutex);
+}
+
+/* Called from sound_poll() with each mixed 48 kHz buffer. */
+void
+capture_audio(const int32_t *buf, int len)
+{
+    capture_item_t *item;
+    int16_t        *out;
+    int32_t         v;
+    int             c;
+
+    if (!capture_on)
+        return;
+
+    item = malloc(sizeof(capture_item_t) + (len * 2 * sizeof(int16_t)));
+    if (!item)
+        return;
+
+    item->type = CAPTURE_AUDIO;
+    item->ts   = atomic_load(&capture_samples);
+    item->w    = 0;
+    item->h    = 0;
+    item->size = len * 2 * sizeof(int16_t);
+
+    out = (int16_t *) item->data;
+    for (c = 0; c < len * 2; c++) {
+        v      = buf[c];
+        v      = (v > 32767) ? 32767 : v;
+        v      = (v < -32768) ? -32768 : v;
+        out[c] = (int16_t) v;
+    }
+
+    atomic_fetch_add(&capture_samples, len);
+    capture_queue(item);
+}
+
+/* Called from the CD audio and MIDI threads with each stereo block they
+   hand to the output, in the current sound sample format. */
+void
+capture_stream(int stream, int rate, const void *buf, int frames)
+{
+    capture_item_t *item;
+    int16_t        *out;
+    float           f;
+    int             c;
+
+    if (!capture_on || (stream <= CAPTURE_STREAM_MIX) || (stream >= CAPTURE_STREAMS))
+        return;
+
+    item = malloc(sizeof(capture_item_t) + (frames * 2 * sizeof(int16_t)));
+    if (!item)
+        return;
+
+    item->type = (stream == CAPTURE_STREAM_CD) ? CAPTURE_CD : CAPTURE_MIDI;
+    item->ts   = atomic_load(&capture_samples);
+    item->w    = rate;
+    item->h    = stream;
+    item->size = frames * 2 * sizeof(int16_t);
+
+    out = (int16_t *) item->data;
+    if (sound_is_float) {
+        for (c = 0; c < frames * 2; c++) {
+            f      = ((const float *) buf)[c] * 32768.0f;
+            f      = (f > 32767.0f) ? 32767.0f : f;
+            f      = (f < -32768.0f) ? -32768.0f : f;
+            out[c] = (int16_t) f;
+        }
+    } else
+        memcpy(out, buf, item->size);
+
+    capture_queue(item);
+}
+
+/* Called from video_blit_memtoscreen() with the area about to be shown. */
+void
+capture_video(int x, int y, int w, int h)
+{
+    capture_item_t *item;
+    size_t          size = (size_t) w * h * sizeof(uint32_t);
+    int             yy;
+
+    if (!capture_on || !buffer32 || (w <= 0) || (h <= 0))
+        return;
+
+    if ((atomic_load(&capture_pending) + size) > CAPTURE_MAX_PENDING) {
+        capture_dropped++;
+        return;
+    }
+
+    item = malloc(sizeof(capture_item_t) + size);
+    if (!item)
+        return;
+
+    item->type = CAPTURE_VIDEO;
+    item->ts   = atomic_load(&capture_samples) + sound_get_pos();
+    item->w    = w;
+    item->h    = h;
+    item->size = size;
+
+    for (yy = 0; yy < h; yy++)
+        memcpy(&item->data[yy * w * sizeof(uint32_t)], &buffer32->line[y + yy][x], w * sizeof(uint32_t));
+
+    capture_queue(item);
+}
+
+int
+capture_start(const char *path)
+{
+    char   fn[1024 + 32];
+    size_t len;
+    int    c;
+
+    if (capture_on)
+        return 1;
+
+    for (c = 0; c < CAPTURE_STREAMS; c++) {
+        capture_wavs[c].fp    = NULL;
+        capture_wavs[c].rate  = 0;
+        capture_wavs[c].bytes = 0;
+        capture_wavs[c].part  = 0;
+    }
+
+    strncpy(capture_path, path, sizeof(capture_path) - 1);
+    capture_path[sizeof(capture_path) - 1] = '\0';
+
+    len         = strlen(capture_path);
+    capture_raw = (len > 6) && !strcmp(&capture_path[len - 6], ".86cap");
+
+    if (capture_raw) {
+        capture_file = plat_fopen(capture_path, "wb");
+        if (!capture_file)
+            return 0;
+        fwrite("86BXCAP1", 1, 8, capture_file);
+    } else {
+        if (!plat_dir_check(capture_path))
+            plat_dir_create(capture_path);
+        path_slash(capture_path);
+
+        capture_wavs[CAPTURE_STREAM_MIX].rate = 48000;
+        capture_wav_open(&capture_wavs[CAPTURE_STREAM_MIX]);
+        snprintf(fn, sizeof(fn), "%sframes.txt", capture_path);
+        capture_index = plat_fopen(fn, "w");
+        if (!capture_wavs[CAPTURE_STREAM_MIX].fp || !capture_index) {
+            if (capture_wavs[CAPTURE_STREAM_MIX].fp)
+                fclose(capture_wavs[CAPTURE_STREAM_MIX].fp);
+            if (capture_index)
+                fclose(capture_index);
+            capture_wavs[CAPTURE_STREAM_MIX].fp = capture_index = NULL;
+            return 0;
+        }
+        fprintf(capture_index, "# frame timestamp(1/48000 s) width height\n");
+    }
+
+    capture_frames  = 0;
+    capture_dropped = 0;
+    atomic_store(&capture_samples, 0);
+    atomic_store(&capture_pending, 0);
+    capture_head = capture_tail = NULL;
+
+    /* Kept for good, the CD and MIDI threads may still be about to take it. */
+    if (!capture_mutex)
+        capture_mutex = thread_create_mutex();
+    capture_event     = thread_create_event();
+    capture_thread_on = 1;
+    capture_thread_h  = thread_create(capture_thread, NULL);
+
+    capture_log("CAPTURE: recording to %s\n", capture_path);
+    capture_on = 1;
+
+    return 1;
+}
+
+void
+capture_stop(void)
+{
+    int c;
+
+    if (!capture_on)
+        return;
+
+    thread_wait_mutex(capture_mutex);
+    capture_on = 0;
+    thread_release_mutex(capture_mutex);
+
+    /* Let the worker drain the queue before it exits. */
+    capture_thread_on = 0;
+    thread_set_event(capture_event);
+    thread_wait(capture_thread_h);
+    capture_thread_h = NULL;
+
+    thread_destroy_event(capture_event);
+    capture_event = NULL;
+
+    if (capture_raw) {
+        fclose(capture_file);
+        capture_file = NULL;
+    } else {
+        for (c = 0; c < CAPTURE_STREAMS; c++)
+            capture_wav_close(&capture_wavs[c]);
+        fclose(capture_index);
+        capture_index = NULL;
+    }
+
+    if (capture_dropped)
+        pclog("CAPTURE: %u video frames dropped, the writer could not keep up\n", capture_dropped);
+}
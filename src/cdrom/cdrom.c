@@ -14,6 +14,7 @@
  */
 #include <inttypes.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
@@ -27,6 +28,7 @@
 #include <86box/plat.h>
 #include <86box/scsi_device.h>
 #include <86box/sound.h>
+#include <86box/thread.h>
 
 
 /* The addresses sent from the guest are absolute, ie. a LBA of 0 corresponds to a MSF of 00:00:00. Otherwise, the counter displayed by the guest is wrong:
@@ -233,6 +235,7 @@ cdrom_seek(cdrom_t *dev, uint32_t pos)
 
     dev->seek_pos   = pos;
     cdrom_stop(dev);
+    cdrom_audio_restart(dev);
 }
 
 
@@ -246,12 +249,190 @@ cdrom_is_pre(cdrom_t *dev, uint32_t lba)
 }
 
 
+/* CD-DA read-ahead.
+
+   Every drive gets a reader thread that keeps a ring of audio sectors
+   filled ahead of the play position, so the CD audio thread only ever
+   copies out of memory and host I/O stalls (compressed tracks, network
+   mounted images) are absorbed by the read-ahead instead of causing
+   dropouts. The ring is single producer/single consumer; a play or seek
+   just bumps the generation and the consumer discards whatever was read
+   for an older one, so restarting never waits for the reader. */
+typedef struct {
+    uint32_t lba, gen;
+    int      ok;
+    int16_t  data[RAW_SECTOR_SIZE / 2];
+} cdrom_audio_sector_t;
+
+typedef struct {
+    cdrom_t    *dev;
+    thread_t   *thread;
+    event_t    *wake, *filled;
+    mutex_t    *read_mutex;
+    volatile int run;
+
+    /* Written by the emulation thread, req_* before gen. */
+    uint32_t    req_pos, req_end;
+    atomic_uint gen;
+
+    atomic_uint head, tail;
+
+    /* Consumer side only. */
+    uint32_t    cons_gen;
+    int         cons_off;
+
+    cdrom_audio_sector_t ring[CD_PREFETCH_SECTORS];
+} cdrom_prefetch_t;
+
+
+static int
+cdrom_prefetch_active(cdrom_t *dev)
+{
+    return (dev->cd_status == CD_STATUS_PLAYING) || (dev->cd_status == CD_STATUS_PAUSED);
+}
+
+
+static void
+cdrom_prefetch_thread(void *priv)
+{
+    cdrom_prefetch_t *pf = (cdrom_prefetch_t *) priv;
+    cdrom_t *dev = pf->dev;
+    cdrom_audio_sector_t *slot;
+    uint32_t gen = 0xffffffff, cur, pos = 0, end = 0;
+    unsigned int head;
+    int ok;
+
+    while (pf->run) {
+        thread_reset_event(pf->wake);
+
+        cur = atomic_load(&pf->gen);
+        while (cur != gen) {
+            gen = cur;
+            pos = pf->req_pos;
+            end = pf->req_end;
+            cur = atomic_load(&pf->gen);
+        }
+
+        head = atomic_load_explicit(&pf->head, memory_order_relaxed);
+        if (!cdrom_prefetch_active(dev) || (pos >= end) ||
+            ((head - atomic_load_explicit(&pf->tail, memory_order_acquire)) >= CD_PREFETCH_SECTORS)) {
+            thread_wait_event(pf->wake, -1);
+            continue;
+        }
+
+        slot = &pf->ring[head % CD_PREFETCH_SECTORS];
+
+        /* Held across the read so the image can not go away under it. */
+        thread_wait_mutex(pf->read_mutex);
+        if ((atomic_load(&pf->gen) != gen) || !dev->ops) {
+            thread_release_mutex(pf->read_mutex);
+            continue;
+        }
+        ok = dev->ops->read_sector(dev, CD_READ_AUDIO, (uint8_t *) slot->data, pos);
+        thread_release_mutex(pf->read_mutex);
+
+        cdrom_log("CD-ROM %i: Prefetch LBA %08X %s\n", dev->id, pos, ok ? "successful" : "failed");
+
+        slot->lba = pos;
+        slot->gen = gen;
+        slot->ok  = ok;
+        atomic_store_explicit(&pf->head, head + 1, memory_order_release);
+        thread_set_event(pf->filled);
+
+        /* Nothing past a failed sector is going to be played. */
+        pos = ok ? (pos + 1) : end;
+    }
+}
+
+
+/* Called whenever the play position or end changes. */
+void
+cdrom_audio_restart(cdrom_t *dev)
+{
+    cdrom_prefetch_t *pf = (cdrom_prefetch_t *) dev->audio_prefetch;
+
+    if (!pf)
+        return;
+
+    pf->req_pos = dev->seek_pos;
+    pf->req_end = dev->cd_end;
+    atomic_fetch_add(&pf->gen, 1);
+    thread_set_event(pf->wake);
+}
+
+
+/* Stop reading ahead and wait out a read in progress, before the image
+   is closed. */
+void
+cdrom_audio_halt(cdrom_t *dev)
+{
+    cdrom_prefetch_t *pf = (cdrom_prefetch_t *) dev->audio_prefetch;
+
+    if (!pf)
+        return;
+
+    pf->req_pos = pf->req_end = 0;
+    atomic_fetch_add(&pf->gen, 1);
+
+    thread_wait_mutex(pf->read_mutex);
+    thread_release_mutex(pf->read_mutex);
+}
+
+
+static void
+cdrom_audio_prefetch_init(cdrom_t *dev)
+{
+    cdrom_prefetch_t *pf;
+
+    pf = (cdrom_prefetch_t *) calloc(1, sizeof(cdrom_prefetch_t));
+    if (!pf)
+        return;
+
+    pf->dev = dev;
+    pf->wake = thread_create_event();
+    pf->filled = thread_create_event();
+    pf->read_mutex = thread_create_mutex();
+    atomic_init(&pf->gen, 0);
+    atomic_init(&pf->head, 0);
+    atomic_init(&pf->tail, 0);
+    pf->run = 1;
+
+    dev->audio_prefetch = pf;
+    pf->thread = thread_create(cdrom_prefetch_thread, pf);
+}
+
+
+static void
+cdrom_audio_prefetch_close(cdrom_t *dev)
+{
+    cdrom_prefetch_t *pf = (cdrom_prefetch_t *) dev->audio_prefetch;
+
+    if (!pf)
+        return;
+
+    dev->audio_prefetch = NULL;
+
+    pf->run = 0;
+    thread_set_event(pf->wake);
+    thread_wait(pf->thread);
+
+    thread_destroy_event(pf->wake);
+    thread_destroy_event(pf->filled);
+    thread_close_mutex(pf->read_mutex);
+    free(pf);
+}
+
+
 int
 cdrom_audio_callback(cdrom_t *dev, int16_t *output, int len)
 {
-    int ret = 1;
+    cdrom_prefetch_t *pf = (cdrom_prefetch_t *) dev->audio_prefetch;
+    cdrom_audio_sector_t *slot;
+    unsigned int tail;
+    uint32_t gen;
+    int ret = 1, done = 0, n, waited = 0;
 
-    if (!dev->sound_on || (dev->cd_status != CD_STATUS_PLAYING)) {
+    if (!pf || !dev->sound_on || (dev->cd_status != CD_STATUS_PLAYING)) {
         cdrom_log("CD-ROM %i: Audio callback while not playing\n", dev->id);
         if (dev->cd_status == CD_STATUS_PLAYING)
             dev->seek_pos += (len >> 11);
@@ -259,33 +440,76 @@ cdrom_audio_callback(cdrom_t *dev, int16_t *output, int len)
         return 0;
     }
 
-    while (dev->cd_buflen < len) {
-        if (dev->seek_pos < dev->cd_end) {
-            if (dev->ops->read_sector(dev, CD_READ_AUDIO, (uint8_t *) &(dev->cd_buffer[dev->cd_buflen]),
-                                      dev->seek_pos)) {
-                cdrom_log("CD-ROM %i: Read LBA %08X successful\n", dev->id, dev->seek_pos);
-                dev->seek_pos++;
-                dev->cd_buflen += (RAW_SECTOR_SIZE / 2);
-                ret = 1;
-            } else {
-                cdrom_log("CD-ROM %i: Read LBA %08X failed\n", dev->id, dev->seek_pos);
-                memset(&(dev->cd_buffer[dev->cd_buflen]), 0x00, (BUF_SIZE - dev->cd_buflen) * 2);
-                dev->cd_status = CD_STATUS_STOPPED;
-                dev->cd_buflen = len;
+    gen = atomic_load(&pf->gen);
+    if (gen != pf->cons_gen) {
+        pf->cons_gen = gen;
+        pf->cons_off = 0;
+    }
+
+    tail = atomic_load_explicit(&pf->tail, memory_order_relaxed);
+    while (done < len) {
+        if (tail == atomic_load_explicit(&pf->head, memory_order_acquire)) {
+            if (dev->seek_pos >= dev->cd_end) {
+                cdrom_log("CD-ROM %i: Playing completed\n", dev->id);
+                dev->cd_status = CD_STATUS_PLAYING_COMPLETED;
                 ret = 0;
+                break;
             }
-        } else {
-            cdrom_log("CD-ROM %i: Playing completed\n", dev->id);
-            memset(&dev->cd_buffer[dev->cd_buflen], 0x00, (BUF_SIZE - dev->cd_buflen) * 2);
-            dev->cd_status = CD_STATUS_PLAYING_COMPLETED;
-            dev->cd_buflen = len;
+
+            /* Ran dry, most likely right after a seek; give the reader a
+               little time before playing silence. */
+            if (waited >= CD_PREFETCH_WAIT) {
+                cdrom_log("CD-ROM %i: Prefetch underrun at LBA %08X\n", dev->id, dev->seek_pos);
+                break;
+            }
+            atomic_store_explicit(&pf->tail, tail, memory_order_release);
+            thread_reset_event(pf->filled);
+            thread_set_event(pf->wake);
+            if (tail == atomic_load_explicit(&pf->head, memory_order_acquire)) {
+                thread_wait_event(pf->filled, 10);
+                waited += 10;
+            }
+            continue;
+        }
+
+        slot = &pf->ring[tail % CD_PREFETCH_SECTORS];
+
+        if (slot->gen != gen) {
+            gen = atomic_load(&pf->gen);
+            if (slot->gen != gen) {
+                /* Read for a position that has since been left. */
+                tail++;
+                continue;
+            }
+            pf->cons_gen = gen;
+            pf->cons_off = 0;
+        }
+
+        if (!slot->ok) {
+            cdrom_log("CD-ROM %i: Read LBA %08X failed\n", dev->id, slot->lba);
+            dev->cd_status = CD_STATUS_STOPPED;
+            tail++;
             ret = 0;
+            break;
+        }
+
+        n = MIN(len - done, (RAW_SECTOR_SIZE / 2) - pf->cons_off);
+        memcpy(&output[done], &slot->data[pf->cons_off], n * 2);
+        done += n;
+        pf->cons_off += n;
+
+        if (pf->cons_off == (RAW_SECTOR_SIZE / 2)) {
+            pf->cons_off = 0;
+            dev->seek_pos = slot->lba + 1;
+            tail++;
         }
     }
 
-    memcpy(output, dev->cd_buffer, len * 2);
-    memmove(dev->cd_buffer, &dev->cd_buffer[len], (BUF_SIZE - len) * 2);
-    dev->cd_buflen -= len;
+    atomic_store_explicit(&pf->tail, tail, memory_order_release);
+    thread_set_event(pf->wake);
+
+    if (done < len)
+        memset(&output[done], 0x00, (len - done) * 2);
 
     cdrom_log("CD-ROM %i: Audio callback returning %i\n", dev->id, ret);
     return ret;
@@ -349,7 +573,7 @@ cdrom_audio_play(cdrom_t *dev, uint32_t pos, uint32_t len, int ismsf)
     dev->seek_pos = pos;
     dev->cd_end = len;
     dev->cd_status = CD_STATUS_PLAYING;
-    dev->cd_buflen = 0;
+    cdrom_audio_restart(dev);
 
     return 1;
 }
@@ -384,6 +608,7 @@ cdrom_audio_track_search(cdrom_t *dev, uint32_t pos, int type, uint8_t playbit)
     dev->seek_pos = pos;
     dev->noplay = !playbit;
     dev->cd_status = playbit ? CD_STATUS_PLAYING : CD_STATUS_PAUSED;
+    cdrom_audio_restart(dev);
     return 1;
 }
 
@@ -419,7 +644,7 @@ cdrom_toshiba_audio_play(cdrom_t *dev, uint32_t pos, int type)
     }
 
     dev->cd_end = pos;
-    dev->cd_buflen = 0;
+    cdrom_audio_restart(dev);
     return 1;
 }
 
@@ -1232,6 +1457,9 @@ cdrom_hard_reset(void)
 
             dev->cd_status = CD_STATUS_EMPTY;
 
+            if (!dev->audio_prefetch)
+                cdrom_audio_prefetch_init(dev);
+
             if (dev->host_drive == 200)
                 cdrom_image_open(dev, dev->image_path);
         }
@@ -1256,6 +1484,8 @@ cdrom_close(void)
         if (dev->close)
             dev->close(dev->priv);
 
+        cdrom_audio_prefetch_close(dev);
+
         if (dev->ops && dev->ops->exit)
             dev->ops->exit(dev);
 
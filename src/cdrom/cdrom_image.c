@@ -230,6 +230,9 @@ image_exit(cdrom_t *dev)
     cdrom_image_log("CDROM: image_exit(%s)\n", dev->image_path);
     dev->cd_status = CD_STATUS_EMPTY;
 
+    /* The read-ahead thread may be inside the image right now. */
+    cdrom_audio_halt(dev);
+
     if (img) {
         cdi_close(img);
         dev->image = NULL;
@@ -287,12 +290,13 @@ cdrom_image_open(cdrom_t *dev, const char *fn)
         return image_open_abort(dev);
 
     /* All good, reset state. */
-    if (! strcasecmp(path_get_extension((char *) fn), "ISO"))
+    if (! strcasecmp(path_get_extension((char *) fn), "ISO") ||
+        ! strcasecmp(path_get_extension((char *) fn), "CSO"))
 	dev->cd_status = CD_STATUS_DATA_ONLY;
     else
 	dev->cd_status = CD_STATUS_STOPPED;
     dev->seek_pos = 0;
-    dev->cd_buflen = 0;
+    cdrom_audio_restart(dev);
     dev->cdrom_capacity = image_get_capacity(dev);
     cdrom_image_log("CD-ROM capacity: %i sectors (%" PRIi64 " bytes)\n", dev->cdrom_capacity, ((uint64_t) dev->cdrom_capacity) << 11ULL);
 
@@ -170,8 +170,11 @@ bin_init(const char *filename, int *error)
 static track_file_t *
 track_file_init(const char *filename, int *error)
 {
-    /* Current we only support .BIN files, either combined or one per
-       track. In the future, more is planned. */
+    /* Plain .BIN files, either combined or one per track, or the same
+       compressed into a CISO container. */
+    if (cso_probe(filename))
+        return cso_init(filename, error);
+
     return bin_init(filename, error);
 }
 
@@ -567,7 +570,7 @@ cdi_load_iso(cd_img_t *cdi, const char *filename)
     memset(&trk, 0, sizeof(track_t));
 
     /* Data track (shouldn't there be a lead in track?). */
-    trk.file = bin_init(filename, &error);
+    trk.file = track_file_init(filename, &error);
     if (error) {
         if ((trk.file != NULL) && (trk.file->close != NULL))
             trk.file->close(trk.file);
@@ -0,0 +1,478 @@
+/*
+ * 86Box	A hypervisor and IBM PC system emulator that specializes in
+ *		running old operating systems and software designed for IBM
+ *		PC systems and compatibles from 1981 through fairly recent
+ *		system designs based on the PCI bus.
+ *
+ *		This file is part of the 86Box distribution.
+ *
+ *		Compressed (CISO) CD-ROM image track files.
+ *
+ *		The image is a sequence of deflated blocks with an index
+ *		in front. Blocks are decompressed a hunk (a run of blocks)
+ *		at a time into an LRU cache, and once the guest is reading
+ *		sequentially, the hunks ahead of it are decompressed by a
+ *		small pool of worker threads, each with its own file handle.
+ */
+#define __STDC_FORMAT_MACROS
+#include <stdarg.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <wchar.h>
+#include <zlib.h>
+#define HAVE_STDARG_H
+#include <86box/86box.h>
+#include <86box/plat.h>
+#include <86box/thread.h>
+#include <86box/cdrom_image_backend.h>
+
+
+#define CSO_HEADER_SIZE	24
+#define CSO_PLAIN	0x80000000
+
+#define CSO_HUNK_BLOCKS	16	/* 32 kB hunks with the usual 2 kB blocks. */
+#define CSO_CACHE_HUNKS	64
+#define CSO_READAHEAD	8	/* Hunks decompressed ahead of a sequential reader. */
+#define CSO_THREADS	2
+
+
+typedef struct {
+    FILE	*file;
+    z_stream	zs;
+    uint8_t	*comp;
+    size_t	comp_size;
+} cso_decoder_t;
+
+typedef struct {
+    int64_t	hunk;
+    uint32_t	stamp;
+    uint8_t	*data;
+} cso_hunk_t;
+
+typedef struct {
+    track_file_t	tf;		/* Must be first. */
+
+    uint64_t	total;
+    uint32_t	block_size, blocks,
+		hunks, hunk_size,
+		*index;
+    int		align;
+
+    mutex_t	*mutex,			/* Cache and read-ahead state. */
+		*dec_mutex;
+    cso_hunk_t	cache[CSO_CACHE_HUNKS];
+    uint32_t	stamp;
+
+    cso_decoder_t	dec;		/* Used by the caller, under dec_mutex. */
+    uint8_t	*hunk_buf;
+
+    int64_t	last_hunk;
+    uint32_t	ra_next, ra_end;
+    event_t	*ra_event;
+    volatile int	ra_run;
+    thread_t	*ra_thread[CSO_THREADS];
+} cso_t;
+
+
+#ifdef ENABLE_CDROM_IMAGE_CSO_LOG
+int cdrom_image_cso_do_log = ENABLE_CDROM_IMAGE_CSO_LOG;
+
+
+void
+cdrom_image_cso_log(const char *fmt, ...)
+{
+    va_list ap;
+
+    if (cdrom_image_cso_do_log) {
+        va_start(ap, fmt);
+        pclog_ex(fmt, ap);
+        va_end(ap);
+    }
+}
+#else
+#define cdrom_image_cso_log(fmt, ...)
+#endif
+
+
+static uint32_t
+cso_get32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+
+static int
+cso_decoder_init(cso_t *cso, cso_decoder_t *dec)
+{
+    memset(dec, 0x00, sizeof(cso_decoder_t));
+
+    dec->file = plat_fopen64(cso->tf.fn, "rb");
+    if (dec->file == NULL)
+        return 0;
+
+    /* CISO blocks are raw deflate streams. */
+    if (inflateInit2(&dec->zs, -15) != Z_OK) {
+        fclose(dec->file);
+        dec->file = NULL;
+        return 0;
+    }
+
+    return 1;
+}
+
+
+static void
+cso_decoder_close(cso_decoder_t *dec)
+{
+    if (dec->file == NULL)
+        return;
+
+    inflateEnd(&dec->zs);
+    fclose(dec->file);
+    free(dec->comp);
+    memset(dec, 0x00, sizeof(cso_decoder_t));
+}
+
+
+/* Decompress one hunk into out, reading all of its blocks in one go. */
+static int
+cso_decode_hunk(cso_t *cso, cso_decoder_t *dec, uint32_t hunk, uint8_t *out)
+{
+    uint32_t first = hunk * CSO_HUNK_BLOCKS, last, b;
+    uint64_t start, end, pos, next;
+    size_t len;
+
+    last = first + CSO_HUNK_BLOCKS;
+    if (last > cso->blocks)
+        last = cso->blocks;
+
+    start = ((uint64_t) (cso->index[first] & ~CSO_PLAIN)) << cso->align;
+    end = ((uint64_t) (cso->index[last] & ~CSO_PLAIN)) << cso->align;
+    if (end < start)
+        return 0;
+
+    len = (size_t) (end - start);
+    if (len > dec->comp_size) {
+        free(dec->comp);
+        dec->comp = (uint8_t *) malloc(len);
+        dec->comp_size = dec->comp ? len : 0;
+        if (dec->comp == NULL)
+            return 0;
+    }
+
+    if ((fseeko64(dec->file, start, SEEK_SET) == -1) ||
+        (fread(dec->comp, 1, len, dec->file) != len)) {
+        cdrom_image_cso_log("CSO: Hunk %u read failed\n", hunk);
+        return 0;
+    }
+
+    for (b = first; b < last; b++) {
+        pos = ((uint64_t) (cso->index[b] & ~CSO_PLAIN)) << cso->align;
+        next = ((uint64_t) (cso->index[b + 1] & ~CSO_PLAIN)) << cso->align;
+        if (next < pos)
+            return 0;
+
+        if (cso->index[b] & CSO_PLAIN) {
+            memcpy(out, &dec->comp[pos - start], MIN(next - pos, cso->block_size));
+        } else {
+            inflateReset(&dec->zs);
+            dec->zs.next_in = &dec->comp[pos - start];
+            dec->zs.avail_in = (uInt) (next - pos);
+            dec->zs.next_out = out;
+            dec->zs.avail_out = cso->block_size;
+            if (inflate(&dec->zs, Z_FINISH) != Z_STREAM_END) {
+                /* Some writers do not end the stream on the last block. */
+                if (dec->zs.avail_out != 0) {
+                    cdrom_image_cso_log("CSO: Block %u inflate failed\n", b);
+                    return 0;
+                }
+            }
+        }
+
+        out += cso->block_size;
+    }
+
+    return 1;
+}
+
+
+/* Must be called with the mutex held. */
+static cso_hunk_t *
+cso_cache_find(cso_t *cso, int64_t hunk)
+{
+    int i;
+
+    for (i = 0; i < CSO_CACHE_HUNKS; i++) {
+        if (cso->cache[i].hunk == hunk)
+            return &cso->cache[i];
+    }
+
+    return NULL;
+}
+
+
+/* Must be called with the mutex held. */
+static void
+cso_cache_insert(cso_t *cso, int64_t hunk, const uint8_t *data)
+{
+    cso_hunk_t *h = cso_cache_find(cso, hunk);
+    int i;
+
+    if (h == NULL) {
+        h = &cso->cache[0];
+        for (i = 1; i < CSO_CACHE_HUNKS; i++) {
+            if ((int32_t) (cso->cache[i].stamp - h->stamp) < 0)
+                h = &cso->cache[i];
+        }
+        memcpy(h->data, data, cso->hunk_size);
+        h->hunk = hunk;
+    }
+
+    h->stamp = cso->stamp++;
+}
+
+
+static void
+cso_readahead_thread(void *p)
+{
+    cso_t *cso = (cso_t *) p;
+    cso_decoder_t dec;
+    uint8_t *buf;
+    uint32_t hunk;
+
+    buf = (uint8_t *) malloc(cso->hunk_size);
+    if ((buf == NULL) || !cso_decoder_init(cso, &dec)) {
+        free(buf);
+        return;
+    }
+
+    while (cso->ra_run) {
+        thread_reset_event(cso->ra_event);
+
+        thread_wait_mutex(cso->mutex);
+        while ((cso->ra_next < cso->ra_end) && cso_cache_find(cso, cso->ra_next))
+            cso->ra_next++;
+        if (cso->ra_next >= cso->ra_end) {
+            thread_release_mutex(cso->mutex);
+            thread_wait_event(cso->ra_event, -1);
+            continue;
+        }
+        hunk = cso->ra_next++;
+        thread_release_mutex(cso->mutex);
+
+        if (!cso_decode_hunk(cso, &dec, hunk, buf))
+            continue;
+
+        thread_wait_mutex(cso->mutex);
+        /* Do not push out what the reader still needs if it jumped away. */
+        if (((int64_t) hunk > cso->last_hunk) && (hunk < cso->ra_end))
+            cso_cache_insert(cso, hunk, buf);
+        thread_release_mutex(cso->mutex);
+    }
+
+    cso_decoder_close(&dec);
+    free(buf);
+}
+
+
+static int
+cso_read(void *p, uint8_t *buffer, uint64_t seek, size_t count)
+{
+    cso_t *cso = (cso_t *) p;
+    cso_hunk_t *h;
+    uint64_t hunk, offs;
+    size_t len;
+    int ret = 1;
+
+    if ((seek + count) > cso->total)
+        return 0;
+
+    thread_wait_mutex(cso->mutex);
+
+    while (count) {
+        hunk = seek / cso->hunk_size;
+        offs = seek % cso->hunk_size;
+        len = MIN(count, cso->hunk_size - offs);
+
+        /* Start reading ahead once the access pattern is sequential. */
+        if (hunk == (uint64_t) (cso->last_hunk + 1)) {
+            if ((cso->ra_next < (hunk + 1)) || (cso->ra_next > (hunk + 1 + CSO_READAHEAD)))
+                cso->ra_next = hunk + 1;
+            cso->ra_end = MIN(hunk + 1 + CSO_READAHEAD, cso->hunks);
+            thread_set_event(cso->ra_event);
+        }
+        cso->last_hunk = hunk;
+
+        h = cso_cache_find(cso, hunk);
+        if (h == NULL) {
+            /* Decompress without holding up the read-ahead workers. */
+            thread_release_mutex(cso->mutex);
+            thread_wait_mutex(cso->dec_mutex);
+            ret = cso_decode_hunk(cso, &cso->dec, hunk, cso->hunk_buf);
+            if (ret) {
+                thread_wait_mutex(cso->mutex);
+                cso_cache_insert(cso, hunk, cso->hunk_buf);
+                h = cso_cache_find(cso, hunk);
+            }
+            thread_release_mutex(cso->dec_mutex);
+            if (!ret)
+                return 0;
+        } else
+            h->stamp = cso->stamp++;
+
+        memcpy(buffer, &h->data[offs], len);
+        buffer += len;
+        seek += len;
+        count -= len;
+    }
+
+    thread_release_mutex(cso->mutex);
+
+    return ret;
+}
+
+
+static uint64_t
+cso_get_length(void *p)
+{
+    cso_t *cso = (cso_t *) p;
+
+    return cso->total;
+}
+
+
+static void
+cso_close(void *p)
+{
+    cso_t *cso = (cso_t *) p;
+    int i;
+
+    if (cso == NULL)
+        return;
+
+    cso->ra_run = 0;
+    for (i = 0; i < CSO_THREADS; i++) {
+        if (cso->ra_thread[i] != NULL) {
+            thread_set_event(cso->ra_event);
+            thread_wait(cso->ra_thread[i]);
+        }
+    }
+
+    if (cso->ra_event != NULL)
+        thread_destroy_event(cso->ra_event);
+    if (cso->mutex != NULL)
+        thread_close_mutex(cso->mutex);
+    if (cso->dec_mutex != NULL)
+        thread_close_mutex(cso->dec_mutex);
+
+    cso_decoder_close(&cso->dec);
+
+    for (i = 0; i < CSO_CACHE_HUNKS; i++)
+        free(cso->cache[i].data);
+    free(cso->hunk_buf);
+    free(cso->index);
+
+    free(cso);
+}
+
+
+int
+cso_probe(const char *filename)
+{
+    uint8_t magic[4];
+    FILE *f;
+    int ret;
+
+    f = plat_fopen64(filename, "rb");
+    if (f == NULL)
+        return 0;
+
+    ret = (fread(magic, 1, 4, f) == 4) && !memcmp(magic, "CISO", 4);
+    fclose(f);
+
+    return ret;
+}
+
+
+track_file_t *
+cso_init(const char *filename, int *error)
+{
+    cso_t *cso = (cso_t *) calloc(1, sizeof(cso_t));
+    uint8_t hdr[CSO_HEADER_SIZE], *idx = NULL;
+    uint32_t i;
+
+    *error = 1;
+
+    if (cso == NULL)
+        return NULL;
+
+    strncpy(cso->tf.fn, filename, sizeof(cso->tf.fn) - 1);
+    cso->tf.read = cso_read;
+    cso->tf.get_length = cso_get_length;
+    cso->tf.close = cso_close;
+
+    if (!cso_decoder_init(cso, &cso->dec))
+        goto fail;
+    cso->tf.file = cso->dec.file;
+
+    if ((fread(hdr, 1, sizeof(hdr), cso->dec.file) != sizeof(hdr)) || memcmp(hdr, "CISO", 4))
+        goto fail;
+
+    cso->total = cso_get32(&hdr[8]) | ((uint64_t) cso_get32(&hdr[12]) << 32);
+    cso->block_size = cso_get32(&hdr[16]);
+    cso->align = hdr[21];
+
+    /* Version 2 adds LZ4 blocks, which are not supported. */
+    if ((hdr[20] > 1) || (cso->block_size == 0) || (cso->block_size > (1 << 20)) ||
+        (cso->total == 0)) {
+        cdrom_image_cso_log("CSO: Unsupported image (version %i, block size %u)\n",
+                            hdr[20], cso->block_size);
+        goto fail;
+    }
+
+    cso->blocks = (uint32_t) ((cso->total + cso->block_size - 1) / cso->block_size);
+    cso->hunks = (cso->blocks + CSO_HUNK_BLOCKS - 1) / CSO_HUNK_BLOCKS;
+    cso->hunk_size = cso->block_size * CSO_HUNK_BLOCKS;
+
+    cso->index = (uint32_t *) malloc((cso->blocks + 1) * sizeof(uint32_t));
+    idx = (uint8_t *) malloc((cso->blocks + 1) * 4);
+    if ((cso->index == NULL) || (idx == NULL) ||
+        (fread(idx, 4, cso->blocks + 1, cso->dec.file) != (cso->blocks + 1)))
+        goto fail;
+    for (i = 0; i <= cso->blocks; i++)
+        cso->index[i] = cso_get32(&idx[i * 4]);
+    free(idx);
+    idx = NULL;
+
+    cso->hunk_buf = (uint8_t *) malloc(cso->hunk_size);
+    if (cso->hunk_buf == NULL)
+        goto fail;
+    for (i = 0; i < CSO_CACHE_HUNKS; i++) {
+        cso->cache[i].hunk = -1;
+        cso->cache[i].data = (uint8_t *) malloc(cso->hunk_size);
+        if (cso->cache[i].data == NULL)
+            goto fail;
+    }
+
+    cso->last_hunk = -1;
+    cso->mutex = thread_create_mutex();
+    cso->dec_mutex = thread_create_mutex();
+    cso->ra_event = thread_create_event();
+    cso->ra_run = 1;
+    for (i = 0; i < CSO_THREADS; i++)
+        cso->ra_thread[i] = thread_create(cso_readahead_thread, cso);
+
+    cdrom_image_cso_log("CSO: %s: %" PRIu64 " bytes, %u blocks of %u\n",
+                        filename, cso->total, cso->blocks, cso->block_size);
+
+    *error = 0;
+    return &cso->tf;
+
+fail:
+    free(idx);
+    cso_close(cso);
+    return NULL;
+}
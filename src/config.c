@@ -877,6 +877,9 @@ load_machine(void)
 
     cpu_use_dynarec = !!config_get_int(cat, "cpu_use_dynarec", 0);
 
+    mem_huge_pages = !!config_get_int(cat, "mem_huge_pages", 0);
+    mem_reclaim = !!config_get_int(cat, "mem_reclaim", 0);
+
     p = config_get_string(cat, "time_sync", NULL);
     if (p != NULL) {
 	if (!strcmp(p, "disabled"))
@@ -1071,6 +1074,11 @@ load_sound(void)
 	sound_is_float = 1;
       else
 	sound_is_float = 0;
+
+    sound_buffer_ms = config_get_int(cat, "sound_buffer_ms", 20);
+    sound_buffers = config_get_int(cat, "sound_buffers", 4);
+    sound_out_rate = config_get_int(cat, "sound_out_rate", 48000);
+    sound_adaptive = !!config_get_int(cat, "sound_adaptive", 1);
 }
 
 
@@ -1079,47 +1087,87 @@ static void
 load_network(void)
 {
     char *cat = "Network";
-    char *p;
+    char temp[512], *p;
+    netcard_conf_t *nc;
+    int c;
 
-    p = config_get_string(cat, "net_type", NULL);
-    if (p != NULL) {
-	if (!strcmp(p, "pcap") || !strcmp(p, "1"))
-		network_type = NET_TYPE_PCAP;
-	else
-	if (!strcmp(p, "slirp") || !strcmp(p, "2"))
-		network_type = NET_TYPE_SLIRP;
-	else
-		network_type = NET_TYPE_NONE;
-    } else
-	network_type = NET_TYPE_NONE;
+    for (c = 0; c < NET_CARD_MAX; c++) {
+	nc = &net_cards_conf[c];
 
-    memset(network_host, '\0', sizeof(network_host));
-    p = config_get_string(cat, "net_host_device", NULL);
-    if (p == NULL) {
-	p = config_get_string(cat, "net_host_device", NULL);
+	sprintf(temp, "net_%02i_card", c + 1);
+	p = config_get_string(cat, temp, NULL);
+	/* The first adapter may still use the old single-card keys. */
+	if ((p == NULL) && (c == 0)) {
+		p = config_get_string(cat, "net_card", NULL);
+		if (p != NULL)
+			config_delete_var(cat, "net_card");
+	}
 	if (p != NULL)
-		config_delete_var(cat, "net_host_device");
-    }
-    if (p != NULL) {
-	if ((network_dev_to_id(p) == -1) || (network_ndev == 1)) {
-		if ((network_ndev == 1) && strcmp(network_host, "none")) {
-			ui_msgbox_header(MBX_ERROR, (wchar_t *) IDS_2094, (wchar_t *) IDS_2129);
-		} else if (network_dev_to_id(p) == -1) {
-			ui_msgbox_header(MBX_ERROR, (wchar_t *) IDS_2095, (wchar_t *) IDS_2129);
+		nc->device_num = network_card_get_from_internal_name(p);
+	  else
+		nc->device_num = 0;
+
+	sprintf(temp, "net_%02i_net_type", c + 1);
+	p = config_get_string(cat, temp, NULL);
+	if ((p == NULL) && (c == 0)) {
+		p = config_get_string(cat, "net_type", NULL);
+		if (p != NULL)
+			config_delete_var(cat, "net_type");
+	}
+	if (p != NULL) {
+		if (!strcmp(p, "pcap") || !strcmp(p, "1"))
+			nc->net_type = NET_TYPE_PCAP;
+		else
+		if (!strcmp(p, "slirp") || !strcmp(p, "2"))
+			nc->net_type = NET_TYPE_SLIRP;
+		else
+		if (!strcmp(p, "vswitch") || !strcmp(p, "3"))
+			nc->net_type = NET_TYPE_VSWITCH;
+		else
+			nc->net_type = NET_TYPE_NONE;
+	} else
+		nc->net_type = NET_TYPE_NONE;
+
+	memset(nc->host_dev_name, '\0', sizeof(nc->host_dev_name));
+	sprintf(temp, "net_%02i_host_device", c + 1);
+	p = config_get_string(cat, temp, NULL);
+	if ((p == NULL) && (c == 0)) {
+		p = config_get_string(cat, "net_host_device", NULL);
+		if (p != NULL)
+			config_delete_var(cat, "net_host_device");
+	}
+	if ((p != NULL) && (nc->net_type == NET_TYPE_VSWITCH)) {
+		/* This is the switch name, not a host interface. */
+		strncpy(nc->host_dev_name, p, sizeof(nc->host_dev_name) - 1);
+	} else if (p != NULL) {
+		if ((network_dev_to_id(p) == -1) || (network_ndev == 1)) {
+			if ((network_ndev == 1) && strcmp(p, "none")) {
+				ui_msgbox_header(MBX_ERROR, (wchar_t *) IDS_2094, (wchar_t *) IDS_2129);
+			} else if (network_dev_to_id(p) == -1) {
+				ui_msgbox_header(MBX_ERROR, (wchar_t *) IDS_2095, (wchar_t *) IDS_2129);
+			}
+
+			strcpy(nc->host_dev_name, "none");
+		} else {
+			strncpy(nc->host_dev_name, p, sizeof(nc->host_dev_name) - 1);
 		}
+	} else
+		strcpy(nc->host_dev_name, "none");
 
-		strcpy(network_host, "none");
-	} else {
-		strncpy(network_host, p, sizeof(network_host) - 1);
+	sprintf(temp, "net_%02i_link_rate", c + 1);
+	nc->link_rate = config_get_int(cat, temp, 0);
+	if ((nc->link_rate == 0) && (c == 0)) {
+		nc->link_rate = config_get_int(cat, "net_link_rate", 0);
+		config_delete_var(cat, "net_link_rate");
 	}
-    } else
-	strcpy(network_host, "none");
 
-    p = config_get_string(cat, "net_card", NULL);
-    if (p != NULL)
-	network_card = network_card_get_from_internal_name(p);
-      else
-	network_card = 0;
+	sprintf(temp, "net_%02i_pcap_mmap_ring", c + 1);
+	nc->pcap_mmap_ring = !!config_get_int(cat, temp, 0);
+	if (!nc->pcap_mmap_ring && (c == 0)) {
+		nc->pcap_mmap_ring = !!config_get_int(cat, "pcap_mmap_ring", 0);
+		config_delete_var(cat, "pcap_mmap_ring");
+	}
+    }
 }
 
 
@@ -2444,6 +2492,16 @@ save_machine(void)
 
     config_set_int(cat, "cpu_use_dynarec", cpu_use_dynarec);
 
+    if (mem_huge_pages)
+	config_set_int(cat, "mem_huge_pages", mem_huge_pages);
+    else
+	config_delete_var(cat, "mem_huge_pages");
+
+    if (mem_reclaim)
+	config_set_int(cat, "mem_reclaim", mem_reclaim);
+    else
+	config_delete_var(cat, "mem_reclaim");
+
     if (time_sync & TIME_SYNC_ENABLED)
 	if (time_sync & TIME_SYNC_UTC)
 		config_set_string(cat, "time_sync", "utc");
@@ -2589,6 +2647,26 @@ save_sound(void)
       else
 	config_set_string(cat, "sound_type", (sound_is_float == 1) ? "float" : "int16");
 
+    if (sound_buffer_ms == 20)
+	config_delete_var(cat, "sound_buffer_ms");
+      else
+	config_set_int(cat, "sound_buffer_ms", sound_buffer_ms);
+
+    if (sound_buffers == 4)
+	config_delete_var(cat, "sound_buffers");
+      else
+	config_set_int(cat, "sound_buffers", sound_buffers);
+
+    if (sound_out_rate == 48000)
+	config_delete_var(cat, "sound_out_rate");
+      else
+	config_set_int(cat, "sound_out_rate", sound_out_rate);
+
+    if (sound_adaptive == 1)
+	config_delete_var(cat, "sound_adaptive");
+      else
+	config_set_int(cat, "sound_adaptive", sound_adaptive);
+
     delete_section_if_empty(cat);
 }
 
@@ -2598,28 +2676,56 @@ static void
 save_network(void)
 {
     char *cat = "Network";
+    char temp[512];
+    netcard_conf_t *nc;
+    int c;
 
-    if (network_type == NET_TYPE_NONE)
-	config_delete_var(cat, "net_type");
-      else
-	config_set_string(cat, "net_type",
-		(network_type == NET_TYPE_SLIRP) ? "slirp" : "pcap");
+    for (c = 0; c < NET_CARD_MAX; c++) {
+	nc = &net_cards_conf[c];
 
-    if (network_host[0] != '\0') {
-	if (! strcmp(network_host, "none"))
-		config_delete_var(cat, "net_host_device");
+	sprintf(temp, "net_%02i_card", c + 1);
+	if (nc->device_num == 0) {
+		config_delete_var(cat, temp);
+		/* The rest of an unused slot is not saved either. */
+		sprintf(temp, "net_%02i_net_type", c + 1);
+		config_delete_var(cat, temp);
+		sprintf(temp, "net_%02i_host_device", c + 1);
+		config_delete_var(cat, temp);
+		sprintf(temp, "net_%02i_link_rate", c + 1);
+		config_delete_var(cat, temp);
+		sprintf(temp, "net_%02i_pcap_mmap_ring", c + 1);
+		config_delete_var(cat, temp);
+		continue;
+	}
+	config_set_string(cat, temp,
+			  network_card_get_internal_name(nc->device_num));
+
+	sprintf(temp, "net_%02i_net_type", c + 1);
+	if (nc->net_type == NET_TYPE_NONE)
+		config_delete_var(cat, temp);
 	  else
-		config_set_string(cat, "net_host_device", network_host);
-    } else {
-	/* config_set_string(cat, "net_host_device", "none"); */
-	config_delete_var(cat, "net_host_device");
-    }
+		config_set_string(cat, temp,
+			(nc->net_type == NET_TYPE_SLIRP) ? "slirp" :
+			((nc->net_type == NET_TYPE_VSWITCH) ? "vswitch" : "pcap"));
 
-    if (network_card == 0)
-	config_delete_var(cat, "net_card");
-      else
-	config_set_string(cat, "net_card",
-			  network_card_get_internal_name(network_card));
+	sprintf(temp, "net_%02i_host_device", c + 1);
+	if ((nc->host_dev_name[0] != '\0') && strcmp(nc->host_dev_name, "none"))
+		config_set_string(cat, temp, nc->host_dev_name);
+	  else
+		config_delete_var(cat, temp);
+
+	sprintf(temp, "net_%02i_link_rate", c + 1);
+	if (nc->link_rate == 0)
+		config_delete_var(cat, temp);
+	  else
+		config_set_int(cat, temp, nc->link_rate);
+
+	sprintf(temp, "net_%02i_pcap_mmap_ring", c + 1);
+	if (nc->pcap_mmap_ring == 0)
+		config_delete_var(cat, temp);
+	  else
+		config_set_int(cat, temp, nc->pcap_mmap_ring);
+    }
 
     delete_section_if_empty(cat);
 }
@@ -123,7 +123,7 @@ static int opMOV_CRx_r_a16(uint32_t fetchdat)
         switch (cpu_reg)
         {
                 case 0:
-                if ((cpu_state.regs[cpu_rm].l ^ cr0) & 0x80000001)
+                if ((cpu_state.regs[cpu_rm].l ^ cr0) & (0x80000001 | WP_FLAG))
                         flushmmucache();
 		/* Make sure CPL = 0 when switching from real mode to protected mode. */
 		if ((cpu_state.regs[cpu_rm].l & 0x01) && !(cr0 & 0x01))
@@ -149,12 +149,12 @@ static int opMOV_CRx_r_a16(uint32_t fetchdat)
                 break;
                 case 3:
                 cr3 = cpu_state.regs[cpu_rm].l;
-                flushmmucache();
+                mmu_switch_cr3();
                 break;
                 case 4:
                 if (cpu_has_feature(CPU_FEATURE_CR4))
                 {
-	                if (((cpu_state.regs[cpu_rm].l ^ cr4) & cpu_CR4_mask) & CR4_PAE)
+	                if (((cpu_state.regs[cpu_rm].l ^ cr4) & cpu_CR4_mask) & (CR4_PAE | CR4_PSE))
         	                flushmmucache();
                         cr4 = cpu_state.regs[cpu_rm].l & cpu_CR4_mask;
                         break;
@@ -182,7 +182,7 @@ static int opMOV_CRx_r_a32(uint32_t fetchdat)
         switch (cpu_reg)
         {
                 case 0:
-                if ((cpu_state.regs[cpu_rm].l ^ cr0) & 0x80000001)
+                if ((cpu_state.regs[cpu_rm].l ^ cr0) & (0x80000001 | WP_FLAG))
                         flushmmucache();
 		/* Make sure CPL = 0 when switching from real mode to protected mode. */
 		if ((cpu_state.regs[cpu_rm].l & 0x01) && !(cr0 & 0x01))
@@ -208,12 +208,12 @@ static int opMOV_CRx_r_a32(uint32_t fetchdat)
                 break;
                 case 3:
                 cr3 = cpu_state.regs[cpu_rm].l;
-                flushmmucache();
+                mmu_switch_cr3();
                 break;
                 case 4:
                 if (cpu_has_feature(CPU_FEATURE_CR4))
                 {
-	                if (((cpu_state.regs[cpu_rm].l ^ cr4) & cpu_CR4_mask) & CR4_PAE)
+	                if (((cpu_state.regs[cpu_rm].l ^ cr4) & cpu_CR4_mask) & (CR4_PAE | CR4_PSE))
         	                flushmmucache();
                         cr4 = cpu_state.regs[cpu_rm].l & cpu_CR4_mask;
                         break;
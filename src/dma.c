@@ -1659,16 +1659,23 @@ dma_mode(int channel)
 void
 dma_bm_read(uint32_t PhysAddress, uint8_t *DataRead, uint32_t TotalSize, int TransferSize)
 {
-    uint32_t i = 0, n, n2;
+    uint32_t i = 0, n, n2, run;
     uint8_t bytes[4] = { 0, 0, 0, 0 };
+    uint8_t *p;
 
     n = TotalSize & ~(TransferSize - 1);
     n2 = TotalSize - n;
 
-    /* Do the divisible block, if there is one. */
-    if (n) {
-	for (i = 0; i < n; i += TransferSize)
+    /* Do the divisible block, if there is one, copying whole runs of RAM at once. */
+    while (i < n) {
+	run = mem_get_bus_run(PhysAddress + i, n - i, 0, &p) & ~(TransferSize - 1);
+	if (run) {
+		memcpy(&(DataRead[i]), p, run);
+		i += run;
+	} else {
 		mem_read_phys((void *) &(DataRead[i]), PhysAddress + i, TransferSize);
+		i += TransferSize;
+	}
     }
 
     /* Do the non-divisible block, if there is one. */
@@ -1682,16 +1689,23 @@ dma_bm_read(uint32_t PhysAddress, uint8_t *DataRead, uint32_t TotalSize, int Tra
 void
 dma_bm_write(uint32_t PhysAddress, const uint8_t *DataWrite, uint32_t TotalSize, int TransferSize)
 {
-    uint32_t i = 0, n, n2;
+    uint32_t i = 0, n, n2, run;
     uint8_t bytes[4] = { 0, 0, 0, 0 };
+    uint8_t *p;
 
     n = TotalSize & ~(TransferSize - 1);
     n2 = TotalSize - n;
 
-    /* Do the divisible block, if there is one. */
-    if (n) {
-	for (i = 0; i < n; i += TransferSize)
+    /* Do the divisible block, if there is one, copying whole runs of RAM at once. */
+    while (i < n) {
+	run = mem_get_bus_run(PhysAddress + i, n - i, 1, &p) & ~(TransferSize - 1);
+	if (run) {
+		memcpy(p, &(DataWrite[i]), run);
+		i += run;
+	} else {
 		mem_write_phys((void *) &(DataWrite[i]), PhysAddress + i, TransferSize);
+		i += TransferSize;
+	}
     }
 
     /* Do the non-divisible block, if there is one. */
@@ -0,0 +1,214 @@
+/*
+ * 86Box	A hypervisor and IBM PC system emulator that specializes in
+ *		running old operating systems and software designed for IBM
+ *		PC systems and compatibles from 1981 through fairly recent
+ *		system designs based on the PCI bus.
+ *
+ *		This file is part of the 86Box distribution.
+ *
+ *		Export of the emulated screen through POSIX shared memory.
+ *
+ *		Every blitted frame is copied on the emulation thread into
+ *		one of three slots of a shared mapping, described by the
+ *		header in fbexport.h, so that external tools can read the
+ *		screen at full rate without going through VNC or PNG files.
+ *		Nothing waits on the readers: each slot carries a sequence
+ *		count that tells them whether the frame they looked at was
+ *		overwritten in the meantime.
+ */
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#ifndef _WIN32
+#    include <fcntl.h>
+#    include <limits.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <time.h>
+#    include <unistd.h>
+#endif
+#ifdef __linux__
+#    include <linux/futex.h>
+#    include <sys/syscall.h>
+#endif
+
+#include <86box/86box.h>
+#include <86box/plat.h>
+#include <86box/video.h>
+#include <86box/fbexport.h>
+
+volatile int fbexport_on = 0;
+
+#ifndef _WIN32
+static char                     fbexport_name[256];
+static volatile fbexport_hdr_t *fbexport_hdr;
+static uint8_t                 *fbexport_data;
+static uint64_t                 fbexport_frames;
+#endif
+
+#ifdef ENABLE_FBEXPORT_LOG
+int fbexport_do_log = ENABLE_FBEXPORT_LOG;
+
+static void
+fbexport_log(const char *fmt, ...)
+{
+    va_list ap;
+
+    if (fbexport_do_log) {
+        va_start(ap, fmt);
+        pclog_ex(fmt, ap);
+        va_end(ap);
+    }
+}
+#else
+#    define fbexport_log(fmt, ...)
+#endif
+
+#ifndef _WIN32
+/* Let readers blocked on the frame counter know something changed. */
+static void
+fbexport_wake(void)
+{
+#    ifdef __linux__
+    syscall(SYS_futex, &fbexport_hdr->frames, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#    endif
+}
+#endif
+
+/*
+ * Publish a frame from buffer32. Called from video_blit_memtoscreen()
+ * on the emulation thread, before the renderer gets the buffer.
+ */
+void
+fbexport_frame(int x, int y, int w, int h)
+{
+#ifndef _WIN32
+    volatile fbexport_hdr_t  *hdr = fbexport_hdr;
+    volatile fbexport_slot_t *slot;
+    struct timespec           now;
+    uint32_t                  idx, seq;
+    uint8_t                  *dst;
+    int                       yy;
+
+    if (!fbexport_on || !buffer32 || (w <= 0) || (h <= 0))
+        return;
+
+    w = MIN(w, FBEXPORT_MAX_X);
+    h = MIN(h, FBEXPORT_MAX_Y);
+
+    /* Fill the slot after the newest, leaving the other two alone. */
+    idx  = (hdr->latest + 1) % FBEXPORT_BUFS;
+    slot = &hdr->slots[idx];
+    dst  = fbexport_data + (idx * hdr->buf_size);
+
+    seq       = slot->seq;
+    slot->seq = seq + 1;
+    atomic_thread_fence(memory_order_release);
+
+    for (yy = 0; yy < h; yy++)
+        memcpy(dst + (yy * hdr->stride), &buffer32->line[y + yy][x], w * sizeof(uint32_t));
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    slot->w     = w;
+    slot->h     = h;
+    slot->frame = ++fbexport_frames;
+    slot->ts    = ((uint64_t) now.tv_sec * 1000000000ULL) + now.tv_nsec;
+
+    atomic_thread_fence(memory_order_release);
+    slot->seq   = seq + 2;
+    hdr->latest = idx;
+    atomic_thread_fence(memory_order_release);
+    hdr->frames++;
+
+    fbexport_wake();
+#endif
+}
+
+int
+fbexport_start(const char *name)
+{
+#ifdef _WIN32
+    pclog("FBEXPORT: shared memory export is not available on this platform\n");
+    return 0;
+#else
+    size_t  stride = FBEXPORT_MAX_X * sizeof(uint32_t);
+    size_t  offs   = (sizeof(fbexport_hdr_t) + 4095) & ~4095;
+    size_t  size   = offs + (FBEXPORT_BUFS * stride * FBEXPORT_MAX_Y);
+    uint8_t *p;
+    int     fd;
+
+    if (fbexport_on)
+        return 1;
+
+    /* Shared memory object names start with a slash. */
+    snprintf(fbexport_name, sizeof(fbexport_name), "%s%s", (name[0] == '/') ? "" : "/", name);
+
+    fd = shm_open(fbexport_name, O_CREAT | O_RDWR, 0600);
+    if (fd < 0)
+        return 0;
+
+    /* Pages are only backed once a frame of that size was written. */
+    if (ftruncate(fd, size) < 0) {
+        close(fd);
+        shm_unlink(fbexport_name);
+        return 0;
+    }
+
+    p = (uint8_t *) mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        shm_unlink(fbexport_name);
+        return 0;
+    }
+
+    fbexport_hdr  = (volatile fbexport_hdr_t *) p;
+    fbexport_data = p + offs;
+
+    memset(p, 0, sizeof(fbexport_hdr_t));
+    fbexport_hdr->version   = FBEXPORT_VERSION;
+    fbexport_hdr->size      = size;
+    fbexport_hdr->nbufs     = FBEXPORT_BUFS;
+    fbexport_hdr->max_w     = FBEXPORT_MAX_X;
+    fbexport_hdr->max_h     = FBEXPORT_MAX_Y;
+    fbexport_hdr->stride    = stride;
+    fbexport_hdr->format    = 0;
+    fbexport_hdr->data_offs = offs;
+    fbexport_hdr->buf_size  = stride * FBEXPORT_MAX_Y;
+    fbexport_hdr->latest    = FBEXPORT_BUFS - 1;
+    fbexport_frames         = 0;
+
+    /* The magic goes in last, readers check it before anything else. */
+    atomic_thread_fence(memory_order_release);
+    fbexport_hdr->magic = FBEXPORT_MAGIC;
+
+    fbexport_log("FBEXPORT: exporting to %s\n", fbexport_name);
+    fbexport_on = 1;
+
+    return 1;
+#endif
+}
+
+void
+fbexport_stop(void)
+{
+#ifndef _WIN32
+    if (!fbexport_on)
+        return;
+
+    fbexport_on = 0;
+
+    /* Readers that still have it mapped see the export is gone. */
+    fbexport_hdr->magic = 0;
+    fbexport_hdr->frames++;
+    fbexport_wake();
+
+    munmap((void *) fbexport_hdr, fbexport_hdr->size);
+    shm_unlink(fbexport_name);
+    fbexport_hdr  = NULL;
+    fbexport_data = NULL;
+#endif
+}
@@ -108,6 +108,10 @@ extern int	serial_enabled[],		/* (C) enable serial ports */
 		isamem_type[],			/* (C) enable ISA mem cards */
 		isartc_type;			/* (C) enable ISA RTC card */
 extern int	sound_is_float,			/* (C) sound uses FP values */
+		sound_buffer_ms,		/* (C) sound buffer length */
+		sound_buffers,			/* (C) sound buffers queued */
+		sound_out_rate,			/* (C) sound output rate */
+		sound_adaptive,			/* (C) adapt queue to underruns */
 		GAMEBLASTER,			/* (C) sound option */
 		GUS, GUSMAX,			/* (C) sound option */
 		SSI2001,			/* (C) sound option */
@@ -116,13 +120,12 @@ extern int	sound_is_float,			/* (C) sound uses FP values */
 		xga_enabled;            /* (C) video option */
 extern uint32_t	mem_size;			/* (C) memory size (Installed on system board) */
 extern uint32_t	isa_mem_size;		/* (C) memory size (ISA Memory Cards) */
+extern int	mem_huge_pages,			/* (C) back guest RAM with huge pages */
+		mem_reclaim;			/* (C) give zeroed guest RAM back to the host */
 extern int	cpu,				/* (C) cpu type */
 		cpu_use_dynarec,		/* (C) cpu uses/needs Dyna */
 		fpu_type;			/* (C) fpu type */
 extern int	time_sync;			/* (C) enable time sync */
-extern int	network_type;			/* (C) net provider type */
-extern int	network_card;			/* (C) net interface num */
-extern char	network_host[522];		/* (C) host network intf */
 extern int	hdd_format_type;		/* (C) hard disk file format */
 extern int	confirm_reset,			/* (C) enable reset confirmation */
 		confirm_exit,			/* (C) enable exit confirmation */
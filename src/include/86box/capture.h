@@ -0,0 +1,39 @@
+/*
+ * 86Box	A hypervisor and IBM PC system emulator that specializes in
+ *		running old operating systems and software designed for IBM
+ *		PC systems and compatibles from 1981 through fairly recent
+ *		system designs based on the PCI bus.
+ *
+ *		This file is part of the 86Box distribution.
+ *
+ *		Definitions for the audio/video capture module.
+ */
+#ifndef EMU_CAPTURE_H
+#define EMU_CAPTURE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Audio that reaches the output without going through the mix. */
+enum {
+    CAPTURE_STREAM_MIX = 0,
+    CAPTURE_STREAM_CD,
+    CAPTURE_STREAM_MIDI,
+    CAPTURE_STREAMS
+};
+
+extern volatile int capture_on;
+
+extern int  capture_start(const char *path);
+extern void capture_stop(void);
+
+extern void capture_audio(const int32_t *buf, int len);
+extern void capture_stream(int stream, int rate, const void *buf, int frames);
+extern void capture_video(int x, int y, int w, int h);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*EMU_CAPTURE_H*/
@@ -39,7 +39,10 @@
 #define CD_TOC_SESSION			1
 #define CD_TOC_RAW			2
 
-#define BUF_SIZE 32768
+/* CD-DA read-ahead per drive, in sectors (4 seconds), and how long the CD
+   audio thread waits for it after a seek, in ms. */
+#define CD_PREFETCH_SECTORS		300
+#define CD_PREFETCH_WAIT		50
 
 #define CDROM_IMAGE 200
 
@@ -115,7 +118,7 @@ typedef struct cdrom {
              seek_diff, cd_end;
 
     int host_drive, prev_host_drive,
-        cd_buflen, noplay;
+        noplay;
 
     const cdrom_ops_t	*ops;
 
@@ -126,7 +129,7 @@ typedef struct cdrom {
     uint32_t	(*get_volume)(void *p, int channel);
     uint32_t	(*get_channel)(void *p, int channel);
 
-    int16_t cd_buffer[BUF_SIZE];
+    void	*audio_prefetch;
 } cdrom_t;
 
 
@@ -137,6 +140,8 @@ extern double	cdrom_seek_time(cdrom_t *dev);
 extern void	cdrom_stop(cdrom_t *dev);
 extern int	cdrom_is_pre(cdrom_t *dev, uint32_t lba);
 extern int	cdrom_audio_callback(cdrom_t *dev, int16_t *output, int len);
+extern void	cdrom_audio_restart(cdrom_t *dev);
+extern void	cdrom_audio_halt(cdrom_t *dev);
 extern uint8_t	cdrom_audio_play(cdrom_t *dev, uint32_t pos, uint32_t len, int ismsf);
 extern uint8_t	cdrom_audio_track_search(cdrom_t *dev, uint32_t pos, int type, uint8_t playbit);
 extern uint8_t	cdrom_toshiba_audio_play(cdrom_t *dev, uint32_t pos, int type);
@@ -89,5 +89,9 @@ extern int      cdi_load_cue(cd_img_t *cdi, const char *cuefile);
 extern int      cdi_has_data_track(cd_img_t *cdi);
 extern int      cdi_has_audio_track(cd_img_t *cdi);
 
+/* Compressed (CISO) track files. */
+extern int      cso_probe(const char *filename);
+extern track_file_t *cso_init(const char *filename, int *error);
+
 
 #endif /*CDROM_IMAGE_BACKEND_H*/
@@ -0,0 +1,83 @@
+/*
+ * 86Box	A hypervisor and IBM PC system emulator that specializes in
+ *		running old operating systems and software designed for IBM
+ *		PC systems and compatibles from 1981 through fairly recent
+ *		system designs based on the PCI bus.
+ *
+ *		This file is part of the 86Box distribution.
+ *
+ *		Definitions for the shared memory framebuffer export.
+ *
+ *		The layout below is what external readers see. It only uses
+ *		fixed size types so that tools can include this header on
+ *		its own.
+ */
+#ifndef EMU_FBEXPORT_H
+#define EMU_FBEXPORT_H
+
+#include <stdint.h>
+
+#define FBEXPORT_MAGIC   0x42463638 /* "86FB" */
+#define FBEXPORT_VERSION 2
+#define FBEXPORT_BUFS    3
+#define FBEXPORT_MAX_X   2048
+#define FBEXPORT_MAX_Y   2048
+
+/*
+ * One frame slot. The writer makes seq odd while it fills the slot and
+ * even again once done; a reader copies or inspects the pixels and then
+ * checks that seq did not change. The writer always fills the slot after
+ * the newest, so a frame stays intact for two more frame periods.
+ */
+typedef struct {
+    uint32_t seq;
+    uint32_t w, h;   /* pixels, rows are still 'stride' bytes apart */
+    uint32_t pad;    /* keeps the 64-bit fields aligned on every ABI */
+    uint64_t frame;  /* running frame number */
+    uint64_t ts;     /* host monotonic time, ns */
+} fbexport_slot_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;      /* whole mapping, bytes */
+    uint32_t nbufs;
+    uint32_t max_w, max_h;
+    uint32_t stride;    /* bytes per row */
+    uint32_t format;    /* 0 = 32 bpp, 0x00RRGGBB in host order */
+    uint32_t data_offs; /* first slot's pixels from the start */
+    uint32_t buf_size;  /* bytes between slots' pixels */
+
+    /* Number of the newest complete slot. On Linux the frames counter
+       below doubles as a shared futex woken on every new frame. */
+    uint32_t latest;
+    uint32_t frames;
+
+    fbexport_slot_t slots[FBEXPORT_BUFS];
+} fbexport_hdr_t;
+
+/* Readers built with other compilers must see the same layout. */
+#ifdef __cplusplus
+static_assert(sizeof(fbexport_slot_t) == 32, "fbexport_slot_t layout");
+static_assert(sizeof(fbexport_hdr_t) == 144, "fbexport_hdr_t layout");
+#else
+_Static_assert(sizeof(fbexport_slot_t) == 32, "fbexport_slot_t layout");
+_Static_assert(sizeof(fbexport_hdr_t) == 144, "fbexport_hdr_t layout");
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern volatile int fbexport_on;
+
+extern int  fbexport_start(const char *name);
+extern void fbexport_stop(void);
+
+extern void fbexport_frame(int x, int y, int w, int h);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*EMU_FBEXPORT_H*/
@@ -135,6 +135,12 @@
 #define MEM_GRANULARITY_PAGE	(MEM_GRANULARITY_MASK & ~0xfff)
 #define MEM_GRANULARITY_BASE	(~MEM_GRANULARITY_MASK)
 
+/* Page attributes as seen from the bus, rebuilt by mem_mapping_recalc(). */
+#define MEM_PAGE_NONE		0	/* Nothing responds. */
+#define MEM_PAGE_RAM		1	/* Reads and writes go to the same host memory. */
+#define MEM_PAGE_ROM		2	/* ROM or shadowed ROM, only reads go to host memory. */
+#define MEM_PAGE_MMIO		3	/* Needs the mapping handlers. */
+
 /* Compatibility #defines. */
 #define mem_set_state(smm, mode, base, size, access) \
 	mem_set_access((smm ? ACCESS_SMM : ACCESS_NORMAL), mode, base, size, access)
@@ -158,8 +164,6 @@
 	mem_set_access((smm ? ACCESS_CPU_SMM : ACCESS_CPU), 1, base, size, is_smram)
 #define mem_set_access_smram_bus(smm, base, size, is_smram) \
 	mem_set_access((smm ? ACCESS_BUS_SMM : ACCESS_BUS), 1, base, size, is_smram)
-#define flushmmucache_cr3 \
-	flushmmucache_nopc
 
 
 typedef struct {
@@ -376,6 +380,8 @@ extern void	mem_mapping_recalc(uint64_t base, uint64_t size);
 
 extern void	mem_set_access(uint8_t bitmap, int mode, uint32_t base, uint32_t size, uint16_t access);
 
+extern uint8_t	mem_get_page_attr(uint32_t addr);
+extern uint32_t	mem_get_bus_run(uint32_t addr, uint32_t len, int write, uint8_t **ptr);
 extern uint8_t	mem_readb_phys(uint32_t addr);
 extern uint16_t	mem_readw_phys(uint32_t addr);
 extern uint32_t	mem_readl_phys(uint32_t addr);
@@ -414,6 +420,8 @@ extern void	mem_reset_page_blocks(void);
 
 extern void     flushmmucache(void);
 extern void	flushmmucache_nopc(void);
+extern void	flushmmucache_cr3(void);
+extern void	mmu_switch_cr3(void);
 extern void     mmu_invalidate(uint32_t addr);
 
 extern void	mem_a20_init(void);
@@ -422,6 +430,8 @@ extern void	mem_a20_recalc(void);
 extern void	mem_init(void);
 extern void	mem_close(void);
 extern void	mem_reset(void);
+extern uint64_t	mem_get_resident(void);
+extern void	mem_reclaim_zero_pages(uint32_t count);
 extern void	mem_remap_top(int kb);
 
 
@@ -184,6 +184,7 @@ typedef struct {
     int		tx_timer_active;
 
     void	*priv;
+    netcard_t	*card;
 
     void	(*interrupt)(void *priv, int set);
 } dp8390_t;
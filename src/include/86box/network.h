@@ -54,6 +54,7 @@
 #define NET_TYPE_NONE	0		/* networking disabled */
 #define NET_TYPE_PCAP	1		/* use the (Win)Pcap API */
 #define NET_TYPE_SLIRP	2		/* use the SLiRP port forwarder */
+#define NET_TYPE_VSWITCH 3		/* use the local virtual switch */
 
 /* Supported network cards. */
 enum {
@@ -70,21 +71,65 @@ typedef int (*NETWAITCB)(void *);
 typedef int (*NETSETLINKSTATE)(void *);
 
 
+/* Network adapters. */
+#define NET_CARD_MAX	4		/* adapters per machine */
+#define NET_HOST_INTF_MAX	522	/* length of a host interface name */
+
+/* Packet queues. */
+#define NET_QUEUE_RX	0		/* provider -> card */
+#define NET_QUEUE_TX	1		/* card -> provider */
+#define NET_QUEUE_COUNT	2
+
+#define NET_QUEUE_LEN	64		/* slots per queue, power of 2 */
+#define NET_MAX_FRAME	65536
+
+/* Receive pacing. */
+#define NET_LINK_SPEED_DEFAULT	10000	/* kbit/s, for cards that do not say */
+#define NET_RX_IDLE_US	200.0		/* tick while nothing can be delivered */
+#define NET_RX_MIN_US	10.0		/* shortest tick while frames are flowing */
+#define NET_BATCH	32		/* most frames delivered per tick */
+
+/* Capture directions, as seen from the guest. */
+#define NET_CAPTURE_RX	0
+#define NET_CAPTURE_TX	1
+
+
 typedef struct netpkt {
-    void		*priv;
-    uint8_t		data[65536];	/* Maximum length + 1 to round up to the nearest power of 2. */
+    uint8_t		data[NET_MAX_FRAME];	/* Maximum length + 1 to round up to the nearest power of 2. */
     int			len;
-
-    struct netpkt	*prev, *next;
 } netpkt_t;
 
+/* Configuration of one adapter slot. */
+typedef struct {
+    int			device_num;		/* index into the card list */
+    int			net_type;		/* NET_TYPE_xxx */
+    char		host_dev_name[NET_HOST_INTF_MAX];
+    int			link_rate;		/* Mbit/s, 0 = card, -1 = unlimited */
+    int			pcap_mmap_ring;		/* PCAP: read the kernel's packet ring */
+} netcard_conf_t;
+
+struct netcard_t;
+
+/* A host-side provider, one instance per adapter. */
 typedef struct {
+    void		*(*init)(const struct netcard_t *card, const uint8_t *mac, void *priv);
+    void		(*in)(void *priv, uint8_t *, int);
+    void		(*close)(void *priv);
+    void		(*notify_in)(void *priv);	/* optional, frames were released to in() */
+} netdrv_t;
+
+/* A running adapter, returned to the card by network_attach(). */
+typedef struct netcard_t {
     const device_t	*device;
     void		*priv;
-    int			(*poll)(void *);
     NETRXCB		rx;
     NETWAITCB		wait;
     NETSETLINKSTATE	set_link_state;
+    uint32_t		link_speed;	/* kbit/s */
+    int			card_num;
+    volatile int	rx_pause;
+    const netdrv_t	*drv;
+    void		*drv_priv;
 } netcard_t;
 
 typedef struct {
@@ -100,31 +145,25 @@ extern "C" {
 /* Global variables. */
 extern int	nic_do_log;				/* config */
 extern int      network_ndev;
-extern int	network_rx_pause;
 extern netdev_t network_devs[32];
+extern netcard_conf_t	net_cards_conf[NET_CARD_MAX];	/* (C) adapter slots */
 
 
 /* Function prototypes. */
-extern void	network_wait(uint8_t wait);
-
 extern void	network_init(void);
-extern void	network_attach(void *, uint8_t *, NETRXCB, NETWAITCB, NETSETLINKSTATE);
+extern netcard_t *network_attach(void *, uint8_t *, NETRXCB, NETWAITCB, NETSETLINKSTATE);
+extern void	network_detach(netcard_t *card);
+extern void	network_set_link_speed(netcard_t *card, uint32_t kbps);
 extern void	network_close(void);
 extern void	network_reset(void);
 extern int	network_available(void);
-extern void	network_tx(uint8_t *, int);
-extern int	network_tx_queue_check(void);
+extern void	network_tx(netcard_t *card, uint8_t *, int);
+extern int	network_tx_queue_check(const netcard_t *card);
 
 extern int	net_pcap_prepare(netdev_t *);
-extern int	net_pcap_init(void);
-extern int	net_pcap_reset(const netcard_t *, uint8_t *);
-extern void	net_pcap_close(void);
-extern void	net_pcap_in(uint8_t *, int);
-
-extern int	net_slirp_init(void);
-extern int	net_slirp_reset(const netcard_t *, uint8_t *);
-extern void	net_slirp_close(void);
-extern void	net_slirp_in(uint8_t *, int);
+extern const netdrv_t	net_pcap_drv;
+extern const netdrv_t	net_slirp_drv;
+extern const netdrv_t	net_vswitch_drv;
 
 extern int	network_dev_to_id(char *);
 extern int	network_card_available(int);
@@ -135,10 +174,16 @@ extern const device_t	*network_card_getdevice(int);
 
 extern void	network_set_wait(int wait);
 extern int	network_get_wait(void);
+extern int	network_card_inst(void);
 
 extern void	network_timer_stop(void);
 
-extern void	network_queue_put(int tx, void *priv, uint8_t *data, int len);
+extern void	network_queue_put(const netcard_t *card, int queue, uint8_t *data, int len);
+
+extern volatile int	net_capture_on;
+extern int	net_capture_start(const char *path);
+extern void	net_capture_stop(void);
+extern void	net_capture_frame(const netcard_t *card, int dir, const uint8_t *data, int len);
 
 #ifdef __cplusplus
 }
@@ -103,6 +103,7 @@ typedef struct emu8k_chorus_eng_t {
     int32_t chorus_left_buffer[EMU8K_LFOCHORUS_SIZE];
     int32_t chorus_right_buffer[EMU8K_LFOCHORUS_SIZE];
 
+    int quiet; /* samples since the last non-zero input */
 } emu8k_chorus_eng_t;
 
 /*  32 * 242. 32 comes from the "right" room resso case.*/
@@ -154,6 +155,8 @@ typedef struct emu8k_reverb_eng_t {
     emu8k_reverb_combfilter_t tailR;
 
     emu8k_reverb_combfilter_t damper;
+
+    int quiet; /* samples since the last non-zero input */
 } emu8k_reverb_eng_t;
 
 typedef struct emu8k_slide_t {
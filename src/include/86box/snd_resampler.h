@@ -0,0 +1,27 @@
+/*
+ * 86Box	A hypervisor and IBM PC system emulator that specializes in
+ *		running old operating systems and software designed for IBM
+ *		PC systems and compatibles from 1981 through fairly recent
+ *		system designs based on the PCI bus.
+ *
+ *		This file is part of the 86Box distribution.
+ *
+ *		Definitions for the shared polyphase resampler.
+ */
+
+#ifndef SOUND_RESAMPLER_H
+#define SOUND_RESAMPLER_H
+
+typedef struct resampler_t resampler_t;
+
+extern resampler_t *resampler_init(int channels, int in_rate, int out_rate);
+extern void         resampler_close(resampler_t *rs);
+
+extern void resampler_set_rates(resampler_t *rs, int in_rate, int out_rate);
+extern void resampler_reset(resampler_t *rs, int prime, const int16_t *frame);
+extern int  resampler_latency(resampler_t *rs);
+
+extern void resampler_push(resampler_t *rs, const int16_t *frame);
+extern int  resampler_pull(resampler_t *rs, float *out, int frames, int hold);
+
+#endif /*SOUND_RESAMPLER_H*/
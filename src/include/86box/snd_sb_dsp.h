@@ -102,6 +102,9 @@ typedef struct sb_dsp_t {
     int16_t buffer[SOUNDBUFLEN * 2];
     int     pos;
 
+    struct resampler_t *resampler, *rec_resampler; /* SB16 and later only */
+    int                 resample;
+
     uint8_t azt_eeprom[AZTECH_EEPROM_SIZE]; /* the eeprom in the Aztech cards is attached to the DSP */
 
     mpu_t *mpu;
@@ -128,6 +131,9 @@ void sb_dsp_poll(sb_dsp_t *dsp, int16_t *l, int16_t *r);
 void sb_dsp_set_stereo(sb_dsp_t *dsp, int stereo);
 
 void sb_dsp_update(sb_dsp_t *dsp);
+int  sb_dsp_resample_get(sb_dsp_t *dsp, float *buf, int len);
+void sb_dsp_record_add(sb_dsp_t *dsp, int16_t l, int16_t r);
+void sb_dsp_record_update(sb_dsp_t *dsp, int len);
 void sb_update_mask(sb_dsp_t *dsp, int irqm8, int irqm16, int irqm401);
 
 void sb_dsp_irq_attach(sb_dsp_t *dsp, void (*irq_update)(void *priv, int set), void *priv);
@@ -0,0 +1,34 @@
+/*
+ * 86Box	A hypervisor and IBM PC system emulator that specializes in
+ *		running old operating systems and software designed for IBM
+ *		PC systems and compatibles from 1981 through fairly recent
+ *		system designs based on the PCI bus.
+ *
+ *		This file is part of the 86Box distribution.
+ *
+ *		Definitions for the threaded synthesizer wrapper.
+ *
+ *		Register writes are queued with their position within the
+ *		current sound buffer and replayed by a worker thread, which
+ *		renders the synthesizer one buffer behind the emulation.
+ *		Reads of registers that depend on the output wait for the
+ *		worker to catch up and are answered by it.
+ */
+
+#ifndef SOUND_SYNTH_THREAD_H
+#define SOUND_SYNTH_THREAD_H
+
+typedef struct synth_thread_t synth_thread_t;
+
+extern synth_thread_t *synth_thread_init(int channels,
+                                         void (*render)(int16_t *buf, int len, void *priv),
+                                         void (*write)(uint32_t data, void *priv),
+                                         uint32_t (*read)(uint32_t data, void *priv),
+                                         void *priv);
+extern void            synth_thread_close(synth_thread_t *st);
+
+extern void     synth_thread_write(synth_thread_t *st, uint32_t data);
+extern uint32_t synth_thread_read(synth_thread_t *st, uint32_t data);
+extern int16_t *synth_thread_get_buffer(synth_thread_t *st);
+
+#endif /*SOUND_SYNTH_THREAD_H*/
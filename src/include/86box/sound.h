@@ -22,7 +22,17 @@
 
 extern int sound_gain;
 
-#define SOUNDBUFLEN (48000 / 50)
+/* Largest sound buffer, in 48 kHz frames; anything holding one buffer
+   is sized by it. The length actually in use is sound_buflen. */
+#define SOUNDBUFLEN (48000 / 10)
+
+/* The sound timer fires every 5 ms; sound_buflen is always a multiple of
+   it. The MIDI renderers are polled every 10 ms, one chunk each. */
+#define SOUND_POLL_SAMPLES (48000 / 200)
+#define SOUND_MIDI_SAMPLES (48000 / 100)
+
+#define SOUND_MIN_BUFFERS 2
+#define SOUND_MAX_BUFFERS 16
 
 #define CD_FREQ     44100
 #define CD_BUFLEN   (CD_FREQ / 10)
@@ -37,9 +47,24 @@ extern int gated,
     speakval,
     speakon;
 
-extern int sound_pos_global;
+typedef struct sound_stats_t {
+    uint32_t buffers;    /* buffers handed to the output */
+    uint32_t underruns;  /* times the output ran dry */
+    int      queued;     /* buffers queued at the output */
+    int      target;     /* queue depth the controller aims for */
+    int      latency_ms; /* output latency implied by the queue */
+} sound_stats_t;
+
+extern int sound_buflen;     /* frames per buffer at 48 kHz */
+extern int sound_out_buflen; /* frames per buffer at sound_out_rate */
+
+extern int sound_get_pos(void);
+extern int sound_get_midi_pos(void);
 extern int sound_card_current;
 
+extern int  sound_out_report(int queued, int underrun);
+extern void sound_get_stats(sound_stats_t *stats);
+
 extern void sound_add_handler(void (*get_buffer)(int32_t *buffer,
                                                  int len, void *p),
                               void *p);
@@ -64,6 +89,8 @@ extern void sound_reset(void);
 
 extern void sound_card_reset(void);
 
+extern void sound_mix_flush(void);
+extern void sound_mix_thread_end(void);
 extern void sound_cd_thread_end(void);
 extern void sound_cd_thread_reset(void);
 
@@ -54,6 +54,42 @@
 #define BLOCK_INVALID 0
 #endif
 
+/* Number of address spaces (CR3 values) whose lookups are kept across CR3 reloads. */
+#define MMU_CTX_NUM		8
+
+/* Number of watched paging structure pages remembered per context, beyond which
+   recycling the context falls back to scanning the whole page map. */
+#define MMU_CTX_PT_NUM		1024
+
+#define LOOKUP_TAG_VALID	1	/* Walked tables are known, the entry can be saved. */
+#define LOOKUP_TAG_USER		2	/* Translated with CPL 3 permission checks. */
+#define LOOKUP_TAG_WRITE	4	/* Translated for a write. */
+
+/* Number of entries in the page directory (and PAE page directory pointer) entry cache. */
+#define PDE_CACHE_NUM		64
+
+
+typedef struct {
+    uint32_t	virt, phys;		/* Page numbers. */
+    uint32_t	pd, pt;			/* Page numbers of the tables the translation was walked through. */
+    uint8_t	tag,
+		perm;			/* mmu_perm of the translation. */
+} lookup_tag_t;
+
+typedef struct {
+    uint32_t	cr3, stamp;
+    int		valid,
+		rn, wn;
+    lookup_tag_t read[256],
+		write[256];
+    int		ptn;			/* -1 once pt[] has overflowed */
+    uint32_t	pt[MMU_CTX_PT_NUM];	/* Pages this context set its pt_page_ctx bit in. */
+} mmu_ctx_t;
+
+typedef struct {
+    uint64_t	addr, val;		/* Physical address and contents of the entry. */
+} pde_cache_t;
+
 
 mem_mapping_t		ram_low_mapping,	/* 0..640K mapping */
 			ram_mid_mapping,
@@ -127,14 +163,30 @@ static mem_mapping_t	*write_mapping[MEM_MAPPINGS_NO];
 static mem_mapping_t	*read_mapping_bus[MEM_MAPPINGS_NO];
 static mem_mapping_t	*write_mapping_bus[MEM_MAPPINGS_NO];
 static uint8_t		*_mem_exec[MEM_MAPPINGS_NO];
+static uint8_t		*_mem_bus_read[MEM_MAPPINGS_NO];	/* direct host pointers for bus reads */
+static uint8_t		*_mem_bus_write[MEM_MAPPINGS_NO];	/* direct host pointers for bus writes */
+static uint8_t		_mem_page_attr[MEM_MAPPINGS_NO];
 static uint8_t		ff_pccache[4] = { 0xff, 0xff, 0xff, 0xff };
 static mem_state_t	_mem_state[MEM_MAPPINGS_NO];
 static uint32_t		remap_start_addr;
+
+/* Address space (CR3) tagged lookup contexts. */
+static lookup_tag_t	readlookup_tag[256];
+static lookup_tag_t	writelookup_tag[256];
+static lookup_tag_t	mmu_walk;		/* result of the last page walk */
+static mmu_ctx_t	mmu_ctx[MMU_CTX_NUM];
+static int		mmu_ctx_cur = -1;
+static uint32_t		mmu_ctx_stamp = 0;
+static uint8_t		*pt_page_ctx;		/* per physical page mask of contexts walking it */
+static uint32_t		pt_page_hi = 0;		/* highest marked physical page + 1 */
+static pde_cache_t	pde_cache[PDE_CACHE_NUM];
 #if (!(defined __amd64__ || defined _M_X64 || defined __aarch64__ || defined _M_ARM64))
 static size_t		ram_size = 0, ram2_size = 0;
 #else
 static size_t		ram_size = 0;
 #endif
+static uint32_t		reclaim_pos = 0;	/* next guest RAM page to check for zero */
+static uint64_t		reclaim_logged = 0;	/* resident bytes when last logged */
 
 
 #ifdef ENABLE_MEM_LOG
@@ -166,6 +218,373 @@ mem_addr_is_ram(uint32_t addr)
 }
 
 
+static void
+lookup_flush(void)
+{
+    int c;
+
+    for (c = 0; c < 256; c++) {
+	if (readlookup[c] != (int) 0xffffffff) {
+		readlookup2[readlookup[c]] = LOOKUP_INV;
+		readlookupp[readlookup[c]] = 4;
+		readlookup[c] = 0xffffffff;
+	}
+	if (writelookup[c] != (int) 0xffffffff) {
+		page_lookup[writelookup[c]] = NULL;
+		page_lookupp[writelookup[c]] = 4;
+		writelookup2[writelookup[c]] = LOOKUP_INV;
+		writelookupp[writelookup[c]] = 4;
+		writelookup[c] = 0xffffffff;
+	}
+    }
+
+    mmu_walk.virt = 0xffffffff;
+}
+
+
+static void
+pde_cache_flush(void)
+{
+    memset(pde_cache, 0xff, sizeof(pde_cache));
+}
+
+
+/* Only entries in pages whose writes are watched can be cached. */
+static __inline void
+pde_cache_fill(pde_cache_t *pde, uint64_t addr, uint64_t val)
+{
+    if (((addr >> 12) < pt_page_hi) && pt_page_ctx[addr >> 12]) {
+	pde->addr = addr;
+	pde->val = val;
+    }
+}
+
+
+/* Forget all the saved address spaces, used whenever the translations themselves may
+   have changed (paging mode, memory mappings, A20, SMM, etc.). */
+static void
+mmu_ctx_flush_all(void)
+{
+    int c;
+
+    for (c = 0; c < MMU_CTX_NUM; c++) {
+	mmu_ctx[c].valid = 0;
+	mmu_ctx[c].ptn = 0;
+    }
+    mmu_ctx_cur = -1;
+
+    if (pt_page_hi) {
+	memset(pt_page_ctx, 0x00, pt_page_hi);
+	pt_page_hi = 0;
+	pde_cache_flush();
+    }
+}
+
+
+/* Mark a physical page as holding paging structures of the current address space. */
+static void
+mmu_ctx_mark(uint32_t page)
+{
+    mmu_ctx_t *ctx;
+    int c;
+
+    if ((mmu_ctx_cur < 0) || (page >= pages_sz))
+	return;
+
+    if (!pt_page_ctx[page]) {
+	/* Writes to the page must now be seen, so drop any direct write lookups to it. */
+	for (c = 0; c < 256; c++) {
+		if ((writelookup[c] != (int) 0xffffffff) && (writelookup_tag[c].phys == page)) {
+			page_lookup[writelookup[c]] = NULL;
+			writelookup2[writelookup[c]] = LOOKUP_INV;
+			writelookup[c] = 0xffffffff;
+		}
+	}
+
+	if (page >= pt_page_hi)
+		pt_page_hi = page + 1;
+    }
+
+    if (!(pt_page_ctx[page] & (1 << mmu_ctx_cur))) {
+	ctx = &mmu_ctx[mmu_ctx_cur];
+	if ((ctx->ptn >= 0) && (ctx->ptn < MMU_CTX_PT_NUM))
+		ctx->pt[ctx->ptn++] = page;
+	else
+		ctx->ptn = -1;
+    }
+
+    pt_page_ctx[page] |= (1 << mmu_ctx_cur);
+}
+
+
+static __inline int
+lookup_tag_uses(lookup_tag_t *t, uint32_t page)
+{
+    return (t->pd == page) || (t->pt == page);
+}
+
+
+static int
+lookup_tag_drop(lookup_tag_t *t, int n, uint32_t page, uint32_t virt)
+{
+    int c, i = 0;
+
+    for (c = 0; c < n; c++) {
+	if ((t[c].virt != virt) && !lookup_tag_uses(&t[c], page))
+		t[i++] = t[c];
+    }
+
+    return i;
+}
+
+
+/* A page holding paging structures has been written to. */
+static void
+mmu_ctx_pt_write(uint32_t page)
+{
+    mmu_ctx_t *ctx;
+    uint8_t mask = pt_page_ctx[page];
+    int c, i;
+
+    for (c = 0; c < PDE_CACHE_NUM; c++) {
+	if ((pde_cache[c].addr >> 12) == page)
+		pde_cache[c].addr = 0xffffffffffffffffULL;
+    }
+
+    for (c = 0; c < MMU_CTX_NUM; c++) {
+	ctx = &mmu_ctx[c];
+
+	if (!(mask & (1 << c)) || !ctx->valid)
+		continue;
+
+	if (c == mmu_ctx_cur) {
+		/* The live lookups remain in use until INVLPG or a CR3 reload as on real
+		   hardware, but they can no longer be saved. */
+		for (i = 0; i < 256; i++) {
+			if ((page == (ctx->cr3 >> 12)) || lookup_tag_uses(&readlookup_tag[i], page))
+				readlookup_tag[i].tag &= ~LOOKUP_TAG_VALID;
+			if ((page == (ctx->cr3 >> 12)) || lookup_tag_uses(&writelookup_tag[i], page))
+				writelookup_tag[i].tag &= ~LOOKUP_TAG_VALID;
+		}
+		mmu_walk.virt = 0xffffffff;
+	} else if (page == (ctx->cr3 >> 12))
+		ctx->valid = 0;
+	else {
+		ctx->rn = lookup_tag_drop(ctx->read, ctx->rn, page, 0xffffffff);
+		ctx->wn = lookup_tag_drop(ctx->write, ctx->wn, page, 0xffffffff);
+	}
+    }
+}
+
+
+static __inline void
+mmu_ctx_check_write(page_t *p)
+{
+    uint32_t page = p - pages;
+
+    if ((page < pt_page_hi) && pt_page_ctx[page])
+	mmu_ctx_pt_write(page);
+}
+
+
+static __inline void
+lookup_tag_get(lookup_tag_t *t, uint32_t virt, uint32_t phys, int write)
+{
+    t->virt = virt >> 12;
+    t->phys = phys >> 12;
+
+    if (!(cr0 >> 31))
+	t->tag = LOOKUP_TAG_USER;
+    else if ((mmu_walk.virt == t->virt) && (!write || (mmu_walk.tag & LOOKUP_TAG_WRITE))) {
+	t->pd = mmu_walk.pd;
+	t->pt = mmu_walk.pt;
+	t->tag = mmu_walk.tag;
+    } else
+	t->tag = 0;
+
+    t->perm = mmu_perm;
+}
+
+
+static void
+readlookup_add(uint32_t virt, uint32_t phys, lookup_tag_t *t)
+{
+#if (!(defined __amd64__ || defined _M_X64 || defined __aarch64__ || defined _M_ARM64))
+    uint32_t a;
+#endif
+
+    if (readlookup2[virt>>12] != (uintptr_t) LOOKUP_INV) return;
+
+    if (readlookup[readlnext] != (int) 0xffffffff) {
+	if ((readlookup[readlnext] == ((es + DI) >> 12)) || (readlookup[readlnext] == ((es + EDI) >> 12)))
+		uncached = 1;
+	readlookup2[readlookup[readlnext]] = LOOKUP_INV;
+    }
+
+#if (defined __amd64__ || defined _M_X64 || defined __aarch64__ || defined _M_ARM64)
+    readlookup2[virt>>12] = (uintptr_t)&ram[(uintptr_t)(phys & ~0xFFF) - (uintptr_t)(virt & ~0xfff)];
+#else
+    a = ((uint32_t)(phys & ~0xfff) - (uint32_t)(virt & ~0xfff));
+
+    if ((phys & ~0xfff) >= (1 << 30))
+	readlookup2[virt>>12] = (uintptr_t)&ram2[a - (1 << 30)];
+    else
+	readlookup2[virt>>12] = (uintptr_t)&ram[a];
+#endif
+    readlookupp[virt>>12] = t->perm;
+
+    readlookup_tag[readlnext] = *t;
+    readlookup[readlnext++] = virt >> 12;
+    readlnext &= (cachesize-1);
+}
+
+
+static void
+writelookup_add(uint32_t virt, uint32_t phys, lookup_tag_t *t)
+{
+#if (!(defined __amd64__ || defined _M_X64 || defined __aarch64__ || defined _M_ARM64))
+    uint32_t a;
+#endif
+
+    if (page_lookup[virt >> 12]) return;
+
+    if (writelookup[writelnext] != -1) {
+	page_lookup[writelookup[writelnext]] = NULL;
+	writelookup2[writelookup[writelnext]] = LOOKUP_INV;
+    }
+
+#ifdef USE_NEW_DYNAREC
+#ifdef USE_DYNAREC
+    if (pages[phys >> 12].block || (phys & ~0xfff) == recomp_page || pt_page_ctx[phys >> 12]) {
+#else
+    if (pages[phys >> 12].block || pt_page_ctx[phys >> 12]) {
+#endif
+#else
+#ifdef USE_DYNAREC
+    if (pages[phys >> 12].block[0] || pages[phys >> 12].block[1] || pages[phys >> 12].block[2] || pages[phys >> 12].block[3] || (phys & ~0xfff) == recomp_page || pt_page_ctx[phys >> 12]) {
+#else
+    if (pages[phys >> 12].block[0] || pages[phys >> 12].block[1] || pages[phys >> 12].block[2] || pages[phys >> 12].block[3] || pt_page_ctx[phys >> 12]) {
+#endif
+#endif
+	page_lookup[virt >> 12] = &pages[phys >> 12];
+	page_lookupp[virt >> 12] = t->perm;
+    } else {
+#if (defined __amd64__ || defined _M_X64 || defined __aarch64__ || defined _M_ARM64)
+	writelookup2[virt>>12] = (uintptr_t)&ram[(uintptr_t)(phys & ~0xFFF) - (uintptr_t)(virt & ~0xfff)];
+#else
+	a = ((uint32_t)(phys & ~0xfff) - (uint32_t)(virt & ~0xfff));
+
+	if ((phys & ~0xfff) >= (1 << 30))
+		writelookup2[virt>>12] = (uintptr_t)&ram2[a - (1 << 30)];
+	else
+		writelookup2[virt>>12] = (uintptr_t)&ram[a];
+#endif
+    }
+    writelookupp[virt>>12] = t->perm;
+
+    writelookup_tag[writelnext] = *t;
+    writelookup[writelnext++] = virt >> 12;
+    writelnext &= (cachesize - 1);
+}
+
+
+static uint32_t
+mmu_ctx_key(void)
+{
+    return (cr4 & CR4_PAE) ? (cr3 & ~0x1f) : (cr3 & ~0xfff);
+}
+
+
+/* Bind the current CR3 to a context, restoring its saved lookups if it has any. */
+static void
+mmu_ctx_enter(void)
+{
+    mmu_ctx_t *ctx;
+    uint32_t key = mmu_ctx_key();
+    uint8_t mask;
+    int c, n = -1;
+
+    for (c = 0; c < MMU_CTX_NUM; c++) {
+	if (mmu_ctx[c].valid && (mmu_ctx[c].cr3 == key)) {
+		n = c;
+		break;
+	}
+    }
+
+    if (n >= 0) {
+	ctx = &mmu_ctx[n];
+	mmu_ctx_cur = n;
+
+	/* Lookups translated in supervisor mode are only valid below CPL 3. */
+	for (c = 0; c < ctx->rn; c++) {
+		if ((CPL != 3) || (ctx->read[c].tag & LOOKUP_TAG_USER))
+			readlookup_add(ctx->read[c].virt << 12, ctx->read[c].phys << 12, &ctx->read[c]);
+	}
+	for (c = 0; c < ctx->wn; c++) {
+		if ((CPL != 3) || (ctx->write[c].tag & LOOKUP_TAG_USER))
+			writelookup_add(ctx->write[c].virt << 12, ctx->write[c].phys << 12, &ctx->write[c]);
+	}
+    } else {
+	/* Take a free context, or the least recently used one. */
+	n = 0;
+	for (c = 0; c < MMU_CTX_NUM; c++) {
+		if (!mmu_ctx[c].valid) {
+			n = c;
+			break;
+		}
+		if (mmu_ctx[c].stamp < mmu_ctx[n].stamp)
+			n = c;
+	}
+
+	ctx = &mmu_ctx[n];
+	mask = ~(1 << n);
+	if (ctx->ptn >= 0) {
+		for (c = 0; c < ctx->ptn; c++)
+			pt_page_ctx[ctx->pt[c]] &= mask;
+	} else {
+		for (c = 0; c < pt_page_hi; c++)
+			pt_page_ctx[c] &= mask;
+	}
+	pde_cache_flush();
+
+	ctx->cr3 = key;
+	ctx->valid = 1;
+	ctx->rn = ctx->wn = ctx->ptn = 0;
+	mmu_ctx_cur = n;
+    }
+
+    ctx->stamp = ++mmu_ctx_stamp;
+    mmu_ctx_mark(cr3 >> 12);
+}
+
+
+/* Save the lookups of the current address space, oldest first. */
+static void
+mmu_ctx_leave(void)
+{
+    mmu_ctx_t *ctx;
+    int c, n;
+
+    if (mmu_ctx_cur < 0)
+	return;
+
+    ctx = &mmu_ctx[mmu_ctx_cur];
+    ctx->rn = ctx->wn = 0;
+
+    for (c = 0; c < 256; c++) {
+	n = (readlnext + c) & (cachesize - 1);
+	if ((readlookup[n] != (int) 0xffffffff) && (readlookup_tag[n].tag & LOOKUP_TAG_VALID))
+		ctx->read[ctx->rn++] = readlookup_tag[n];
+
+	n = (writelnext + c) & (cachesize - 1);
+	if ((writelookup[n] != (int) 0xffffffff) && (writelookup_tag[n].tag & LOOKUP_TAG_VALID))
+		ctx->write[ctx->wn++] = writelookup_tag[n];
+    }
+
+    mmu_ctx_cur = -1;
+}
+
+
 void
 resetreadlookup(void)
 {
@@ -191,28 +610,17 @@ resetreadlookup(void)
     writelnext = 0;
     pccache = 0xffffffff;
     high_page = 0;
+
+    mmu_walk.virt = 0xffffffff;
+    mmu_ctx_flush_all();
 }
 
 
 void
 flushmmucache(void)
 {
-    int c;
-
-    for (c = 0; c < 256; c++) {
-	if (readlookup[c] != (int) 0xffffffff) {
-		readlookup2[readlookup[c]] = LOOKUP_INV;
-		readlookupp[readlookup[c]] = 4;
-		readlookup[c] = 0xffffffff;
-	}
-	if (writelookup[c] != (int) 0xffffffff) {
-		page_lookup[writelookup[c]] = NULL;
-		page_lookupp[writelookup[c]] = 4;
-		writelookup2[writelookup[c]] = LOOKUP_INV;
-		writelookupp[writelookup[c]] = 4;
-		writelookup[c] = 0xffffffff;
-	}
-    }
+    lookup_flush();
+    mmu_ctx_flush_all();
     mmuflush++;
 
     pccache = (uint32_t)0xffffffff;
@@ -226,16 +634,26 @@ flushmmucache(void)
 
 void
 flushmmucache_nopc(void)
+{
+    lookup_flush();
+    mmu_ctx_flush_all();
+}
+
+
+/* Called when entering CPL 3, drops the lookups that were not translated with user
+   mode permission checks. */
+void
+flushmmucache_cr3(void)
 {
     int c;
 
     for (c = 0; c < 256; c++) {
-	if (readlookup[c] != (int) 0xffffffff) {
+	if ((readlookup[c] != (int) 0xffffffff) && !(readlookup_tag[c].tag & LOOKUP_TAG_USER)) {
 		readlookup2[readlookup[c]] = LOOKUP_INV;
 		readlookupp[readlookup[c]] = 4;
 		readlookup[c] = 0xffffffff;
 	}
-	if (writelookup[c] != (int) 0xffffffff) {
+	if ((writelookup[c] != (int) 0xffffffff) && !(writelookup_tag[c].tag & LOOKUP_TAG_USER)) {
 		page_lookup[writelookup[c]] = NULL;
 		page_lookupp[writelookup[c]] = 4;
 		writelookup2[writelookup[c]] = LOOKUP_INV;
@@ -246,6 +664,27 @@ flushmmucache_nopc(void)
 }
 
 
+/* Called after CR3 has been loaded: the lookups of the old address space are saved
+   and those of the new one, if it was recently used, are brought back. */
+void
+mmu_switch_cr3(void)
+{
+    mmu_ctx_leave();
+    lookup_flush();
+    mmuflush++;
+
+    pccache = (uint32_t)0xffffffff;
+    pccache2 = (uint8_t *)0xffffffff;
+
+#ifdef USE_DYNAREC
+    codegen_flush();
+#endif
+
+    if (cr0 >> 31)
+	mmu_ctx_enter();
+}
+
+
 void
 mem_flush_write_page(uint32_t addr, uint32_t virt)
 {
@@ -285,17 +724,44 @@ mem_flush_write_page(uint32_t addr, uint32_t virt)
 #define rammap64(x)	((uint64_t *)(_mem_exec[(x) >> MEM_GRANULARITY_BITS]))[((x) >> 3) & MEM_GRANULARITY_PMASK]
 
 
+/* Record a successful page walk, so that the lookup it produces can be tagged with the
+   tables it depends on. */
+static __inline void
+mmu_walk_done(uint32_t addr, uint64_t pd, uint64_t pt, int rw)
+{
+    if (mmu_ctx_cur < 0)
+	mmu_ctx_enter();
+
+    mmu_walk.virt = addr >> 12;
+    mmu_walk.pd = (uint32_t) (pd >> 12);
+    mmu_walk.pt = (uint32_t) (pt >> 12);
+    mmu_walk.tag = ((CPL == 3) && !cpl_override) ? LOOKUP_TAG_USER : 0;
+    if (rw)
+	mmu_walk.tag |= LOOKUP_TAG_WRITE;
+
+    if (((pd >> 12) < pages_sz) && ((pt >> 12) < pages_sz)) {
+	mmu_walk.tag |= LOOKUP_TAG_VALID;
+	mmu_ctx_mark(mmu_walk.pd);
+	mmu_ctx_mark(mmu_walk.pt);
+    }
+}
+
+
 static __inline uint64_t
 mmutranslatereal_normal(uint32_t addr, int rw)
 {
     uint32_t temp, temp2, temp3;
     uint32_t addr2;
+    pde_cache_t *pde;
+    int hit;
 
     if (cpu_state.abrt)
 	return 0xffffffffffffffffULL;
 
     addr2 = ((cr3 & ~0xfff) + ((addr >> 20) & 0xffc));
-    temp = temp2 = rammap(addr2);
+    pde = &pde_cache[(addr2 >> 2) & (PDE_CACHE_NUM - 1)];
+    hit = (pde->addr == addr2);
+    temp = temp2 = hit ? (uint32_t) pde->val : rammap(addr2);
     if (!(temp & 1)) {
 	cr2 = addr;
 	temp &= 1;
@@ -322,7 +788,12 @@ mmutranslatereal_normal(uint32_t addr, int rw)
 	}
 
 	mmu_perm = temp & 4;
-	rammap(addr2) |= (rw ? 0x60 : 0x20);
+	if (!hit || (~temp & (rw ? 0x60 : 0x20))) {
+		rammap(addr2) |= (rw ? 0x60 : 0x20);
+		mmu_walk_done(addr, addr2, addr2, rw);
+		pde_cache_fill(pde, addr2, temp | (rw ? 0x60 : 0x20));
+	} else
+		mmu_walk_done(addr, addr2, addr2, rw);
 
 	return (temp & ~0x3fffff) + (addr & 0x3fffff);
     }
@@ -342,8 +813,12 @@ mmutranslatereal_normal(uint32_t addr, int rw)
     }
 
     mmu_perm = temp & 4;
-    rammap(addr2) |= 0x20;
+    if (!hit || !(temp2 & 0x20))
+	rammap(addr2) |= 0x20;
     rammap((temp2 & ~0xfff) + ((addr >> 10) & 0xffc)) |= (rw ? 0x60 : 0x20);
+    mmu_walk_done(addr, addr2, temp2, rw);
+    if (!hit || !(temp2 & 0x20))
+	pde_cache_fill(pde, addr2, temp2 | 0x20);
 
     return (uint64_t) ((temp & ~0xfff) + (addr & 0xfff));
 }
@@ -354,12 +829,16 @@ mmutranslatereal_pae(uint32_t addr, int rw)
 {
     uint64_t temp, temp2, temp3, temp4;
     uint64_t addr2, addr3, addr4;
+    pde_cache_t *pdpte, *pde;
+    int hit, hit2;
 
     if (cpu_state.abrt)
 	return 0xffffffffffffffffULL;
 
     addr2 = (cr3 & ~0x1f) + ((addr >> 27) & 0x18);
-    temp = temp2 = rammap64(addr2) & 0x000000ffffffffffULL;
+    pdpte = &pde_cache[(addr2 >> 3) & (PDE_CACHE_NUM - 1)];
+    hit = (pdpte->addr == addr2);
+    temp = temp2 = hit ? pdpte->val : (rammap64(addr2) & 0x000000ffffffffffULL);
     if (!(temp & 1)) {
 	cr2 = addr;
 	temp &= 1;
@@ -371,7 +850,9 @@ mmutranslatereal_pae(uint32_t addr, int rw)
     }
 
     addr3 = (temp & ~0xfffULL) + ((addr >> 18) & 0xff8);
-    temp = temp4 = rammap64(addr3) & 0x000000ffffffffffULL;
+    pde = &pde_cache[(addr3 >> 3) & (PDE_CACHE_NUM - 1)];
+    hit2 = (pde->addr == addr3);
+    temp = temp4 = hit2 ? pde->val : (rammap64(addr3) & 0x000000ffffffffffULL);
     temp3 = temp & temp2;
     if (!(temp & 1)) {
 	cr2 = addr;
@@ -398,7 +879,13 @@ mmutranslatereal_pae(uint32_t addr, int rw)
 		return 0xffffffffffffffffULL;
 	}
 	mmu_perm = temp & 4;
-	rammap64(addr3) |= (rw ? 0x60 : 0x20);
+	if (!hit2 || (~temp & (rw ? 0x60 : 0x20)))
+		rammap64(addr3) |= (rw ? 0x60 : 0x20);
+	mmu_walk_done(addr, addr3, addr3, rw);
+	if (!hit)
+		pde_cache_fill(pdpte, addr2, temp2);
+	if (!hit2 || (~temp & (rw ? 0x60 : 0x20)))
+		pde_cache_fill(pde, addr3, temp | (rw ? 0x60 : 0x20));
 
 	return ((temp & ~0x1fffffULL) + (addr & 0x1fffffULL)) & 0x000000ffffffffffULL;
     }
@@ -417,8 +904,14 @@ mmutranslatereal_pae(uint32_t addr, int rw)
     }
 
     mmu_perm = temp & 4;
-    rammap64(addr3) |= 0x20;
+    if (!hit2 || !(temp4 & 0x20))
+	rammap64(addr3) |= 0x20;
     rammap64(addr4) |= (rw ? 0x60 : 0x20);
+    mmu_walk_done(addr, addr3, addr4, rw);
+    if (!hit)
+	pde_cache_fill(pdpte, addr2, temp2);
+    if (!hit2 || !(temp4 & 0x20))
+	pde_cache_fill(pde, addr3, temp4 | 0x20);
 
     return ((temp & ~0xfffULL) + ((uint64_t) (addr & 0xfff))) & 0x000000ffffffffffULL;
 }
@@ -541,7 +1034,17 @@ mmutranslate_noabrt(uint32_t addr, int rw)
 void
 mmu_invalidate(uint32_t addr)
 {
-    flushmmucache_cr3();
+    int c;
+
+    lookup_flush();
+
+    /* The page may be global and shared with the saved address spaces. */
+    for (c = 0; c < MMU_CTX_NUM; c++) {
+	if (mmu_ctx[c].valid && (c != mmu_ctx_cur)) {
+		mmu_ctx[c].rn = lookup_tag_drop(mmu_ctx[c].read, mmu_ctx[c].rn, 0xffffffff, addr >> 12);
+		mmu_ctx[c].wn = lookup_tag_drop(mmu_ctx[c].write, mmu_ctx[c].wn, 0xffffffff, addr >> 12);
+	}
+    }
 }
 
 
@@ -569,34 +1072,14 @@ mem_addr_translate(uint32_t addr, uint32_t chunk_start, uint32_t len)
 void
 addreadlookup(uint32_t virt, uint32_t phys)
 {
-#if (!(defined __amd64__ || defined _M_X64 || defined __aarch64__ || defined _M_ARM64))
-    uint32_t a;
-#endif
+    lookup_tag_t t;
 
     if (virt == 0xffffffff) return;
 
     if (readlookup2[virt>>12] != (uintptr_t) LOOKUP_INV) return;
 
-    if (readlookup[readlnext] != (int) 0xffffffff) {
-	if ((readlookup[readlnext] == ((es + DI) >> 12)) || (readlookup[readlnext] == ((es + EDI) >> 12)))
-		uncached = 1;
-	readlookup2[readlookup[readlnext]] = LOOKUP_INV;
-    }
-
-#if (defined __amd64__ || defined _M_X64 || defined __aarch64__ || defined _M_ARM64)
-    readlookup2[virt>>12] = (uintptr_t)&ram[(uintptr_t)(phys & ~0xFFF) - (uintptr_t)(virt & ~0xfff)];
-#else
-    a = ((uint32_t)(phys & ~0xfff) - (uint32_t)(virt & ~0xfff));
-
-    if ((phys & ~0xfff) >= (1 << 30))
-	readlookup2[virt>>12] = (uintptr_t)&ram2[a - (1 << 30)];
-    else
-	readlookup2[virt>>12] = (uintptr_t)&ram[a];
-#endif
-    readlookupp[virt>>12] = mmu_perm;
-
-    readlookup[readlnext++] = virt >> 12;
-    readlnext &= (cachesize-1);
+    lookup_tag_get(&t, virt, phys, 0);
+    readlookup_add(virt, phys, &t);
 
     cycles -= 9;
 }
@@ -605,50 +1088,14 @@ addreadlookup(uint32_t virt, uint32_t phys)
 void
 addwritelookup(uint32_t virt, uint32_t phys)
 {
-#if (!(defined __amd64__ || defined _M_X64 || defined __aarch64__ || defined _M_ARM64))
-    uint32_t a;
-#endif
+    lookup_tag_t t;
 
     if (virt == 0xffffffff) return;
 
     if (page_lookup[virt >> 12]) return;
 
-    if (writelookup[writelnext] != -1) {
-	page_lookup[writelookup[writelnext]] = NULL;
-	writelookup2[writelookup[writelnext]] = LOOKUP_INV;
-    }
-
-#ifdef USE_NEW_DYNAREC
-#ifdef USE_DYNAREC
-    if (pages[phys >> 12].block || (phys & ~0xfff) == recomp_page) {
-#else
-    if (pages[phys >> 12].block) {
-#endif
-#else
-#ifdef USE_DYNAREC
-    if (pages[phys >> 12].block[0] || pages[phys >> 12].block[1] || pages[phys >> 12].block[2] || pages[phys >> 12].block[3] || (phys & ~0xfff) == recomp_page) {
-#else
-    if (pages[phys >> 12].block[0] || pages[phys >> 12].block[1] || pages[phys >> 12].block[2] || pages[phys >> 12].block[3]) {
-#endif
-#endif
-	page_lookup[virt >> 12] = &pages[phys >> 12];
-	page_lookupp[virt >> 12] = mmu_perm;
-    } else {
-#if (defined __amd64__ || defined _M_X64 || defined __aarch64__ || defined _M_ARM64)
-	writelookup2[virt>>12] = (uintptr_t)&ram[(uintptr_t)(phys & ~0xFFF) - (uintptr_t)(virt & ~0xfff)];
-#else
-	a = ((uint32_t)(phys & ~0xfff) - (uint32_t)(virt & ~0xfff));
-
-	if ((phys & ~0xfff) >= (1 << 30))
-		writelookup2[virt>>12] = (uintptr_t)&ram2[a - (1 << 30)];
-	else
-		writelookup2[virt>>12] = (uintptr_t)&ram[a];
-#endif
-    }
-    writelookupp[virt>>12] = mmu_perm;
-
-    writelookup[writelnext++] = virt >> 12;
-    writelnext &= (cachesize - 1);
+    lookup_tag_get(&t, virt, phys, 1);
+    writelookup_add(virt, phys, &t);
 
     cycles -= 9;
 }
@@ -1662,11 +2109,14 @@ uint8_t
 mem_readb_phys(uint32_t addr)
 {
     mem_mapping_t *map = read_mapping_bus[addr >> MEM_GRANULARITY_BITS];
+    uint8_t *d = _mem_bus_read[addr >> MEM_GRANULARITY_BITS];
     uint8_t ret = 0xff;
 
     mem_logical_addr = 0xffffffff;
 
-    if (map) {
+    if (d)
+	ret = d[addr & MEM_GRANULARITY_MASK];
+    else if (map) {
 	if (map->exec)
 		ret = map->exec[addr - map->base];
 	else if (map->read_b)
@@ -1681,11 +2131,14 @@ uint16_t
 mem_readw_phys(uint32_t addr)
 {
     mem_mapping_t *map = read_mapping_bus[addr >> MEM_GRANULARITY_BITS];
+    uint8_t *d = _mem_bus_read[addr >> MEM_GRANULARITY_BITS];
     uint16_t ret, *p;
 
     mem_logical_addr = 0xffffffff;
 
-    if (((addr & MEM_GRANULARITY_MASK) <= MEM_GRANULARITY_HBOUND) && (map && map->exec)) {
+    if (((addr & MEM_GRANULARITY_MASK) <= MEM_GRANULARITY_HBOUND) && d)
+	ret = *(uint16_t *) &d[addr & MEM_GRANULARITY_MASK];
+    else if (((addr & MEM_GRANULARITY_MASK) <= MEM_GRANULARITY_HBOUND) && (map && map->exec)) {
 	p = (uint16_t *) &(map->exec[addr - map->base]);
 	ret = *p;
     } else if (((addr & MEM_GRANULARITY_MASK) <= MEM_GRANULARITY_HBOUND) && (map && map->read_w))
@@ -1703,11 +2156,14 @@ uint32_t
 mem_readl_phys(uint32_t addr)
 {
     mem_mapping_t *map = read_mapping_bus[addr >> MEM_GRANULARITY_BITS];
+    uint8_t *d = _mem_bus_read[addr >> MEM_GRANULARITY_BITS];
     uint32_t ret, *p;
 
     mem_logical_addr = 0xffffffff;
 
-    if (((addr & MEM_GRANULARITY_MASK) <= MEM_GRANULARITY_QBOUND) && (map && map->exec)) {
+    if (((addr & MEM_GRANULARITY_MASK) <= MEM_GRANULARITY_QBOUND) && d)
+	ret = *(uint32_t *) &d[addr & MEM_GRANULARITY_MASK];
+    else if (((addr & MEM_GRANULARITY_MASK) <= MEM_GRANULARITY_QBOUND) && (map && map->exec)) {
 	p = (uint32_t *) &(map->exec[addr - map->base]);
 	ret = *p;
     } else if (((addr & MEM_GRANULARITY_MASK) <= MEM_GRANULARITY_QBOUND) && (map && map->read_l))
@@ -1745,10 +2201,13 @@ void
 mem_writeb_phys(uint32_t addr, uint8_t val)
 {
     mem_mapping_t *map = write_mapping_bus[addr >> MEM_GRANULARITY_BITS];
+    uint8_t *d = _mem_bus_write[addr >> MEM_GRANULARITY_BITS];
 
     mem_logical_addr = 0xffffffff;
 
-    if (map) {
+    if (d)
+	d[addr & MEM_GRANULARITY_MASK] = val;
+    else if (map) {
 	if (map->exec)
 		map->exec[addr - map->base] = val;
 	else if (map->write_b)
@@ -1761,11 +2220,14 @@ void
 mem_writew_phys(uint32_t addr, uint16_t val)
 {
     mem_mapping_t *map = write_mapping_bus[addr >> MEM_GRANULARITY_BITS];
+    uint8_t *d = _mem_bus_write[addr >> MEM_GRANULARITY_BITS];
     uint16_t *p;
 
     mem_logical_addr = 0xffffffff;
 
-    if (((addr & MEM_GRANULARITY_MASK) <= MEM_GRANULARITY_HBOUND) && (map && map->exec)) {
+    if (((addr & MEM_GRANULARITY_MASK) <= MEM_GRANULARITY_HBOUND) && d)
+	*(uint16_t *) &d[addr & MEM_GRANULARITY_MASK] = val;
+    else if (((addr & MEM_GRANULARITY_MASK) <= MEM_GRANULARITY_HBOUND) && (map && map->exec)) {
 	p = (uint16_t *) &(map->exec[addr - map->base]);
 	*p = val;
     } else if (((addr & MEM_GRANULARITY_MASK) <= MEM_GRANULARITY_HBOUND) && (map && map->write_w))
@@ -1781,11 +2243,14 @@ void
 mem_writel_phys(uint32_t addr, uint32_t val)
 {
     mem_mapping_t *map = write_mapping_bus[addr >> MEM_GRANULARITY_BITS];
+    uint8_t *d = _mem_bus_write[addr >> MEM_GRANULARITY_BITS];
     uint32_t *p;
 
     mem_logical_addr = 0xffffffff;
 
-    if (((addr & MEM_GRANULARITY_MASK) <= MEM_GRANULARITY_QBOUND) && (map && map->exec)) {
+    if (((addr & MEM_GRANULARITY_MASK) <= MEM_GRANULARITY_QBOUND) && d)
+	*(uint32_t *) &d[addr & MEM_GRANULARITY_MASK] = val;
+    else if (((addr & MEM_GRANULARITY_MASK) <= MEM_GRANULARITY_QBOUND) && (map && map->exec)) {
 	p = (uint32_t *) &(map->exec[addr - map->base]);
 	*p = val;
     } else if (((addr & MEM_GRANULARITY_MASK) <= MEM_GRANULARITY_QBOUND) && (map && map->write_l))
@@ -1954,6 +2419,7 @@ mem_write_ramb_page(uint32_t addr, uint8_t val, page_t *p)
 	int byte_offset = (addr >> PAGE_BYTE_MASK_SHIFT) & PAGE_BYTE_MASK_OFFSET_MASK;
 	uint64_t byte_mask = (uint64_t)1 << (addr & PAGE_BYTE_MASK_MASK);
 
+	mmu_ctx_check_write(p);
 	p->mem[addr & 0xfff] = val;
 	p->dirty_mask |= mask;
 	if ((p->code_present_mask & mask) && !page_in_evict_list(p))
@@ -1982,6 +2448,7 @@ mem_write_ramw_page(uint32_t addr, uint16_t val, page_t *p)
 
 	if ((addr & 0xf) == 0xf)
 		mask |= (mask << 1);
+	mmu_ctx_check_write(p);
 	*(uint16_t *)&p->mem[addr & 0xfff] = val;
 	p->dirty_mask |= mask;
 	if ((p->code_present_mask & mask) && !page_in_evict_list(p))
@@ -2018,6 +2485,7 @@ mem_write_raml_page(uint32_t addr, uint32_t val, page_t *p)
 
 	if ((addr & 0xf) >= 0xd)
 		mask |= (mask << 1);
+	mmu_ctx_check_write(p);
 	*(uint32_t *)&p->mem[addr & 0xfff] = val;
 	p->dirty_mask |= mask;
 	p->byte_dirty_mask[byte_offset] |= byte_mask;
@@ -2046,6 +2514,7 @@ mem_write_ramb_page(uint32_t addr, uint8_t val, page_t *p)
 #endif
 	uint64_t mask = (uint64_t)1 << ((addr >> PAGE_MASK_SHIFT) & PAGE_MASK_MASK);
 	p->dirty_mask[(addr >> PAGE_MASK_INDEX_SHIFT) & PAGE_MASK_INDEX_MASK] |= mask;
+	mmu_ctx_check_write(p);
 	p->mem[addr & 0xfff] = val;
     }
 }
@@ -2066,6 +2535,7 @@ mem_write_ramw_page(uint32_t addr, uint16_t val, page_t *p)
 	if ((addr & 0xf) == 0xf)
 		mask |= (mask << 1);
 	p->dirty_mask[(addr >> PAGE_MASK_INDEX_SHIFT) & PAGE_MASK_INDEX_MASK] |= mask;
+	mmu_ctx_check_write(p);
 	*(uint16_t *)&p->mem[addr & 0xfff] = val;
     }
 }
@@ -2086,6 +2556,7 @@ mem_write_raml_page(uint32_t addr, uint32_t val, page_t *p)
 	if ((addr & 0xf) >= 0xd)
 		mask |= (mask << 1);
 	p->dirty_mask[(addr >> PAGE_MASK_INDEX_SHIFT) & PAGE_MASK_INDEX_MASK] |= mask;
+	mmu_ctx_check_write(p);
 	*(uint32_t *)&p->mem[addr & 0xfff] = val;
     }
 }
@@ -2228,6 +2699,8 @@ mem_invalidate_range(uint32_t start_addr, uint32_t end_addr)
 
 		if (!page_in_evict_list(p))
 			page_add_to_evict_list(p);
+
+		mmu_ctx_check_write(p);
 	}
     }
 #else
@@ -2239,8 +2712,10 @@ mem_invalidate_range(uint32_t start_addr, uint32_t end_addr)
 	/* Do nothing if the pages array is empty or DMA reads/writes to/from PCI device memory addresses
 	   may crash the emulator. */
 	cur_addr = (start_addr >> 12);
-	if (cur_addr < pages_sz)
+	if (cur_addr < pages_sz) {
 		memset(pages[cur_addr].dirty_mask, 0xff, sizeof(pages[cur_addr].dirty_mask));
+		mmu_ctx_check_write(&pages[cur_addr]);
+	}
     }
 #endif
 }
@@ -2280,6 +2755,57 @@ mem_mapping_access_allowed(uint32_t flags, uint16_t access)
 }
 
 
+/*
+ * Host pointer for a whole 4k page of a mapping, if it has one.
+ * Mappings that do not start or end on a page boundary only get
+ * their handlers, as the page may be shared with another mapping.
+ */
+static uint8_t *
+mem_mapping_direct(mem_mapping_t *map, uint64_t c)
+{
+    if (!map->exec || (map->base & MEM_GRANULARITY_MASK) || (map->size & MEM_GRANULARITY_MASK))
+	return NULL;
+
+    return map->exec + (c - map->base);
+}
+
+
+uint8_t
+mem_get_page_attr(uint32_t addr)
+{
+    return _mem_page_attr[addr >> MEM_GRANULARITY_BITS];
+}
+
+
+/*
+ * Find how much of [addr, addr + len) a bus master can access straight
+ * through host memory, as one contiguous block starting at *ptr.
+ * Returns 0 if addr itself needs the mapping handlers.
+ */
+uint32_t
+mem_get_bus_run(uint32_t addr, uint32_t len, int write, uint8_t **ptr)
+{
+    uint8_t **tbl = write ? _mem_bus_write : _mem_bus_read;
+    uint8_t *p = tbl[addr >> MEM_GRANULARITY_BITS];
+    uint32_t run, next;
+
+    if (p == NULL)
+	return 0;
+
+    *ptr = p + (addr & MEM_GRANULARITY_MASK);
+    run = MEM_GRANULARITY_SIZE - (addr & MEM_GRANULARITY_MASK);
+
+    while (run < len) {
+	next = addr + run;
+	if ((next == 0) || (tbl[next >> MEM_GRANULARITY_BITS] != (*ptr + run)))
+		break;
+	run += MEM_GRANULARITY_SIZE;
+    }
+
+    return (run < len) ? run : len;
+}
+
+
 void
 mem_mapping_recalc(uint64_t base, uint64_t size)
 {
@@ -2299,6 +2825,8 @@ mem_mapping_recalc(uint64_t base, uint64_t size)
 	read_mapping[c >> MEM_GRANULARITY_BITS] = NULL;
 	write_mapping_bus[c >> MEM_GRANULARITY_BITS] = NULL;
 	read_mapping_bus[c >> MEM_GRANULARITY_BITS] = NULL;
+	_mem_bus_write[c >> MEM_GRANULARITY_BITS] = NULL;
+	_mem_bus_read[c >> MEM_GRANULARITY_BITS] = NULL;
     }
 
     /* Walk mapping list. */
@@ -2328,17 +2856,34 @@ mem_mapping_recalc(uint64_t base, uint64_t size)
 			/* Bus */
 			n |= STATE_BUS;
 			if ((map->write_b || map->write_w || map->write_l) &&
-			    mem_mapping_access_allowed(map->flags, _mem_state[c >> MEM_GRANULARITY_BITS].states[n].w))
+			    mem_mapping_access_allowed(map->flags, _mem_state[c >> MEM_GRANULARITY_BITS].states[n].w)) {
 				write_mapping_bus[c >> MEM_GRANULARITY_BITS] = map;
+				_mem_bus_write[c >> MEM_GRANULARITY_BITS] = mem_mapping_direct(map, c);
+			}
 			if ((map->read_b || map->read_w || map->read_l) &&
-			    mem_mapping_access_allowed(map->flags, _mem_state[c >> MEM_GRANULARITY_BITS].states[n].r))
+			    mem_mapping_access_allowed(map->flags, _mem_state[c >> MEM_GRANULARITY_BITS].states[n].r)) {
 				read_mapping_bus[c >> MEM_GRANULARITY_BITS] = map;
+				_mem_bus_read[c >> MEM_GRANULARITY_BITS] = mem_mapping_direct(map, c);
+			}
 		}
 	}
 	map = map->next;
     }
 
-    flushmmucache_cr3();
+    /* Classify the pages now that the bus mappings are final. */
+    for (c = base; c < base + size; c += MEM_GRANULARITY_SIZE) {
+	n = c >> MEM_GRANULARITY_BITS;
+	if (_mem_bus_read[n] && (_mem_bus_read[n] == _mem_bus_write[n]))
+		_mem_page_attr[n] = MEM_PAGE_RAM;
+	else if (_mem_bus_read[n])
+		_mem_page_attr[n] = MEM_PAGE_ROM;
+	else if (read_mapping_bus[n] || write_mapping_bus[n])
+		_mem_page_attr[n] = MEM_PAGE_MMIO;
+	else
+		_mem_page_attr[n] = MEM_PAGE_NONE;
+    }
+
+    flushmmucache_nopc();
 }
 
 
@@ -2604,6 +3149,101 @@ mem_init_ram_mapping(mem_mapping_t *mapping, uint32_t base, uint32_t size)
 }
 
 
+/* Host pointer to a 4K page of guest RAM. */
+static uint8_t *
+mem_ram_page(uint32_t c)
+{
+#if (!(defined __amd64__ || defined _M_X64 || defined __aarch64__ || defined _M_ARM64))
+    if (c >= (1 << 18))
+	return &ram2[(c - (1 << 18)) << 12];
+#endif
+    return &ram[c << 12];
+}
+
+
+static int
+mem_page_is_zero(uint8_t *p)
+{
+    uint64_t *q = (uint64_t *) p;
+    int c;
+
+    for (c = 0; c < 512; c += 4) {
+	if (q[c] | q[c + 1] | q[c + 2] | q[c + 3])
+		return 0;
+    }
+
+    return 1;
+}
+
+
+/* Number of bytes of guest RAM actually backed by host memory. */
+uint64_t
+mem_get_resident(void)
+{
+    uint64_t ret = 0;
+
+    if (ram != NULL)
+	ret += plat_mresident(ram, ram_size);
+#if (!(defined __amd64__ || defined _M_X64 || defined __aarch64__ || defined _M_ARM64))
+    if (ram2 != NULL)
+	ret += plat_mresident(ram2, ram2_size);
+#endif
+
+    return ret;
+}
+
+
+/*
+ * Check up to count pages of guest RAM and hand the ones that
+ * are all zero back to the host. The guest still reads them as
+ * zero, so this is invisible to it; it has to run on the CPU
+ * thread, between blocks.
+ */
+void
+mem_reclaim_zero_pages(uint32_t count)
+{
+    uint32_t total = mem_size >> 2;
+    uint8_t *start = NULL, *p;
+    uint32_t run = 0;
+    uint64_t resident, delta;
+
+    if ((ram == NULL) || (total == 0))
+	return;
+
+    while (count--) {
+	if (reclaim_pos >= total) {
+		reclaim_pos = 0;
+
+		/* Log after the first sweep and whenever it moved by an eighth of the RAM. */
+		resident = mem_get_resident();
+		delta = (resident > reclaim_logged) ? (resident - reclaim_logged) : (reclaim_logged - resident);
+		if ((reclaim_logged == 0) || (delta >= ((uint64_t) mem_size << 7))) {
+			pclog("MEM: %" PRIu64 " of %u KB of guest RAM resident\n",
+			      resident >> 10, mem_size);
+			reclaim_logged = resident ? resident : 1;
+		}
+		break;
+	}
+
+	p = mem_ram_page(reclaim_pos++);
+	if (mem_page_is_zero(p)) {
+		/* Collect contiguous runs so we make as few calls as possible. */
+		if (run && (p == (start + (run << 12))))
+			run++;
+		else {
+			if (run)
+				plat_mdiscard(start, run << 12);
+			start = p;
+			run = 1;
+		}
+	}
+    }
+
+    if (run)
+	plat_mdiscard(start, run << 12);
+}
+
+
 /* Reset the memory state. */
 void
 mem_reset(void)
@@ -2651,14 +3291,15 @@ mem_reset(void)
 #if (!(defined __amd64__ || defined _M_X64 || defined __aarch64__ || defined _M_ARM64))
     if (mem_size > 1048576) {
 	ram_size = 1 << 30;
-	ram = (uint8_t *) plat_mmap(ram_size, 0);	/* allocate and clear the RAM block of the first 1 GB */
+	ram = (uint8_t *) plat_mmap(ram_size, 0);	/* allocate the RAM block of the first 1 GB, zeroed on demand by the host */
 	if (ram == NULL) {
 		fatal("Failed to allocate primary RAM block. Make sure you have enough RAM available.\n");
 		return;
 	}
-	memset(ram, 0x00, ram_size);
+	if (mem_huge_pages)
+		plat_madvise_huge(ram, ram_size);
 	ram2_size = m - (1 << 30);
-	ram2 = (uint8_t *) plat_mmap(ram2_size, 0);	/* allocate and clear the RAM block above 1 GB */
+	ram2 = (uint8_t *) plat_mmap(ram2_size, 0);	/* allocate the RAM block above 1 GB */
 	if (ram2 == NULL) {
 		if (config_changed == 2)
 			fatal(EMU_NAME " must be restarted for the memory amount change to be applied.\n");
@@ -2666,20 +3307,26 @@ mem_reset(void)
 			fatal("Failed to allocate secondary RAM block. Make sure you have enough RAM available.\n");
 		return;
 	}
-	memset(ram2, 0x00, ram2_size);
+	if (mem_huge_pages)
+		plat_madvise_huge(ram2, ram2_size);
     } else
 #endif
     {
 	ram_size = m;
-	ram = (uint8_t *) plat_mmap(ram_size, 0);	/* allocate and clear the RAM block */
+	ram = (uint8_t *) plat_mmap(ram_size, 0);	/* allocate the RAM block, zeroed on demand by the host */
 	if (ram == NULL) {
 		fatal("Failed to allocate RAM block. Make sure you have enough RAM available.\n");
 		return;
 	}
-	memset(ram, 0x00, ram_size);
+	if (mem_huge_pages)
+		plat_madvise_huge(ram, ram_size);
 	if (mem_size > 1048576)
 		ram2 = &(ram[1 << 30]);
     }
+    reclaim_pos = 0;
+    reclaim_logged = 0;
+    if (mem_reclaim && mem_huge_pages)
+	pclog("MEM: mem_reclaim is ignored while mem_huge_pages is set\n");
 
     /*
      * Allocate the page table based on how much RAM we have.
@@ -2751,6 +3398,9 @@ mem_reset(void)
     memset(read_mapping,      0x00, sizeof(read_mapping));
     memset(write_mapping_bus, 0x00, sizeof(write_mapping_bus));
     memset(read_mapping_bus,  0x00, sizeof(read_mapping_bus));
+    memset(_mem_bus_write,    0x00, sizeof(_mem_bus_write));
+    memset(_mem_bus_read,     0x00, sizeof(_mem_bus_read));
+    memset(_mem_page_attr,    0x00, sizeof(_mem_page_attr));
 
     base_mapping = last_mapping = NULL;
 
@@ -2812,6 +3462,8 @@ mem_init(void)
     readlookupp  = malloc((1<<20)*sizeof(uint8_t));
     writelookup2 = malloc((1<<20)*sizeof(uintptr_t));
     writelookupp = malloc((1<<20)*sizeof(uint8_t));
+    pt_page_ctx  = calloc(1<<20, sizeof(uint8_t));
+    pde_cache_flush();
 }
 
 
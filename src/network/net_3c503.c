@@ -592,7 +592,9 @@ threec503_nic_init(const device_t *info)
 	dev->maclocal[5] = (mac & 0xff);
     }
 
-    dev->dp8390 = device_add(&dp8390_device);
+    dev->dp8390 = device_add_inst(&dp8390_device, network_card_inst());
+    if (dev->dp8390 == NULL)
+	fatal("3C503: unable to add the DP8390 core\n");
     dev->dp8390->priv = dev;
     dev->dp8390->interrupt = threec503_interrupt;
     dp8390_set_defaults(dev->dp8390, DP8390_FLAG_CHECK_CR | DP8390_FLAG_CLEAR_IRQ);
@@ -617,7 +619,7 @@ threec503_nic_init(const device_t *info)
     dev->regs.gacfr = 0x09;	/* Start with RAM mapping enabled. */
 
     /* Attach ourselves to the network module. */
-    network_attach(dev->dp8390, dev->dp8390->physaddr, dp8390_rx, NULL, NULL);
+    dev->dp8390->card = network_attach(dev->dp8390, dev->dp8390->physaddr, dp8390_rx, NULL, NULL);
 
     return(dev);
 }
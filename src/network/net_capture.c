@@ -0,0 +1,367 @@
+/*
+ * 86Box	A hypervisor and IBM PC system emulator that specializes in
+ *		running old operating systems and software designed for IBM
+ *		PC systems and compatibles from 1981 through fairly recent
+ *		system designs based on the PCI bus.
+ *
+ *		This file is part of the 86Box distribution.
+ *
+ *		Capture of the emulated network adapters' traffic to a
+ *		pcapng file.
+ *
+ *		Frames are copied on the emulation thread, as the card hands
+ *		them over or takes them, into a single producer, single
+ *		consumer byte ring; a worker thread turns them into Enhanced
+ *		Packet Blocks. Nothing waits on the other side: when the ring
+ *		is full, frames are counted and dropped instead. Timestamps
+ *		follow emulated time, starting from the wall clock time at
+ *		which the capture began. Each adapter slot is one interface.
+ */
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <wchar.h>
+#define HAVE_STDARG_H
+#include <86box/86box.h>
+#include <86box/device.h>
+#include <86box/timer.h>
+#include <86box/plat.h>
+#include <86box/thread.h>
+#include <86box/network.h>
+#include <86box/version.h>
+
+
+#define NCAP_RING_SIZE	(8 << 20)	/* bytes, power of 2 */
+#define NCAP_IDLE_MS	50		/* worker flush interval */
+
+#define PCAPNG_SHB	0x0a0d0d0a
+#define PCAPNG_IDB	0x00000001
+#define PCAPNG_EPB	0x00000006
+#define PCAPNG_MAGIC	0x1a2b3c4d
+#define LINKTYPE_ETHERNET 1
+
+/* One frame in the ring, followed by its data; a size of 0 means the
+   rest of the ring is unused and the next record is at its start. */
+typedef struct {
+    uint32_t		size;		/* whole record, multiple of 8 */
+    uint16_t		card;
+    uint8_t		dir;
+    uint8_t		pad;
+    uint64_t		ts;		/* us */
+    uint32_t		len;
+    uint32_t		pad2;
+} ncap_rec_t;
+
+
+volatile int	net_capture_on = 0;
+
+
+static FILE		*ncap_fp;
+static uint8_t		*ncap_ring;
+static atomic_uint	ncap_head, ncap_tail;
+static atomic_int	ncap_kicked;
+static uint32_t		ncap_dropped;
+static uint64_t		ncap_base;		/* wall clock at start, us */
+static uint64_t		ncap_last_tsc;
+static double		ncap_elapsed;		/* emulated us since start */
+static event_t		*ncap_event;
+static thread_t		*ncap_thread_h;
+static volatile int	ncap_thread_on;
+
+
+#ifdef ENABLE_NET_CAPTURE_LOG
+int net_capture_do_log = ENABLE_NET_CAPTURE_LOG;
+
+
+static void
+ncap_log(const char *fmt, ...)
+{
+    va_list ap;
+
+    if (net_capture_do_log) {
+	va_start(ap, fmt);
+	pclog_ex(fmt, ap);
+	va_end(ap);
+    }
+}
+#else
+#define ncap_log(fmt, ...)
+#endif
+
+
+/* Append an option to a block being built, padded to 32 bits. */
+static int
+ncap_option(uint8_t *p, uint16_t code, const void *data, uint16_t len)
+{
+    int padded = (len + 3) & ~3;
+
+    memcpy(p, &code, 2);
+    memcpy(p + 2, &len, 2);
+    memset(p + 4, 0, padded);
+    if (len)
+	memcpy(p + 4, data, len);
+
+    return 4 + padded;
+}
+
+
+/* Write a block given its body, adding the type and both length fields. */
+static void
+ncap_block(uint32_t type, const uint8_t *body, uint32_t len)
+{
+    uint32_t total = len + 12;
+
+    fwrite(&type, 4, 1, ncap_fp);
+    fwrite(&total, 4, 1, ncap_fp);
+    fwrite(body, 1, len, ncap_fp);
+    fwrite(&total, 4, 1, ncap_fp);
+}
+
+
+/* Section header, and one interface per adapter slot. */
+static void
+ncap_header(void)
+{
+    uint8_t body[512];
+    char name[32];
+    const char *desc;
+    uint32_t v;
+    uint16_t w;
+    int64_t section = -1;
+    uint8_t tsresol = 6;
+    int i, n;
+
+    /* The blocks are written in host order, the magic tells readers which. */
+    v = PCAPNG_MAGIC;
+    memcpy(body, &v, 4);
+    w = 1;
+    memcpy(body + 4, &w, 2);
+    w = 0;
+    memcpy(body + 6, &w, 2);
+    memcpy(body + 8, &section, 8);
+    n = 16;
+    n += ncap_option(body + n, 4, EMU_NAME, strlen(EMU_NAME));	/* shb_userappl */
+    n += ncap_option(body + n, 0, NULL, 0);
+    ncap_block(PCAPNG_SHB, body, n);
+
+    for (i = 0; i < NET_CARD_MAX; i++) {
+	w = LINKTYPE_ETHERNET;
+	memcpy(body, &w, 2);
+	w = 0;
+	memcpy(body + 2, &w, 2);
+	v = NET_MAX_FRAME;
+	memcpy(body + 4, &v, 4);
+	n = 8;
+
+	sprintf(name, "net_%02i", i + 1);
+	desc = (net_cards_conf[i].device_num > 0) ?
+	       network_card_getdevice(net_cards_conf[i].device_num)->name : "None";
+	n += ncap_option(body + n, 2, name, strlen(name));		/* if_name */
+	n += ncap_option(body + n, 3, desc, MIN(strlen(desc), 128));	/* if_description */
+	n += ncap_option(body + n, 9, &tsresol, 1);			/* if_tsresol */
+	n += ncap_option(body + n, 0, NULL, 0);
+	ncap_block(PCAPNG_IDB, body, n);
+    }
+}
+
+
+static void
+ncap_write(const ncap_rec_t *rec)
+{
+    uint8_t body[28 + 12];
+    uint32_t v, flags = (rec->dir == NET_CAPTURE_RX) ? 1 : 2;	/* inbound, outbound */
+    uint32_t padded = (rec->len + 3) & ~3, total;
+    static const uint8_t zero[4] = { 0, 0, 0, 0 };
+
+    total = 28 + padded + 12 + 4;
+
+    v = PCAPNG_EPB;
+    memcpy(body, &v, 4);
+    memcpy(body + 4, &total, 4);
+    v = rec->card;
+    memcpy(body + 8, &v, 4);
+    v = (uint32_t) (rec->ts >> 32);
+    memcpy(body + 12, &v, 4);
+    v = (uint32_t) rec->ts;
+    memcpy(body + 16, &v, 4);
+    memcpy(body + 20, &rec->len, 4);
+    memcpy(body + 24, &rec->len, 4);
+    fwrite(body, 1, 28, ncap_fp);
+
+    fwrite(rec + 1, 1, rec->len, ncap_fp);
+    fwrite(zero, 1, padded - rec->len, ncap_fp);
+
+    /* epb_flags with the direction, then the end of options. */
+    v = ncap_option(body, 2, &flags, 4);
+    v += ncap_option(body + v, 0, NULL, 0);
+    memcpy(body + v, &total, 4);
+    fwrite(body, 1, v + 4, ncap_fp);
+}
+
+
+/* Write out everything in the ring. */
+static void
+ncap_drain(void)
+{
+    uint32_t head = atomic_load_explicit(&ncap_head, memory_order_acquire);
+    uint32_t tail = atomic_load_explicit(&ncap_tail, memory_order_relaxed);
+    ncap_rec_t *rec;
+    uint32_t off;
+
+    while (tail != head) {
+	off = tail & (NCAP_RING_SIZE - 1);
+	rec = (ncap_rec_t *) &ncap_ring[off];
+	if (rec->size == 0) {
+		tail += NCAP_RING_SIZE - off;
+		continue;
+	}
+
+	ncap_write(rec);
+	tail += rec->size;
+    }
+
+    atomic_store_explicit(&ncap_tail, tail, memory_order_release);
+    fflush(ncap_fp);
+}
+
+
+static void
+ncap_thread(void *param)
+{
+    while (ncap_thread_on) {
+	thread_wait_event(ncap_event, NCAP_IDLE_MS);
+	thread_reset_event(ncap_event);
+	atomic_store(&ncap_kicked, 0);
+
+	ncap_drain();
+    }
+
+    /* Whatever came in before the stop. */
+    ncap_drain();
+}
+
+
+/*
+ * Copy a frame into the ring. Only ever called from the emulation
+ * thread, through the network_tx() and receive timer paths, which
+ * makes it the single producer.
+ */
+void
+net_capture_frame(const netcard_t *card, int dir, const uint8_t *data, int len)
+{
+    uint32_t head, tail, off, need, skip = 0;
+    ncap_rec_t *rec;
+    uint64_t now;
+
+    if (!net_capture_on || (len <= 0) || (len > NET_MAX_FRAME))
+	return;
+
+    /* Emulated time, accumulated so that speed changes only affect the
+       interval they happen in. */
+    now = tsc;
+    if ((now > ncap_last_tsc) && TIMER_USEC)
+	ncap_elapsed += ((double) (now - ncap_last_tsc) * 4294967296.0) / (double) TIMER_USEC;
+    ncap_last_tsc = now;
+
+    need = (sizeof(ncap_rec_t) + len + 7) & ~7;
+    head = atomic_load_explicit(&ncap_head, memory_order_relaxed);
+    tail = atomic_load_explicit(&ncap_tail, memory_order_acquire);
+    off = head & (NCAP_RING_SIZE - 1);
+    if ((NCAP_RING_SIZE - off) < need)
+	skip = NCAP_RING_SIZE - off;
+
+    if (((head - tail) + skip + need) > NCAP_RING_SIZE) {
+	/* The writer is behind, do not hold up the emulation for it. */
+	ncap_dropped++;
+	return;
+    }
+
+    if (skip) {
+	((ncap_rec_t *) &ncap_ring[off])->size = 0;
+	head += skip;
+	off = 0;
+    }
+
+    rec = (ncap_rec_t *) &ncap_ring[off];
+    rec->size = need;
+    rec->card = card->card_num;
+    rec->dir = dir;
+    rec->ts = ncap_base + (uint64_t) ncap_elapsed;
+    rec->len = len;
+    memcpy(rec + 1, data, len);
+
+    atomic_store_explicit(&ncap_head, head + need, memory_order_release);
+
+    /* Only hurry the writer along once the ring fills up. */
+    if (((head + need - tail) >= (NCAP_RING_SIZE / 2)) && !atomic_exchange(&ncap_kicked, 1))
+	thread_set_event(ncap_event);
+}
+
+
+int
+net_capture_start(const char *path)
+{
+    if (net_capture_on)
+	return 1;
+
+    ncap_ring = (uint8_t *) malloc(NCAP_RING_SIZE);
+    if (ncap_ring == NULL)
+	return 0;
+
+    ncap_fp = plat_fopen((char *) path, "wb");
+    if (ncap_fp == NULL) {
+	free(ncap_ring);
+	ncap_ring = NULL;
+	return 0;
+    }
+
+    ncap_header();
+
+    atomic_init(&ncap_head, 0);
+    atomic_init(&ncap_tail, 0);
+    atomic_init(&ncap_kicked, 0);
+    ncap_dropped = 0;
+    ncap_base = (uint64_t) time(NULL) * 1000000ULL;
+    ncap_last_tsc = tsc;
+    ncap_elapsed = 0.0;
+
+    ncap_event = thread_create_event();
+    ncap_thread_on = 1;
+    ncap_thread_h = thread_create(ncap_thread, NULL);
+
+    ncap_log("NETCAP: capturing to %s\n", path);
+    net_capture_on = 1;
+
+    return 1;
+}
+
+
+void
+net_capture_stop(void)
+{
+    if (!net_capture_on)
+	return;
+
+    net_capture_on = 0;
+
+    /* Let the worker write out what is left before it exits. */
+    ncap_thread_on = 0;
+    thread_set_event(ncap_event);
+    thread_wait(ncap_thread_h);
+    ncap_thread_h = NULL;
+
+    thread_destroy_event(ncap_event);
+    ncap_event = NULL;
+
+    fclose(ncap_fp);
+    ncap_fp = NULL;
+    free(ncap_ring);
+    ncap_ring = NULL;
+
+    if (ncap_dropped)
+	pclog("NETCAP: %u frames dropped, the writer could not keep up\n", ncap_dropped);
+}
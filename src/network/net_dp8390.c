@@ -225,7 +225,7 @@ dp8390_write_cr(dp8390_t *dev, uint32_t val)
 	/* Send the packet to the system driver */
 	dev->CR.tx_packet = 1;
 
-	network_tx(&dev->mem[(dev->tx_page_start * 256) - dev->mem_start], dev->tx_bytes);
+	network_tx(dev->card, &dev->mem[(dev->tx_page_start * 256) - dev->mem_start], dev->tx_bytes);
 
 	/* some more debug */
 #ifdef ENABLE_DP8390_LOG
@@ -1099,10 +1099,10 @@ dp8390_close(void *priv)
 {
     dp8390_t *dp8390 = (dp8390_t *) priv;
 
-    /* Make sure the platform layer is shut down. */
-    network_close();
-
     if (dp8390) {
+	/* Make sure the platform layer is shut down. */
+	network_detach(dp8390->card);
+
 	if (dp8390->mem)
 		free(dp8390->mem);
 
@@ -973,7 +973,9 @@ nic_init(const device_t *info)
 	dev->maclocal[5] = (mac & 0xff);
     }
 
-    dev->dp8390 = device_add(&dp8390_device);
+    dev->dp8390 = device_add_inst(&dp8390_device, network_card_inst());
+    if (dev->dp8390 == NULL)
+	fatal("%s: unable to add the DP8390 core\n", dev->name);
     dev->dp8390->priv = dev;
     dev->dp8390->interrupt = nic_interrupt;
 
@@ -1120,7 +1122,7 @@ nic_init(const device_t *info)
 	nic_reset(dev);
 
     /* Attach ourselves to the network module. */
-    network_attach(dev->dp8390, dev->dp8390->physaddr, dp8390_rx, NULL, NULL);
+    dev->dp8390->card = network_attach(dev->dp8390, dev->dp8390->physaddr, dp8390_rx, NULL, NULL);
 
     nelog(1, "%s: %s attached IO=0x%X IRQ=%d\n", dev->name,
 	dev->is_pci?"PCI":"ISA", dev->base_address, dev->base_irq);
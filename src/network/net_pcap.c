@@ -45,11 +45,31 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <wchar.h>
+#ifndef _WIN32
+# include <errno.h>
+# include <fcntl.h>
+# include <poll.h>
+# include <unistd.h>
+#endif
+/* On Linux the frames can also be taken straight from an AF_PACKET
+   TPACKET_V3 ring, bypassing the library for higher packet rates. */
+#ifdef __linux__
+# define PCAP_USE_RING 1
+# include <sys/eventfd.h>
+# include <sys/mman.h>
+# include <sys/socket.h>
+# include <arpa/inet.h>
+# include <net/if.h>
+# include <linux/filter.h>
+# include <linux/if_ether.h>
+# include <linux/if_packet.h>
+#endif
 #define HAVE_STDARG_H
 #include <86box/86box.h>
 #include <86box/device.h>
@@ -59,6 +79,13 @@
 #include <86box/network.h>
 
 
+#define PCAP_IDLE_MS		10		/* wait while the card is busy */
+#define PCAP_RING_BLOCK		(1 << 17)	/* bytes per ring block */
+#define PCAP_RING_BLOCKS	32
+#define PCAP_RING_FRAME		2048
+#define PCAP_RING_TOV		1		/* ms before a partial block is handed over */
+
+
 typedef int bpf_int32;
 typedef unsigned int bpf_u_int32;
 
@@ -103,12 +130,35 @@ struct pcap_if {
     unsigned int flags;
 };
 
+typedef void (*pcap_handler)(unsigned char *, const struct pcap_pkthdr *,
+			     const unsigned char *);
+
+
+/* One capture channel, per network adapter. */
+typedef struct {
+    void		*pcap;		/* handle to WinPcap library */
+    const netcard_t	*card;		/* netcard linked to us */
+    thread_t		*poll_tid;
+    event_t		*poll_state;
+    volatile int	stop;
+    uint8_t		mac[6];
+    char		host_dev_name[NET_HOST_INTF_MAX];
+#ifdef _WIN32
+    event_t		*wake;		/* guest frames are waiting */
+#else
+    int			notify_rd, notify_wr;
+#endif
+#ifdef PCAP_USE_RING
+    int			ring_fd;	/* AF_PACKET socket, or -1 */
+    uint8_t		*ring;
+    uint32_t		ring_blk;	/* block being read */
+    uint32_t		ring_pkt;	/* frames of it already taken */
+    struct tpacket3_hdr	*ring_ppd;	/* next frame in it */
+#endif
+} net_pcap_t;
+
 
 static volatile void		*pcap_handle;	/* handle to WinPcap DLL */
-static volatile void		*pcap;		/* handle to WinPcap library */
-static volatile thread_t	*poll_tid;
-static const netcard_t		*poll_card;	/* netcard linked to us */
-static event_t			*poll_state;
 
 
 /* Pointers to the real functions. */
@@ -119,11 +169,20 @@ static void		*(*f_pcap_open_live)(const char *,int,int,int,char *);
 static int		(*f_pcap_compile)(void *,void *,
 					 const char *,int,bpf_u_int32);
 static int		(*f_pcap_setfilter)(void *,void *);
-static const unsigned char
-			*(*f_pcap_next)(void *,void *);
+static int		(*f_pcap_dispatch)(void *,int,pcap_handler,
+					  unsigned char *);
 static int		(*f_pcap_sendpacket)(void *,const unsigned char *,int);
 static void		(*f_pcap_close)(void *);
 static int              (*f_pcap_setnonblock)(void*, int, char*);
+#ifndef _WIN32
+static void		*(*f_pcap_create)(const char *,char *);
+static int		(*f_pcap_set_snaplen)(void *,int);
+static int		(*f_pcap_set_promisc)(void *,int);
+static int		(*f_pcap_set_timeout)(void *,int);
+static int		(*f_pcap_set_immediate_mode)(void *,int);
+static int		(*f_pcap_activate)(void *);
+static int		(*f_pcap_get_selectable_fd)(void *);
+#endif
 static dllimp_t pcap_imports[] = {
   { "pcap_lib_version",	&f_pcap_lib_version	},
   { "pcap_findalldevs",	&f_pcap_findalldevs	},
@@ -131,10 +190,19 @@ static dllimp_t pcap_imports[] = {
   { "pcap_open_live",	&f_pcap_open_live	},
   { "pcap_compile",	&f_pcap_compile		},
   { "pcap_setfilter",	&f_pcap_setfilter	},
-  { "pcap_next",	&f_pcap_next		},
+  { "pcap_dispatch",	&f_pcap_dispatch	},
   { "pcap_sendpacket",	&f_pcap_sendpacket	},
   { "pcap_close",	&f_pcap_close		},
   { "pcap_setnonblock",	&f_pcap_setnonblock	},
+#ifndef _WIN32
+  { "pcap_create",	&f_pcap_create		},
+  { "pcap_set_snaplen",	&f_pcap_set_snaplen	},
+  { "pcap_set_promisc",	&f_pcap_set_promisc	},
+  { "pcap_set_timeout",	&f_pcap_set_timeout	},
+  { "pcap_set_immediate_mode", &f_pcap_set_immediate_mode },
+  { "pcap_activate",	&f_pcap_activate	},
+  { "pcap_get_selectable_fd", &f_pcap_get_selectable_fd },
+#endif
   { NULL,		NULL			},
 };
 
@@ -159,74 +227,155 @@ pcap_log(const char *fmt, ...)
 #endif
 
 
-/* Handle the receiving of frames from the channel. */
+/* Queue one captured frame for the card. */
 static void
-poll_thread(void *arg)
+net_pcap_queue(net_pcap_t *pcap, const uint8_t *data, int len)
 {
-    uint8_t *mac = (uint8_t *)arg;
-    uint8_t *data = NULL;
-    struct pcap_pkthdr h;
-    uint32_t mac_cmp32[2];
-    uint16_t mac_cmp16[2];
-    event_t *evt;
-    int tx;
+    /* The filter should have caught our own frames, but be sure. */
+    if ((len < 12) || !memcmp(data + 6, pcap->mac, 6))
+	return;
 
-    pcap_log("PCAP: polling started.\n");
-    thread_set_event(poll_state);
+    network_queue_put(pcap->card, NET_QUEUE_RX, (uint8_t *) data, len);
+}
 
-    /* Create a waitable event. */
-    pcap_log("PCAP: Creating event...\n");
-    evt = thread_create_event();
 
-    /* As long as the channel is open.. */
-    while (pcap != NULL) {
-	/* Request ownership of the device. */
-	network_wait(1);
+static void
+net_pcap_rx(unsigned char *user, const struct pcap_pkthdr *h, const unsigned char *bytes)
+{
+    net_pcap_queue((net_pcap_t *) user, bytes, h->caplen);
+}
+
+
+#ifdef PCAP_USE_RING
+/* Take up to a batch of frames from the ring, block by block. */
+static int
+net_pcap_ring_rx(net_pcap_t *pcap)
+{
+    struct tpacket_block_desc *bd;
+    struct tpacket3_hdr *ppd;
+    int n = 0;
 
-	if (pcap == NULL) {
-		network_wait(0);
+    while (n < NET_BATCH) {
+	bd = (struct tpacket_block_desc *) (pcap->ring + (pcap->ring_blk * PCAP_RING_BLOCK));
+	if (!(*(volatile uint32_t *) &bd->hdr.bh1.block_status & TP_STATUS_USER))
 		break;
+	atomic_thread_fence(memory_order_acquire);
+
+	if (pcap->ring_pkt == 0)
+		pcap->ring_ppd = (struct tpacket3_hdr *) ((uint8_t *) bd + bd->hdr.bh1.offset_to_first_pkt);
+	while ((pcap->ring_pkt < bd->hdr.bh1.num_pkts) && (n < NET_BATCH)) {
+		ppd = pcap->ring_ppd;
+		net_pcap_queue(pcap, (uint8_t *) ppd + ppd->tp_mac, ppd->tp_snaplen);
+		pcap->ring_ppd = (struct tpacket3_hdr *) ((uint8_t *) ppd + ppd->tp_next_offset);
+		pcap->ring_pkt++;
+		n++;
 	}
+	if (pcap->ring_pkt < bd->hdr.bh1.num_pkts)
+		break;
 
-	if (network_get_wait() || (poll_card->set_link_state && poll_card->set_link_state(poll_card->priv)) || (poll_card->wait && poll_card->wait(poll_card->priv)))
-		data = NULL;
-	else
-		data = (uint8_t *)f_pcap_next((void *)pcap, &h);
-	if (data != NULL) {
-		/* Received MAC. */
-		mac_cmp32[0] = *(uint32_t *)(data+6);
-		mac_cmp16[0] = *(uint16_t *)(data+10);
-
-		/* Local MAC. */
-		mac_cmp32[1] = *(uint32_t *)mac;
-		mac_cmp16[1] = *(uint16_t *)(mac+4);
-		if ((mac_cmp32[0] != mac_cmp32[1]) ||
-		    (mac_cmp16[0] != mac_cmp16[1]))
-			network_queue_put(0, poll_card->priv, data, h.caplen);
-		else {
-			/* Mark as invalid packet. */
-			data = NULL;
-		}
-	}
+	/* Hand the whole block back to the kernel. */
+	atomic_thread_fence(memory_order_release);
+	*(volatile uint32_t *) &bd->hdr.bh1.block_status = TP_STATUS_KERNEL;
+	pcap->ring_pkt = 0;
+	pcap->ring_blk = (pcap->ring_blk + 1) % PCAP_RING_BLOCKS;
+    }
 
-	/* Wait for the next packet to arrive - network_do_tx() is called from there. */
-	tx = network_tx_queue_check();
+    return n;
+}
+#endif
 
-	/* Release ownership of the device. */
-	network_wait(0);
 
-	/* If we did not get anything, wait a while. */
-	if (!tx)
-		thread_wait_event(evt, 10);
-    }
+/* Read whatever is ready, at most one batch; returns the frame count. */
+static int
+net_pcap_read(net_pcap_t *pcap)
+{
+    int n;
+
+#ifdef PCAP_USE_RING
+    if (pcap->ring_fd >= 0)
+	return net_pcap_ring_rx(pcap);
+#endif
+
+    n = f_pcap_dispatch(pcap->pcap, NET_BATCH, net_pcap_rx, (unsigned char *) pcap);
 
-    /* No longer needed. */
-    if (evt != NULL)
-	thread_destroy_event(evt);
+    return (n > 0) ? n : 0;
+}
+
+
+#ifndef _WIN32
+/* Swallow pending wakeups, the frames themselves are picked up afterwards. */
+static void
+net_pcap_drain_notify(net_pcap_t *pcap)
+{
+# ifdef __linux__
+    uint64_t val;
+
+    (void) !read(pcap->notify_rd, &val, sizeof(val));
+# else
+    uint8_t buf[64];
+
+    while (read(pcap->notify_rd, buf, sizeof(buf)) > 0)
+	;
+# endif
+}
+#endif
+
+
+/* Handle the receiving of frames from the channel. */
+static void
+poll_thread(void *arg)
+{
+    net_pcap_t *pcap = (net_pcap_t *) arg;
+    const netcard_t *card = pcap->card;
+    int busy, n;
+#ifndef _WIN32
+    struct pollfd pfd[2];
+
+    /* Sleep on the capture descriptor and on the guest's frames. */
+    pfd[0].fd = pcap->notify_rd;
+    pfd[0].events = POLLIN;
+# ifdef PCAP_USE_RING
+    if (pcap->ring_fd >= 0)
+	pfd[1].fd = pcap->ring_fd;
+    else
+# endif
+	pfd[1].fd = f_pcap_get_selectable_fd(pcap->pcap);
+    if (pfd[1].fd < 0)
+	pcap_log("PCAP: no selectable descriptor, falling back to polling\n");
+#endif
+
+    pcap_log("PCAP: polling started.\n");
+    thread_set_event(pcap->poll_state);
+
+    /* As long as the channel is open.. */
+    while (!pcap->stop) {
+	busy = network_get_wait() || (card->set_link_state && card->set_link_state(card->priv)) || (card->wait && card->wait(card->priv));
+	n = busy ? 0 : net_pcap_read(pcap);
+
+	/* Send everything the guest has queued so far. */
+	network_tx_queue_check(card);
+
+	/* A full batch means there may be more ready already. */
+	if (n >= NET_BATCH)
+		continue;
+
+#ifdef _WIN32
+	/* There is nothing portable to wait on for the capture, so nap. */
+	if (!n) {
+		thread_wait_event(pcap->wake, PCAP_IDLE_MS);
+		thread_reset_event(pcap->wake);
+	}
+#else
+	/* Leave the capture alone while the card cannot take frames, the
+	   busy state does not wake us, so look again in a while. */
+	pfd[1].events = busy ? 0 : POLLIN;
+	if ((poll(pfd, 2, (busy || (pfd[1].fd < 0)) ? PCAP_IDLE_MS : -1) > 0) &&
+	    (pfd[0].revents & POLLIN))
+		net_pcap_drain_notify(pcap);
+#endif
+    }
 
     pcap_log("PCAP: polling stopped.\n");
-    if (poll_state != NULL)
-	thread_set_event(poll_state);
 }
 
 
@@ -244,9 +393,6 @@ net_pcap_prepare(netdev_t *list)
     pcap_if_t *devlist, *dev;
     int i = 0;
 
-    /* Local variables. */
-    pcap = NULL;
-
     /* Try loading the DLL. */
 #ifdef _WIN32
     pcap_handle = dynld_module("wpcap.dll", pcap_imports);
@@ -289,106 +435,203 @@ net_pcap_prepare(netdev_t *list)
 }
 
 
+#ifdef PCAP_USE_RING
 /*
- * Initialize (Win)Pcap for use.
- *
- * This is called on every 'cycle' of the emulator,
- * if and as long the NetworkType is set to PCAP,
- * and also as long as we have a NetCard defined.
+ * Open an AF_PACKET socket on the interface with a TPACKET_V3 receive
+ * ring, for use instead of the library. The kernel fills whole blocks
+ * of frames and hands them over when full or after PCAP_RING_TOV, so
+ * a wakeup usually brings several frames at once.
  */
-int
-net_pcap_init(void)
+static int
+net_pcap_ring_open(net_pcap_t *pcap)
 {
-    char errbuf[PCAP_ERRBUF_SIZE];
-    char *str;
+    const uint8_t *mac = pcap->mac;
+    uint32_t mac_hi = (mac[0] << 24) | (mac[1] << 16) | (mac[2] << 8) | mac[3];
+    uint32_t mac_lo = (mac[4] << 8) | mac[5];
+    /* Same as the library filter: broadcast or to us, and not from us. */
+    struct sock_filter code[] = {
+	BPF_STMT(BPF_LD  | BPF_W   | BPF_ABS, 0),		/* destination */
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,   mac_hi, 0, 2),
+	BPF_STMT(BPF_LD  | BPF_H   | BPF_ABS, 4),
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,   mac_lo, 3, 8),
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,   0xffffffff, 0, 7),
+	BPF_STMT(BPF_LD  | BPF_H   | BPF_ABS, 4),
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,   0xffff, 0, 5),
+	BPF_STMT(BPF_LD  | BPF_W   | BPF_ABS, 6),		/* source */
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,   mac_hi, 0, 2),
+	BPF_STMT(BPF_LD  | BPF_H   | BPF_ABS, 10),
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,   mac_lo, 1, 0),
+	BPF_STMT(BPF_RET | BPF_K,             NET_MAX_FRAME),
+	BPF_STMT(BPF_RET | BPF_K,             0)
+    };
+    struct sock_fprog prog = { sizeof(code) / sizeof(code[0]), code };
+    struct tpacket_req3 req;
+    struct sockaddr_ll sll;
+    struct packet_mreq mr;
+    int ver = TPACKET_V3;
+    unsigned int ifindex;
+    void *ring;
+
+    ifindex = if_nametoindex(pcap->host_dev_name);
+    if (ifindex == 0)
+	return 0;
+
+    /* Nothing arrives before bind(), so the filter is in place first. */
+    pcap->ring_fd = socket(AF_PACKET, SOCK_RAW | SOCK_CLOEXEC, 0);
+    if (pcap->ring_fd < 0)
+	return 0;
+
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = PCAP_RING_BLOCK;
+    req.tp_block_nr = PCAP_RING_BLOCKS;
+    req.tp_frame_size = PCAP_RING_FRAME;
+    req.tp_frame_nr = (PCAP_RING_BLOCK / PCAP_RING_FRAME) * PCAP_RING_BLOCKS;
+    req.tp_retire_blk_tov = PCAP_RING_TOV;
+
+    if ((setsockopt(pcap->ring_fd, SOL_PACKET, PACKET_VERSION, &ver, sizeof(ver)) < 0) ||
+	(setsockopt(pcap->ring_fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) < 0) ||
+	(setsockopt(pcap->ring_fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0)) {
+	pcap_log("PCAP: unable to set up the ring (%i)\n", errno);
+	goto fail;
+    }
 
-    /* Did we already load the library? */
-    if (pcap_handle == NULL)
-	return(-1);
+    ring = mmap(NULL, PCAP_RING_BLOCK * PCAP_RING_BLOCKS, PROT_READ | PROT_WRITE,
+		MAP_SHARED, pcap->ring_fd, 0);
+    if (ring == MAP_FAILED) {
+	pcap_log("PCAP: unable to map the ring (%i)\n", errno);
+	goto fail;
+    }
+    pcap->ring = (uint8_t *) ring;
+
+    memset(&sll, 0, sizeof(sll));
+    sll.sll_family = AF_PACKET;
+    sll.sll_protocol = htons(ETH_P_ALL);
+    sll.sll_ifindex = ifindex;
+    if (bind(pcap->ring_fd, (struct sockaddr *) &sll, sizeof(sll)) < 0) {
+	pcap_log("PCAP: unable to bind the ring to %s (%i)\n", pcap->host_dev_name, errno);
+	goto fail;
+    }
 
-    /* Get the PCAP library name and version. */
-    strcpy(errbuf, f_pcap_lib_version());
-    str = strchr(errbuf, '(');
-    if (str != NULL) *(str-1) = '\0';
-    pcap_log("PCAP: initializing, %s\n", errbuf);
+    memset(&mr, 0, sizeof(mr));
+    mr.mr_ifindex = ifindex;
+    mr.mr_type = PACKET_MR_PROMISC;
+    if (setsockopt(pcap->ring_fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mr, sizeof(mr)) < 0)
+	pcap_log("PCAP: unable to make %s promiscuous (%i)\n", pcap->host_dev_name, errno);
+
+    return 1;
+
+fail:
+    if (pcap->ring != NULL)
+	munmap(pcap->ring, PCAP_RING_BLOCK * PCAP_RING_BLOCKS);
+    pcap->ring = NULL;
+    close(pcap->ring_fd);
+    pcap->ring_fd = -1;
+    return 0;
+}
+#endif
 
-    /* Get the value of our capture interface. */
-    if ((network_host[0] == '\0') || !strcmp(network_host, "none")) {
-	pcap_log("PCAP: no interface configured!\n");
-	return(-1);
-    }
 
-    poll_tid = NULL;
-    poll_state = NULL;
-    poll_card = NULL;
+/* Wake the polling thread, the guest has frames for us. */
+static void
+net_pcap_notify_in(void *priv)
+{
+    net_pcap_t *pcap = (net_pcap_t *) priv;
+#ifdef _WIN32
+    thread_set_event(pcap->wake);
+#elif defined(__linux__)
+    uint64_t val = 1;
 
-    return(0);
+    (void) !write(pcap->notify_wr, &val, sizeof(val));
+#else
+    (void) !write(pcap->notify_wr, "", 1);
+#endif
 }
 
 
 /* Close up shop. */
-void
-net_pcap_close(void)
+static void
+net_pcap_close(void *priv)
 {
-    void *pc;
+    net_pcap_t *pcap = (net_pcap_t *) priv;
 
     if (pcap == NULL) return;
 
     pcap_log("PCAP: closing.\n");
 
     /* Tell the polling thread to shut down. */
-    pc = (void *)pcap; pcap = NULL;
+    pcap->stop = 1;
 
-    /* Tell the thread to terminate. */
-    if (poll_tid != NULL) {
-	/* Wait for the thread to finish. */
+    if (pcap->poll_tid != NULL) {
+	/* Wake it up and wait for it to finish. */
 	pcap_log("PCAP: waiting for thread to end...\n");
-	thread_wait_event(poll_state, -1);
+	net_pcap_notify_in(pcap);
+	thread_wait(pcap->poll_tid);
 	pcap_log("PCAP: thread ended\n");
-	thread_destroy_event(poll_state);
-
-	poll_tid = NULL;
-	poll_state = NULL;
-	poll_card = NULL;
     }
+    if (pcap->poll_state != NULL)
+	thread_destroy_event(pcap->poll_state);
 
     /* OK, now shut down Pcap itself. */
-    f_pcap_close(pc);
-    pcap = NULL;
+    if (pcap->pcap != NULL)
+	f_pcap_close(pcap->pcap);
+#ifdef PCAP_USE_RING
+    if (pcap->ring != NULL)
+	munmap(pcap->ring, PCAP_RING_BLOCK * PCAP_RING_BLOCKS);
+    if (pcap->ring_fd >= 0)
+	close(pcap->ring_fd);
+#endif
+
+#ifdef _WIN32
+    if (pcap->wake != NULL)
+	thread_destroy_event(pcap->wake);
+#else
+    if (pcap->notify_rd >= 0)
+	close(pcap->notify_rd);
+    if ((pcap->notify_wr >= 0) && (pcap->notify_wr != pcap->notify_rd))
+	close(pcap->notify_wr);
+#endif
+
+    free(pcap);
 }
 
 
-/*
- * Reset (Win)Pcap and activate it.
- *
- * This is called on every 'cycle' of the emulator,
- * if and as long the NetworkType is set to PCAP,
- * and also as long as we have a NetCard defined.
- *
- * We already know we have PCAP available, as this
- * is called when the network activates itself and
- * tries to attach to the network module.
- */
-int
-net_pcap_reset(const netcard_t *card, uint8_t *mac)
+/* Open the library's capture on the interface, filtered on our MAC. */
+static int
+net_pcap_open(net_pcap_t *pcap)
 {
     char errbuf[PCAP_ERRBUF_SIZE];
     char filter_exp[255];
     struct bpf_program fp;
+    uint8_t *mac = pcap->mac;
 
     /* Open a PCAP live channel. */
-    if ((pcap = f_pcap_open_live(network_host,		/* interface name */
-				 1518,			/* max packet size */
-				 1,			/* promiscuous mode? */
-				 10,			/* timeout in msec */
-			         errbuf)) == NULL) {	/* error buffer */
-	pcap_log(" Unable to open device: %s!\n", network_host);
-	return(-1);
+#ifdef _WIN32
+    pcap->pcap = f_pcap_open_live(pcap->host_dev_name,	/* interface name */
+				  1518,			/* max packet size */
+				  1,			/* promiscuous mode? */
+				  10,			/* timeout in msec */
+				  errbuf);		/* error buffer */
+#else
+    /* Deliver frames as they arrive instead of once the timeout expires. */
+    if ((pcap->pcap = f_pcap_create(pcap->host_dev_name, errbuf)) != NULL) {
+	f_pcap_set_snaplen(pcap->pcap, 1518);
+	f_pcap_set_promisc(pcap->pcap, 1);
+	f_pcap_set_timeout(pcap->pcap, 10);
+	f_pcap_set_immediate_mode(pcap->pcap, 1);
+	if (f_pcap_activate(pcap->pcap) < 0) {
+		f_pcap_close(pcap->pcap);
+		pcap->pcap = NULL;
+	}
     }
-    if (f_pcap_setnonblock((void*)pcap, 1, errbuf) != 0)
+#endif
+    if (pcap->pcap == NULL) {
+	pcap_log(" Unable to open device: %s!\n", pcap->host_dev_name);
+	return(0);
+    }
+    if (f_pcap_setnonblock(pcap->pcap, 1, errbuf) != 0)
         pcap_log("PCAP: failed nonblock %s\n", errbuf);
 
-    pcap_log("PCAP: interface: %s\n", network_host);
+    pcap_log("PCAP: interface: %s\n", pcap->host_dev_name);
 
     /* Create a MAC address based packet filter. */
     pcap_log("PCAP: installing filter for MAC=%02x:%02x:%02x:%02x:%02x:%02x\n",
@@ -397,36 +640,127 @@ net_pcap_reset(const netcard_t *card, uint8_t *mac)
 	"( ((ether dst ff:ff:ff:ff:ff:ff) or (ether dst %02x:%02x:%02x:%02x:%02x:%02x)) and not (ether src %02x:%02x:%02x:%02x:%02x:%02x) )",
 		mac[0], mac[1], mac[2], mac[3], mac[4], mac[5],
 		mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
-    if (f_pcap_compile((void *)pcap, &fp, filter_exp, 0, 0xffffffff) != -1) {
-	if (f_pcap_setfilter((void *)pcap, &fp) != 0) {
+    if (f_pcap_compile(pcap->pcap, &fp, filter_exp, 0, 0xffffffff) != -1) {
+	if (f_pcap_setfilter(pcap->pcap, &fp) != 0) {
 		pcap_log("PCAP: error installing filter (%s) !\n", filter_exp);
-		f_pcap_close((void *)pcap);
-		return(-1);
+		return(0);
 	}
     } else {
 	pcap_log("PCAP: could not compile filter (%s) !\n", filter_exp);
-	f_pcap_close((void *)pcap);
-	return(-1);
+	return(0);
+    }
+
+    return(1);
+}
+
+
+/*
+ * Open a (Win)Pcap channel for one adapter and activate it.
+ *
+ * This is called on every 'cycle' of the emulator, for each adapter
+ * whose NetworkType is set to PCAP, when its card attaches itself to
+ * the network module.
+ */
+static void *
+net_pcap_init(const netcard_t *card, const uint8_t *mac, void *priv)
+{
+    char errbuf[PCAP_ERRBUF_SIZE];
+    net_pcap_t *pcap;
+    char *str;
+
+    /* Did we already load the library? */
+    if (pcap_handle == NULL)
+	return(NULL);
+
+    /* Get the PCAP library name and version. */
+    strcpy(errbuf, f_pcap_lib_version());
+    str = strchr(errbuf, '(');
+    if (str != NULL) *(str-1) = '\0';
+    pcap_log("PCAP: initializing, %s\n", errbuf);
+
+    /* Get the value of our capture interface. */
+    if ((((char *) priv)[0] == '\0') || !strcmp((char *) priv, "none")) {
+	pcap_log("PCAP: no interface configured!\n");
+	return(NULL);
     }
 
-    /* Save the callback info. */
-    poll_card = card;
+    pcap = (net_pcap_t *) calloc(1, sizeof(net_pcap_t));
+    if (pcap == NULL)
+	return(NULL);
+    strncpy(pcap->host_dev_name, (char *) priv, sizeof(pcap->host_dev_name) - 1);
+    memcpy(pcap->mac, mac, sizeof(pcap->mac));
+    pcap->card = card;
+#ifdef PCAP_USE_RING
+    pcap->ring_fd = -1;
+#endif
+#ifdef _WIN32
+    pcap->wake = thread_create_event();
+#else
+# ifdef __linux__
+    pcap->notify_rd = pcap->notify_wr = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+# else
+    int fds[2];
+    if (pipe(fds) < 0)
+	fds[0] = fds[1] = -1;
+    pcap->notify_rd = fds[0];
+    pcap->notify_wr = fds[1];
+    if (pcap->notify_rd >= 0) {
+	fcntl(pcap->notify_rd, F_SETFL, fcntl(pcap->notify_rd, F_GETFL) | O_NONBLOCK);
+	fcntl(pcap->notify_wr, F_SETFL, fcntl(pcap->notify_wr, F_GETFL) | O_NONBLOCK);
+    }
+# endif
+    if (pcap->notify_rd < 0) {
+	pcap_log("PCAP: unable to create the notification descriptor\n");
+	net_pcap_close(pcap);
+	return(NULL);
+    }
+#endif
+
+#ifdef PCAP_USE_RING
+    /* Optionally skip the library and map the kernel's ring ourselves. */
+    if (net_cards_conf[card->card_num].pcap_mmap_ring) {
+	if (net_pcap_ring_open(pcap))
+		pcap_log("PCAP: using a TPACKET_V3 ring on %s\n", pcap->host_dev_name);
+	else
+		pclog("PCAP: unable to use a packet ring on %s, using the library\n", pcap->host_dev_name);
+    }
+    if ((pcap->ring_fd < 0) && !net_pcap_open(pcap)) {
+#else
+    if (! net_pcap_open(pcap)) {
+#endif
+	net_pcap_close(pcap);
+	return(NULL);
+    }
 
     pcap_log("PCAP: starting thread..\n");
-    poll_state = thread_create_event();
-    poll_tid = thread_create(poll_thread, mac);
-    thread_wait_event(poll_state, -1);
+    pcap->poll_state = thread_create_event();
+    pcap->poll_tid = thread_create(poll_thread, pcap);
+    thread_wait_event(pcap->poll_state, -1);
+    thread_reset_event(pcap->poll_state);
 
-    return(0);
+    return(pcap);
 }
 
 
 /* Send a packet to the Pcap interface. */
-void
-net_pcap_in(uint8_t *bufp, int len)
+static void
+net_pcap_in(void *priv, uint8_t *bufp, int len)
 {
-    if (pcap == NULL)
-	return;
+    net_pcap_t *pcap = (net_pcap_t *) priv;
 
-    f_pcap_sendpacket((void *)pcap, bufp, len);
+#ifdef PCAP_USE_RING
+    if (pcap->ring_fd >= 0) {
+	(void) !send(pcap->ring_fd, bufp, len, 0);
+	return;
+    }
+#endif
+    f_pcap_sendpacket(pcap->pcap, bufp, len);
 }
+
+
+const netdrv_t net_pcap_drv = {
+    .init = net_pcap_init,
+    .in = net_pcap_in,
+    .close = net_pcap_close,
+    .notify_in = net_pcap_notify_in
+};
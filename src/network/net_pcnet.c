@@ -71,6 +71,12 @@ typedef struct RTNETETHERHDR
 /** Maximum frame size we handle */
 #define MAX_FRAME                       1536
 
+/** Transmit descriptors fetched with one guest memory access */
+#define PCNET_TX_BATCH                  16
+
+/** Automatic transmit poll interval while the ring is empty, in us */
+#define PCNET_TX_POLL_US                1600
+
 /** @name Bus configuration registers
  * @{ */
 #define BCR_MSRDA       0
@@ -259,6 +265,14 @@ typedef struct {
     int transfer_size;
     uint8_t maclocal[6]; /* configured MAC (local) address */
     pc_timer_t timer_soft_int, timer_restore;
+    netcard_t *netcard;
+    /** Transmit descriptors fetched ahead while transmitting, see pcnetTmdFetch(). */
+    uint8_t  abTxDesc[PCNET_TX_BATCH * 16];
+    uint32_t GCTxDesc;
+    int      cTxDesc;
+    /** The last transmit poll found the ring empty. */
+    int      fTxRingIdle;
+    uint64_t u64TxPollNext;
 } nic_t;
 
 /** @todo All structs: big endian? */
@@ -441,9 +455,25 @@ pcnetIsLinkUp(nic_t *dev)
 }
 
 
+/** Size of a descriptor as stored in guest memory. */
+static __inline int
+pcnetDescSize(nic_t *dev)
+{
+    return BCR_SWSTYLE(dev) ? 16 : 8;
+}
+
+
+/** Whether the transmit descriptor at the given address has been fetched ahead. */
+static __inline int
+pcnetTmdCached(nic_t *dev, uint32_t addr)
+{
+    return dev->cTxDesc && ((addr - dev->GCTxDesc) < (uint32_t) (dev->cTxDesc << dev->iLog2DescSize));
+}
+
+
 /**
  * Load transmit message descriptor
- * Make sure we read the own flag first.
+ * The whole descriptor is read at once, then the own flag is checked.
  *
  * @param pThis         adapter private data
  * @param addr          physical address of the descriptor
@@ -453,47 +483,56 @@ pcnetIsLinkUp(nic_t *dev)
 static __inline int
 pcnetTmdLoad(nic_t *dev, TMD *tmd, uint32_t addr, int fRetIfNotOwn)
 {
-    uint8_t    ownbyte, bytes[4] = { 0, 0, 0, 0 };
-    uint16_t xda[4];
-    uint32_t xda32[4];
+    union {
+	uint8_t  b[16];
+	uint16_t w[8];
+	uint32_t l[4];
+    } xda;
+    uint8_t ownbyte;
+
+    if (pcnetTmdCached(dev, addr))
+	memcpy(xda.b, &dev->abTxDesc[addr - dev->GCTxDesc], pcnetDescSize(dev));
+    else
+	dma_bm_read(addr, xda.b, pcnetDescSize(dev), dev->transfer_size);
 
     if (BCR_SWSTYLE(dev) == 0) {
-	dma_bm_read(addr, (uint8_t *) bytes, 4, dev->transfer_size);
-	ownbyte = bytes[3];
+	ownbyte = xda.b[3];
         if (!(ownbyte & 0x80) && fRetIfNotOwn)
             return 0;
-        dma_bm_read(addr, (uint8_t*)&xda[0], sizeof(xda), dev->transfer_size);
-        ((uint32_t *)tmd)[0] = (uint32_t)xda[0] | ((uint32_t)(xda[1] & 0x00ff) << 16);
-        ((uint32_t *)tmd)[1] = (uint32_t)xda[2] | ((uint32_t)(xda[1] & 0xff00) << 16);
-        ((uint32_t *)tmd)[2] = (uint32_t)xda[3] << 16;
+        ((uint32_t *)tmd)[0] = (uint32_t)xda.w[0] | ((uint32_t)(xda.w[1] & 0x00ff) << 16);
+        ((uint32_t *)tmd)[1] = (uint32_t)xda.w[2] | ((uint32_t)(xda.w[1] & 0xff00) << 16);
+        ((uint32_t *)tmd)[2] = (uint32_t)xda.w[3] << 16;
         ((uint32_t *)tmd)[3] = 0;
     } else if (BCR_SWSTYLE(dev) != 3) {
-	dma_bm_read(addr + 4, (uint8_t *) bytes, 4, dev->transfer_size);
-	ownbyte = bytes[3];
+	ownbyte = xda.b[7];
         if (!(ownbyte & 0x80) && fRetIfNotOwn)
             return 0;
-        dma_bm_read(addr, (uint8_t*)tmd, 16, dev->transfer_size);
+        memcpy(tmd, xda.b, 16);
     } else {
-	dma_bm_read(addr + 4, (uint8_t *) bytes, 4, dev->transfer_size);
-	ownbyte = bytes[3];
+	ownbyte = xda.b[7];
         if (!(ownbyte & 0x80) && fRetIfNotOwn)
             return 0;
-        dma_bm_read(addr, (uint8_t*)&xda32[0], sizeof(xda32), dev->transfer_size);
-        ((uint32_t *)tmd)[0] = xda32[2];
-        ((uint32_t *)tmd)[1] = xda32[1];
-        ((uint32_t *)tmd)[2] = xda32[0];
-        ((uint32_t *)tmd)[3] = xda32[3];
+        ((uint32_t *)tmd)[0] = xda.l[2];
+        ((uint32_t *)tmd)[1] = xda.l[1];
+        ((uint32_t *)tmd)[2] = xda.l[0];
+        ((uint32_t *)tmd)[3] = xda.l[3];
     }
-    /* Double check the own bit; guest drivers might be buggy and lock prefixes in the recompiler are ignored by other threads. */
-    if (tmd->tmd1.own == 1 && !(ownbyte & 0x80))
-        pcnetlog(3, "%s: pcnetTmdLoad: own bit flipped while reading!!\n", dev->name);
-    if (!(ownbyte & 0x80))
-        tmd->tmd1.own = 0;
 
     return !!tmd->tmd1.own;
 }
 
 
+/** Write back part of a transmit descriptor, keeping the fetched copy in sync. */
+static __inline void
+pcnetTmdWrite(nic_t *dev, uint32_t addr, uint8_t *data, int len)
+{
+    dma_bm_write(addr, data, len, dev->transfer_size);
+
+    if (pcnetTmdCached(dev, addr))
+	memcpy(&dev->abTxDesc[addr - dev->GCTxDesc], data, len);
+}
+
+
 /**
  * Store transmit message descriptor and hand it over to the host (the VM guest).
  * Make sure that all data are transmitted before we clear the own flag.
@@ -514,14 +553,14 @@ pcnetTmdStorePassHost(nic_t *dev, TMD *tmd, uint32_t addr)
         dma_bm_write(addr, (uint8_t*)&xda[0], sizeof(xda), dev->transfer_size);
 #endif
         xda[1] &= ~0x8000;
-        dma_bm_write(addr, (uint8_t*)&xda[0], sizeof(xda), dev->transfer_size);
+        pcnetTmdWrite(dev, addr, (uint8_t*)&xda[0], sizeof(xda));
     } else if (BCR_SWSTYLE(dev) != 3) {
 #if 0
         ((uint32_t*)tmd)[1] |=  0x80000000;
         dma_bm_write(addr, (uint8_t*)tmd, 12, dev->transfer_size);
 #endif
         ((uint32_t*)tmd)[1] &= ~0x80000000;
-        dma_bm_write(addr, (uint8_t*)tmd, 12, dev->transfer_size);
+        pcnetTmdWrite(dev, addr, (uint8_t*)tmd, 12);
     } else {
         xda32[0] = ((uint32_t *)tmd)[2];
         xda32[1] = ((uint32_t *)tmd)[1];
@@ -531,14 +570,14 @@ pcnetTmdStorePassHost(nic_t *dev, TMD *tmd, uint32_t addr)
         dma_bm_write(addr, (uint8_t*)&xda32[0], sizeof(xda32), dev->transfer_size);
 #endif
         xda32[1] &= ~0x80000000;
-        dma_bm_write(addr, (uint8_t*)&xda32[0], sizeof(xda32), dev->transfer_size);
+        pcnetTmdWrite(dev, addr, (uint8_t*)&xda32[0], sizeof(xda32));
     }
 }
 
 
 /**
  * Load receive message descriptor
- * Make sure we read the own flag first.
+ * The whole descriptor is read at once, then the own flag is checked.
  *
  * @param pThis         adapter private data
  * @param addr          physical address of the descriptor
@@ -548,43 +587,37 @@ pcnetTmdStorePassHost(nic_t *dev, TMD *tmd, uint32_t addr)
 static __inline int
 pcnetRmdLoad(nic_t *dev, RMD *rmd, uint32_t addr, int fRetIfNotOwn)
 {
-    uint8_t    ownbyte, bytes[4] = { 0, 0, 0, 0 };
-    uint16_t rda[4];
-    uint32_t rda32[4];
+    union {
+	uint8_t  b[16];
+	uint16_t w[8];
+	uint32_t l[4];
+    } rda;
+    uint8_t ownbyte;
+
+    dma_bm_read(addr, rda.b, pcnetDescSize(dev), dev->transfer_size);
 
     if (BCR_SWSTYLE(dev) == 0) {
-        dma_bm_read(addr, (uint8_t *) bytes, 4, dev->transfer_size);
-	ownbyte = bytes[3];
+	ownbyte = rda.b[3];
         if (!(ownbyte & 0x80) && fRetIfNotOwn)
             return 0;
-        dma_bm_read(addr, (uint8_t*)&rda[0], sizeof(rda), dev->transfer_size);
-        ((uint32_t *)rmd)[0] = (uint32_t)rda[0] | ((rda[1] & 0x00ff) << 16);
-        ((uint32_t *)rmd)[1] = (uint32_t)rda[2] | ((rda[1] & 0xff00) << 16);
-        ((uint32_t *)rmd)[2] = (uint32_t)rda[3];
+        ((uint32_t *)rmd)[0] = (uint32_t)rda.w[0] | ((rda.w[1] & 0x00ff) << 16);
+        ((uint32_t *)rmd)[1] = (uint32_t)rda.w[2] | ((rda.w[1] & 0xff00) << 16);
+        ((uint32_t *)rmd)[2] = (uint32_t)rda.w[3];
         ((uint32_t *)rmd)[3] = 0;
     } else if (BCR_SWSTYLE(dev) != 3) {
-        dma_bm_read(addr + 4, (uint8_t *) bytes, 4, dev->transfer_size);
-	ownbyte = bytes[3];
+	ownbyte = rda.b[7];
         if (!(ownbyte & 0x80) && fRetIfNotOwn)
             return 0;
-        dma_bm_read(addr, (uint8_t*)rmd, 16, dev->transfer_size);
+        memcpy(rmd, rda.b, 16);
     } else {
-        dma_bm_read(addr + 4, (uint8_t *) bytes, 4, dev->transfer_size);
-	ownbyte = bytes[3];
+	ownbyte = rda.b[7];
         if (!(ownbyte & 0x80) && fRetIfNotOwn)
             return 0;
-        dma_bm_read(addr, (uint8_t*)&rda32[0], sizeof(rda32), dev->transfer_size);
-        ((uint32_t *)rmd)[0] = rda32[2];
-        ((uint32_t *)rmd)[1] = rda32[1];
-        ((uint32_t *)rmd)[2] = rda32[0];
-        ((uint32_t *)rmd)[3] = rda32[3];
+        ((uint32_t *)rmd)[0] = rda.l[2];
+        ((uint32_t *)rmd)[1] = rda.l[1];
+        ((uint32_t *)rmd)[2] = rda.l[0];
+        ((uint32_t *)rmd)[3] = rda.l[3];
     }
-    /* Double check the own bit; guest drivers might be buggy and lock prefixes in the recompiler are ignored by other threads. */
-    if (rmd->rmd1.own == 1 && !(ownbyte & 0x80))
-        pcnetlog(3, "%s: pcnetRmdLoad: own bit flipped while reading!!\n", dev->name);
-
-    if (!(ownbyte & 0x80))
-        rmd->rmd1.own = 0;
 
     return !!rmd->rmd1.own;
 }
@@ -1038,6 +1071,7 @@ pcnetStart(nic_t *dev)
         dev->aCSR[0] |= 0x0020;    /* set RXON */
     dev->aCSR[0] &= ~0x0004;       /* clear STOP bit */
     dev->aCSR[0] |= 0x0002;       /* STRT */
+    dev->fTxRingIdle = 0;
     pcnetPollTimer(dev);
 }
 
@@ -1136,6 +1170,28 @@ pcnetRdtePoll(nic_t *dev)
 }
 
 
+/**
+ * Fetch the transmit descriptors from the current one up to the end of the
+ * ring, where they are contiguous, with a single guest memory access. The
+ * copy is only used until pcnetAsyncTransmit() returns, the guest cannot
+ * touch the ring meanwhile and our own writes go through it.
+ */
+static void
+pcnetTmdFetch(nic_t *dev)
+{
+    int cb = pcnetDescSize(dev);
+    int count = MIN(CSR_XMTRC(dev), PCNET_TX_BATCH);
+
+    dev->cTxDesc = 0;
+    if ((cb != (1 << dev->iLog2DescSize)) || (count < 2))
+	return;
+
+    dev->GCTxDesc = PHYSADDR(dev, pcnetTdraAddr(dev, CSR_XMTRC(dev)));
+    dma_bm_read(dev->GCTxDesc, dev->abTxDesc, count * cb, dev->transfer_size);
+    dev->cTxDesc = count;
+}
+
+
 /**
  * Poll Transmit Descriptor Table Entry
  * @return true if transmit descriptors available
@@ -1492,8 +1548,22 @@ pcnetAsyncTransmit(nic_t *dev)
     int cMax = 32;
     do {
         TMD tmd;
-        if (!pcnetTdtePoll(dev, &tmd))
+        if (!pcnetTdtePoll(dev, &tmd)) {
+            if (cMax == 32) {
+                /* Nothing to send: the demand is served, and the ring is not
+                 * looked at again before the guest writes CSR0 or the poll
+                 * interval is over. */
+                dev->aCSR[0] &= ~0x0008; /* clear TDMD */
+                dev->fTxRingIdle = 1;
+                dev->u64TxPollNext = tsc + ((PCNET_TX_POLL_US * TIMER_USEC) >> 32);
+            }
             break;
+        }
+        dev->fTxRingIdle = 0;
+
+        /* Fetch what follows in the ring along with this descriptor. */
+        if (!pcnetTmdCached(dev, PHYSADDR(dev, CSR_CXDA(dev))))
+            pcnetTmdFetch(dev);
 
         /* Don't continue sending packets when the link is down. */
         if ((!pcnetIsLinkUp(dev)
@@ -1523,13 +1593,14 @@ pcnetAsyncTransmit(nic_t *dev)
 		    dma_bm_read(PHYSADDR(dev, tmd.tmd0.tbadr), dev->abLoopBuf, cb, dev->transfer_size);
 
 		    if (fLoopback) {
+			dev->cTxDesc = 0;
 			if (HOST_IS_OWNER(CSR_CRST(dev)))
 			    pcnetRdtePoll(dev);
 
 			pcnetReceiveNoSync(dev, dev->abLoopBuf, dev->xmit_pos);
 		    } else {
 			pcnetlog(3, "%s: pcnetAsyncTransmit: transmit loopbuf stp and enp, xmit pos = %d\n", dev->name, dev->xmit_pos);
-			network_tx(dev->abLoopBuf, dev->xmit_pos);
+			network_tx(dev->netcard, dev->abLoopBuf, dev->xmit_pos);
 		    }
 		} else if (cb == 4096) {
 		    /* The Windows NT4 pcnet driver sometimes marks the first
@@ -1633,6 +1704,7 @@ pcnetAsyncTransmit(nic_t *dev)
                  */
                 if (tmd.tmd1.enp) {
 		    if (fLoopback) {
+			dev->cTxDesc = 0;
 			if (HOST_IS_OWNER(CSR_CRST(dev)))
 			    pcnetRdtePoll(dev);
 
@@ -1640,7 +1712,7 @@ pcnetAsyncTransmit(nic_t *dev)
 			pcnetReceiveNoSync(dev, dev->abLoopBuf, dev->xmit_pos);
 		    } else {
 			pcnetlog(3, "%s: pcnetAsyncTransmit: transmit loopbuf enp\n", dev->name);
-			network_tx(dev->abLoopBuf, dev->xmit_pos);
+			network_tx(dev->netcard, dev->abLoopBuf, dev->xmit_pos);
 		    }
 
                     /* Write back the TMD, pass it to the host */
@@ -1668,6 +1740,9 @@ pcnetAsyncTransmit(nic_t *dev)
             break;
     } while (CSR_TXON(dev));          /* transfer on */
 
+    /* The guest may rewrite the ring once we return. */
+    dev->cTxDesc = 0;
+
     if (cFlushIrq) {
 	dev->aCSR[0] |= 0x0200; /* set TINT */
 	/* Don't allow the guest to clear TINT before reading it */
@@ -1693,7 +1768,10 @@ pcnetPollRxTx(nic_t *dev)
             pcnetRdtePoll(dev);
     }
 
-    if (CSR_TDMD(dev) || (CSR_TXON(dev) && !CSR_DPOLL(dev)))
+    /* An empty ring is polled again at the chip's own pace only, so that
+     * every register access does not cost a descriptor read. */
+    if (CSR_TDMD(dev) || (CSR_TXON(dev) && !CSR_DPOLL(dev) &&
+        (!dev->fTxRingIdle || ((int64_t) (tsc - dev->u64TxPollNext) >= 0))))
         pcnetAsyncTransmit(dev);
 }
 
@@ -1769,6 +1847,7 @@ pcnet_csr_writew(nic_t *dev, uint16_t rap, uint16_t val)
 	    pcnetlog(2, "%s: CSR0 val = %04x, val2 = %04x\n", dev->name, val, dev->aCSR[0]);
 
 	    dev->aCSR[0] = csr0;
+	    dev->fTxRingIdle = 0;
 
 	    if (!CSR_STOP(dev) && (val & 4)) {
 		pcnetlog(3, "%s: pcnet_csr_writew(): Stop\n", dev->name);
@@ -2929,6 +3008,8 @@ pcnet_init(const device_t *info)
 
     dev->fLinkUp = 1;
     dev->cMsLinkUpDelay = 5000;
+    /* kbit/s, only the PCnet-FAST III is a 100 Mbit part. */
+    dev->u32LinkSpeed = (dev->board == DEV_AM79C973) ? 100000 : 10000;
 
     if (dev->board == DEV_AM79C960_EB) {
 	    dev->maclocal[0] = 0x02;  /* 02:07:01 (Racal OID) */
@@ -3048,7 +3129,8 @@ pcnet_init(const device_t *info)
     pcnetHardReset(dev);
 
     /* Attach ourselves to the network module. */
-    network_attach(dev, dev->aPROM, pcnetReceiveNoSync, pcnetWaitReceiveAvail, pcnetSetLinkState);
+    dev->netcard = network_attach(dev, dev->aPROM, pcnetReceiveNoSync, pcnetWaitReceiveAvail, pcnetSetLinkState);
+    network_set_link_speed(dev->netcard, dev->u32LinkSpeed);
 
     if (dev->board == DEV_AM79C973)
         timer_add(&dev->timer_soft_int, pcnetTimerSoftInt, dev, 0);
@@ -3066,10 +3148,10 @@ pcnet_close(void *priv)
 
     pcnetlog(1, "%s: closed\n", dev->name);
 
-    /* Make sure the platform layer is shut down. */
-    network_close();
-
     if (dev) {
+	/* Make sure the platform layer is shut down. */
+	network_detach(dev->netcard);
+
 	free(dev);
 	dev = NULL;
 
@@ -38,10 +38,15 @@
 
 
 /* SLiRP can use poll() or select() for socket polling.
-   poll() is best on *nix but slow and limited on Windows. */
+   poll() is best on *nix but slow and limited on Windows. On Linux the
+   sockets stay registered with epoll instead of being handed to the
+   kernel again on every round. */
 #ifndef _WIN32
 # define SLIRP_USE_POLL 1
 #endif
+#ifdef __linux__
+# define SLIRP_USE_EPOLL 1
+#endif
 #ifdef SLIRP_USE_POLL
 # ifdef _WIN32
 #  include <winsock2.h>
@@ -50,26 +55,60 @@
 #  include <poll.h>
 # endif
 #endif
+#ifdef SLIRP_USE_EPOLL
+# include <sys/epoll.h>
+# include <sys/eventfd.h>
+#endif
+#ifndef _WIN32
+# include <errno.h>
+# include <fcntl.h>
+# include <unistd.h>
+#endif
+
+#define SLIRP_EPOLL_EVENTS	64	/* events taken per epoll_wait() */
+
+
+#ifdef SLIRP_USE_EPOLL
+/* Kernel registration of one descriptor, indexed by fd. */
+typedef struct {
+    uint8_t		registered;
+    uint32_t		events;
+    uint32_t		round;		/* last round SLiRP asked for it */
+    int			idx;		/* its pfd[] slot in that round */
+} slirp_fd_t;
+#endif
 
 
 typedef struct {
     Slirp		*slirp;
     void		*mac;
     const netcard_t	*card; /* netcard attached to us */
+    int			card_num;
     volatile thread_t	*poll_tid;
     event_t		*poll_state;
-    uint8_t		stop;
+    volatile uint8_t	stop;
 #ifdef SLIRP_USE_POLL
     uint32_t		pfd_len, pfd_size;
     struct pollfd 	*pfd;
 #else
     uint32_t		nfds;
     fd_set		rfds, wfds, xfds;
+    event_t		*wake;		/* guest frames are waiting */
+#endif
+#ifndef _WIN32
+    int			notify_rd, notify_wr;	/* guest frames are waiting */
+#endif
+#ifdef SLIRP_USE_EPOLL
+    int			epfd;
+    uint32_t		round;
+    int			fd_size;
+    uint32_t		nreg;
+    slirp_fd_t		*fds;
+    int			*reg;		/* descriptors now in the epoll set */
+    struct epoll_event	evs[SLIRP_EPOLL_EVENTS];
 #endif
 } slirp_t;
 
-static slirp_t	*slirp;
-
 
 #ifdef ENABLE_SLIRP_LOG
 int slirp_do_log = ENABLE_SLIRP_LOG;
@@ -139,8 +178,27 @@ net_slirp_register_poll_fd(int fd, void *opaque)
 static void
 net_slirp_unregister_poll_fd(int fd, void *opaque)
 {
+#ifdef SLIRP_USE_EPOLL
+    slirp_t *slirp = (slirp_t *) opaque;
+    uint32_t i;
+
+    /* SLiRP is closing the socket, forget it so that a new socket which
+       gets the same number is added to the epoll set again. */
+    if ((fd < 0) || (fd >= slirp->fd_size) || !slirp->fds[fd].registered)
+	return;
+
+    (void) epoll_ctl(slirp->epfd, EPOLL_CTL_DEL, fd, NULL);
+    slirp->fds[fd].registered = 0;
+    for (i = 0; i < slirp->nreg; i++) {
+	if (slirp->reg[i] == fd) {
+		slirp->reg[i] = slirp->reg[--slirp->nreg];
+		break;
+	}
+    }
+#else
     (void) fd;
     (void) opaque;
+#endif
 }
 
 
@@ -171,7 +229,7 @@ net_slirp_send_packet(const void *qp, size_t pkt_len, void *opaque)
 	mac_cmp16[1] = *(uint16_t *) (mac + 4);
 	if ((mac_cmp32[0] != mac_cmp32[1]) ||
 	    (mac_cmp16[0] != mac_cmp16[1])) {
-		network_queue_put(0, slirp->card->priv, (uint8_t *) qp, pkt_len);
+		network_queue_put(slirp->card, NET_QUEUE_RX, (uint8_t *) qp, pkt_len);
 	}
 
 	return pkt_len;
@@ -250,11 +308,114 @@ net_slirp_get_revents(int idx, void *opaque)
 }
 
 
+#ifndef _WIN32
+/* Swallow pending wakeups, the frames themselves are picked up afterwards. */
+static void
+net_slirp_drain_notify(slirp_t *slirp)
+{
+# ifdef SLIRP_USE_EPOLL
+    uint64_t val;
+
+    (void) !read(slirp->notify_rd, &val, sizeof(val));
+# else
+    uint8_t buf[64];
+
+    while (read(slirp->notify_rd, buf, sizeof(buf)) > 0)
+	;
+# endif
+}
+#endif
+
+
+#ifdef SLIRP_USE_EPOLL
+static int
+net_slirp_epoll_ctl(slirp_t *slirp, int op, int fd, uint32_t events)
+{
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.fd = fd;
+
+    return epoll_ctl(slirp->epfd, op, fd, &ev);
+}
+
+
+/* Bring the epoll set in line with what SLiRP asked for this round,
+   touching only the descriptors that came, went or changed. */
+static void
+net_slirp_epoll_sync(slirp_t *slirp)
+{
+    slirp_fd_t *fds;
+    int *reg;
+    uint32_t i, n;
+    int fd, size;
+
+    slirp->round++;
+
+    for (i = 0; i < slirp->pfd_len; i++) {
+	fd = slirp->pfd[i].fd;
+	slirp->pfd[i].revents = 0;
+	if (fd < 0)
+		continue;
+
+	if (fd >= slirp->fd_size) {
+		size = MAX(fd + 1, slirp->fd_size * 2);
+		fds = realloc(slirp->fds, size * sizeof(slirp_fd_t));
+		if (fds)
+			slirp->fds = fds;
+		reg = realloc(slirp->reg, size * sizeof(int));
+		if (reg)
+			slirp->reg = reg;
+		if (!fds || !reg)
+			continue;
+		memset(&slirp->fds[slirp->fd_size], 0, (size - slirp->fd_size) * sizeof(slirp_fd_t));
+		slirp->fd_size = size;
+	}
+
+	/* The poll and epoll event bits are the same on Linux. */
+	if (!slirp->fds[fd].registered) {
+		if (net_slirp_epoll_ctl(slirp, EPOLL_CTL_ADD, fd, slirp->pfd[i].events) < 0)
+			continue;
+		slirp->fds[fd].registered = 1;
+		slirp->reg[slirp->nreg++] = fd;
+	} else if (slirp->fds[fd].events != slirp->pfd[i].events) {
+		/* A closed socket leaves the set by itself, and its number may
+		   already belong to a new one. */
+		if ((net_slirp_epoll_ctl(slirp, EPOLL_CTL_MOD, fd, slirp->pfd[i].events) < 0) &&
+		    ((errno != ENOENT) || (net_slirp_epoll_ctl(slirp, EPOLL_CTL_ADD, fd, slirp->pfd[i].events) < 0)))
+			continue;
+	}
+	slirp->fds[fd].events = slirp->pfd[i].events;
+	slirp->fds[fd].round = slirp->round;
+	slirp->fds[fd].idx = i;
+    }
+
+    /* Drop whatever SLiRP no longer cares about. */
+    for (n = i = 0; i < slirp->nreg; i++) {
+	fd = slirp->reg[i];
+	if (slirp->fds[fd].round == slirp->round)
+		slirp->reg[n++] = fd;
+	else {
+		(void) net_slirp_epoll_ctl(slirp, EPOLL_CTL_DEL, fd, 0);
+		slirp->fds[fd].registered = 0;
+	}
+    }
+    slirp->nreg = n;
+}
+#endif
+
+
 static void
 slirp_tic(slirp_t *slirp)
 {
     int ret;
     uint32_t tmo;
+#ifdef SLIRP_USE_EPOLL
+    int fd, i;
+#elif defined(SLIRP_USE_POLL)
+    int notify_idx;
+#endif
 
     /* Let SLiRP create a list of all open sockets. */
 #ifdef SLIRP_USE_POLL
@@ -268,9 +429,25 @@ slirp_tic(slirp_t *slirp)
 #endif
     slirp_pollfds_fill(slirp->slirp, &tmo, net_slirp_add_poll, slirp);
 
-    /* Now wait for something to happen, or at most 'tmo' usec. */
-#ifdef SLIRP_USE_POLL
+    /* Now wait for something to happen, or at most 'tmo' msec. The guest
+       wakes us up through the notification descriptor. */
+#ifdef SLIRP_USE_EPOLL
+    net_slirp_epoll_sync(slirp);
+
+    ret = epoll_wait(slirp->epfd, slirp->evs, SLIRP_EPOLL_EVENTS, (int) tmo);
+    for (i = 0; i < ret; i++) {
+	fd = slirp->evs[i].data.fd;
+	if (fd == slirp->notify_rd)
+		net_slirp_drain_notify(slirp);
+	else if ((fd < slirp->fd_size) && (slirp->fds[fd].round == slirp->round))
+		slirp->pfd[slirp->fds[fd].idx].revents = slirp->evs[i].events;
+    }
+#elif defined(SLIRP_USE_POLL)
+    notify_idx = net_slirp_add_poll(slirp->notify_rd, SLIRP_POLL_IN, slirp);
+
     ret = poll(slirp->pfd, slirp->pfd_len, tmo);
+    if ((ret > 0) && (notify_idx >= 0) && slirp->pfd[notify_idx].revents)
+	net_slirp_drain_notify(slirp);
 #else
     if (tmo < 0)
 	tmo = 500;
@@ -305,8 +482,9 @@ static void
 poll_thread(void *arg)
 {
     slirp_t *slirp = (slirp_t *) arg;
-    event_t *evt;
+#ifdef _WIN32
     int tx;
+#endif
 
     slirp_log("SLiRP: initializing...\n");
 
@@ -323,13 +501,18 @@ poll_thread(void *arg)
     slirp->slirp = slirp_init(0, 1, net, mask, host, 0, ipv6_dummy, 0, ipv6_dummy, NULL, NULL, NULL, NULL, dhcp, dns, ipv6_dummy, NULL, NULL, &slirp_cb, arg);
     if (!slirp->slirp) {
 	slirp_log("SLiRP: initialization failed\n");
+	thread_set_event(slirp->poll_state);
 	return;
     }
 
-    /* Set up port forwarding. */
+    /* Set up port forwarding, the first adapter keeps the old section name. */
     int udp, external, internal, i = 0;
-    char *category = "SLiRP Port Forwarding";
+    char category[64];
     char key[20];
+    if (slirp->card_num == 0)
+	strcpy(category, "SLiRP Port Forwarding");
+    else
+	sprintf(category, "SLiRP Port Forwarding #%i", slirp->card_num + 1);
     while (1) {
 	sprintf(key, "%d_protocol", i);
 	udp = strcmp(config_get_string(category, key, "tcp"), "udp") == 0;
@@ -356,112 +539,161 @@ poll_thread(void *arg)
     slirp_log("SLiRP: polling started.\n");
     thread_set_event(slirp->poll_state);
 
-    /* Create a waitable event. */
-    evt = thread_create_event();
-
     while (!slirp->stop) {
-	/* Request ownership of the queue. */
-	network_wait(1);
-
-	/* Stop processing if asked to. */
-	if (slirp->stop) {
-		network_wait(0);
-		break;
-	}
-
-	/* See if there is any work. */
+	/* Sleep until a socket, a SLiRP timeout or the guest needs us. */
 	slirp_tic(slirp);
 
-	/* Wait for the next packet to arrive - network_do_tx() is called from there. */
-	tx = network_tx_queue_check();
+	/* Hand everything the guest has queued so far to SLiRP in one go. */
+#ifdef _WIN32
+	tx = network_tx_queue_check(slirp->card);
 
-	/* Release ownership of the queue. */
-	network_wait(0);
-
-	/* If we did not get anything, wait a while. */
-	if (!tx)
-		thread_wait_event(evt, 10);
+	/* select() cannot watch the guest, so wait for it separately. */
+	if (!tx) {
+		thread_wait_event(slirp->wake, 10);
+		thread_reset_event(slirp->wake);
+	}
+#else
+	network_tx_queue_check(slirp->card);
+#endif
     }
 
-    /* No longer needed. */
-    if (evt)
-	thread_destroy_event(evt);
-
     slirp_log("SLiRP: polling stopped.\n");
-    thread_set_event(slirp->poll_state);
-
-    /* Destroy event here to avoid a crash. */
-    slirp_log("SLiRP: thread ended\n");
-    thread_destroy_event(slirp->poll_state);
-    /* Free here instead of immediately freeing the global slirp on the main
-       thread to avoid a race condition. */
-    slirp_cleanup(slirp->slirp);
-    free(slirp);
 }
 
 
-/* Initialize SLiRP for use. */
-int
-net_slirp_init(void)
+static void
+net_slirp_free(slirp_t *slirp)
 {
-    return 0;
+    if (slirp->poll_state)
+	thread_destroy_event(slirp->poll_state);
+#ifdef SLIRP_USE_POLL
+    free(slirp->pfd);
+#else
+    thread_destroy_event(slirp->wake);
+#endif
+#ifdef SLIRP_USE_EPOLL
+    if (slirp->epfd >= 0)
+	close(slirp->epfd);
+    free(slirp->fds);
+    free(slirp->reg);
+#endif
+#ifndef _WIN32
+    if (slirp->notify_rd >= 0)
+	close(slirp->notify_rd);
+    if ((slirp->notify_wr >= 0) && (slirp->notify_wr != slirp->notify_rd))
+	close(slirp->notify_wr);
+#endif
+    free(slirp);
 }
 
 
-/* Initialize SLiRP for use. */
-int
-net_slirp_reset(const netcard_t *card, uint8_t *mac)
+/* Initialize SLiRP for use by one adapter. */
+static void *
+net_slirp_init(const netcard_t *card, const uint8_t *mac, void *priv)
 {
-    slirp_t *new_slirp = malloc(sizeof(slirp_t));
-    memset(new_slirp, 0, sizeof(slirp_t));
-    new_slirp->mac = mac;
-    new_slirp->card = card;
+    slirp_t *slirp = malloc(sizeof(slirp_t));
+    memset(slirp, 0, sizeof(slirp_t));
+    slirp->mac = (void *) mac;
+    slirp->card = card;
+    slirp->card_num = card->card_num;
 #ifdef SLIRP_USE_POLL
-    new_slirp->pfd_size = 16 * sizeof(struct pollfd);
-    new_slirp->pfd = malloc(new_slirp->pfd_size);
-    memset(new_slirp->pfd, 0, new_slirp->pfd_size);
+    slirp->pfd_size = 16;
+    slirp->pfd = malloc(slirp->pfd_size * sizeof(struct pollfd));
+    memset(slirp->pfd, 0, slirp->pfd_size * sizeof(struct pollfd));
+#else
+    slirp->wake = thread_create_event();
+#endif
+#ifdef SLIRP_USE_EPOLL
+    slirp->notify_rd = slirp->notify_wr = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    slirp->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if ((slirp->notify_rd < 0) || (slirp->epfd < 0) ||
+	(net_slirp_epoll_ctl(slirp, EPOLL_CTL_ADD, slirp->notify_rd, EPOLLIN) < 0)) {
+	slirp_log("SLiRP: unable to set up epoll\n");
+	net_slirp_free(slirp);
+	return NULL;
+    }
+#elif !defined(_WIN32)
+    int fds[2];
+    if (pipe(fds) < 0) {
+	slirp_log("SLiRP: unable to create the notification pipe\n");
+	fds[0] = fds[1] = -1;
+    }
+    slirp->notify_rd = fds[0];
+    slirp->notify_wr = fds[1];
+    if (slirp->notify_rd < 0) {
+	net_slirp_free(slirp);
+	return NULL;
+    }
+    fcntl(slirp->notify_rd, F_SETFL, fcntl(slirp->notify_rd, F_GETFL) | O_NONBLOCK);
+    fcntl(slirp->notify_wr, F_SETFL, fcntl(slirp->notify_wr, F_GETFL) | O_NONBLOCK);
 #endif
-
-    /* Save the callback info. */
-    slirp = new_slirp;
 
     slirp_log("SLiRP: creating thread...\n");
     slirp->poll_state = thread_create_event();
-    slirp->poll_tid = thread_create(poll_thread, new_slirp);
+    slirp->poll_tid = thread_create(poll_thread, slirp);
     thread_wait_event(slirp->poll_state, -1);
+    thread_reset_event(slirp->poll_state);
 
-    return 0;
+    if (!slirp->slirp) {
+	thread_wait((thread_t *) slirp->poll_tid);
+	net_slirp_free(slirp);
+	return NULL;
+    }
+
+    return slirp;
 }
 
 
-void
-net_slirp_close(void)
+/* Wake the polling thread up, the guest has frames for us. */
+static void
+net_slirp_notify_in(void *priv)
 {
+    slirp_t *slirp = (slirp_t *) priv;
+#ifdef SLIRP_USE_EPOLL
+    uint64_t val = 1;
+
+    (void) !write(slirp->notify_wr, &val, sizeof(val));
+#elif !defined(_WIN32)
+    (void) !write(slirp->notify_wr, "", 1);
+#else
+    thread_set_event(slirp->wake);
+#endif
+}
+
+
+static void
+net_slirp_close(void *priv)
+{
+    slirp_t *slirp = (slirp_t *) priv;
+
     if (!slirp)
 	return;
 
     slirp_log("SLiRP: closing\n");
 
-    /* Tell the polling thread to shut down. */
+    /* Tell the polling thread to shut down, and wake it up. */
     slirp->stop = 1;
+    net_slirp_notify_in(slirp);
 
-    /* Tell the thread to terminate. */
     if (slirp->poll_tid) {
 	/* Wait for the thread to finish. */
 	slirp_log("SLiRP: waiting for thread to end...\n");
-	thread_wait_event(slirp->poll_state, -1);
+	thread_wait((thread_t *) slirp->poll_tid);
     }
 
-    /* Shutdown work is done by the thread on its local copy of slirp. */
-    slirp = NULL;
+    /* The thread is gone, so nothing can touch the state any more. */
+    slirp_cleanup(slirp->slirp);
+    net_slirp_free(slirp);
 }
 
 
 /* Send a packet to the SLiRP interface. */
-void
-net_slirp_in(uint8_t *pkt, int pkt_len)
+static void
+net_slirp_in(void *priv, uint8_t *pkt, int pkt_len)
 {
-    if (!slirp || !slirp->slirp)
+    slirp_t *slirp = (slirp_t *) priv;
+
+    if (!slirp->slirp)
 	return;
 
     slirp_log("SLiRP: sending %d-byte packet\n", pkt_len);
@@ -470,6 +702,14 @@ net_slirp_in(uint8_t *pkt, int pkt_len)
 }
 
 
+const netdrv_t net_slirp_drv = {
+    .init = net_slirp_init,
+    .in = net_slirp_in,
+    .close = net_slirp_close,
+    .notify_in = net_slirp_notify_in
+};
+
+
 /* Stubs to stand in for the parts of libslirp we skip compiling. */
 void ncsi_input(void *slirp, const uint8_t *pkt, int pkt_len) {}
 void ip6_init(void *slirp) {}
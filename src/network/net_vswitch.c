@@ -0,0 +1,655 @@
+/*
+ * 86Box	A hypervisor and IBM PC system emulator that specializes in
+ *		running old operating systems and software designed for IBM
+ *		PC systems and compatibles from 1981 through fairly recent
+ *		system designs based on the PCI bus.
+ *
+ *		This file is part of the 86Box distribution.
+ *
+ *		Virtual switch network provider.
+ *
+ *		Adapters that name the same switch, in this or in any other
+ *		86Box process of the same user, share one memory segment.
+ *		Each port of the switch owns a transmit ring there which only
+ *		it writes; every other port reads that ring in place from its
+ *		own read position, so no locks are taken anywhere and a frame
+ *		is written once for all of its receivers.  A forwarding table
+ *		in the segment learns source MACs, so unicast frames are only
+ *		picked up by the port behind the destination, and broadcasts
+ *		and unknown destinations are flooded.  A port that falls a
+ *		whole ring behind loses the oldest frames, like a switch with
+ *		a full output queue.  Idle ports sleep on a doorbell which is
+ *		rung by whoever queues a frame for them.
+ */
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <wchar.h>
+#ifdef _WIN32
+# define WIN32_LEAN_AND_MEAN
+# include <windows.h>
+#else
+# include <fcntl.h>
+# include <poll.h>
+# include <time.h>
+# include <unistd.h>
+# include <sys/mman.h>
+# include <sys/socket.h>
+# include <sys/stat.h>
+# include <sys/un.h>
+#endif
+#define HAVE_STDARG_H
+#include <86box/86box.h>
+#include <86box/device.h>
+#include <86box/plat.h>
+#include <86box/thread.h>
+#include <86box/network.h>
+
+
+#define VSW_VERSION	1
+#define VSW_PORTS	16		/* ports per switch */
+#define VSW_RING_LEN	256		/* frames per port ring, power of 2 */
+#define VSW_FRAME_MAX	1536		/* largest frame, 1518 rounded up */
+#define VSW_FDB_LEN	256		/* forwarding table entries, power of 2 */
+#define VSW_NAME_MAX	32
+#define VSW_STALE_MS	5000		/* a port not heard from is taken over */
+#define VSW_IDLE_MS	50		/* heartbeat and shutdown check */
+#define VSW_BUDGET	64		/* frames taken from one ring per round */
+
+#define VSW_FDB_MAC	0x0000ffffffffffffULL
+
+enum {
+    VSW_PORT_FREE = 0,
+    VSW_PORT_USED
+};
+
+
+/* Everything below lives in the shared segment; all zero is an empty switch. */
+typedef struct {
+    atomic_uint		seq;		/* 2 * (position + 1), odd while written */
+    int16_t		port;		/* destination port, -1 to flood */
+    uint16_t		len;
+    uint8_t		data[VSW_FRAME_MAX];
+} vsw_frame_t;
+
+typedef struct {
+    atomic_uint		state;
+    atomic_uint		sleeping;
+    atomic_ullong	heartbeat;	/* ms, refreshed by the owner */
+    atomic_uint		head;
+    uint32_t		pad;
+    vsw_frame_t		ring[VSW_RING_LEN];
+} vsw_port_t;
+
+typedef struct {
+    atomic_uint		version;
+    uint32_t		pad;
+    atomic_ullong	fdb[VSW_FDB_LEN];	/* MAC | (port + 1) << 48 */
+    vsw_port_t		port[VSW_PORTS];
+} vsw_shm_t;
+
+
+/* One adapter's connection to a switch. */
+typedef struct {
+    const netcard_t	*card;
+    thread_t		*poll_tid;
+    event_t		*poll_state;
+    volatile int	stop;
+    vsw_shm_t		*shm;
+    int			port;
+    uint32_t		rd[VSW_PORTS];
+    uint32_t		dropped;
+    char		name[VSW_NAME_MAX + 1];
+    uint8_t		buf[VSW_FRAME_MAX];
+#ifdef _WIN32
+    HANDLE		map;
+    HANDLE		bell[VSW_PORTS];
+#else
+    int			sock;
+    char		dir[256];
+    struct sockaddr_un	bell[VSW_PORTS];
+#endif
+} vswitch_t;
+
+
+#ifdef ENABLE_VSWITCH_LOG
+int vswitch_do_log = ENABLE_VSWITCH_LOG;
+
+
+static void
+vswitch_log(const char *fmt, ...)
+{
+    va_list ap;
+
+    if (vswitch_do_log) {
+	va_start(ap, fmt);
+	pclog_ex(fmt, ap);
+	va_end(ap);
+    }
+}
+#else
+#define vswitch_log(fmt, ...)
+#endif
+
+
+static uint64_t
+vswitch_now_ms(void)
+{
+#ifdef _WIN32
+    return GetTickCount64();
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000ULL) + (ts.tv_nsec / 1000000);
+#endif
+}
+
+
+static uint64_t
+vswitch_mac(const uint8_t *mac)
+{
+    return ((uint64_t) mac[0] << 40) | ((uint64_t) mac[1] << 32) | ((uint64_t) mac[2] << 24) |
+	   ((uint64_t) mac[3] << 16) | ((uint64_t) mac[4] << 8) | (uint64_t) mac[5];
+}
+
+
+static atomic_ullong *
+vswitch_fdb_entry(vswitch_t *sw, uint64_t mac)
+{
+    return &sw->shm->fdb[((mac * 0x9e3779b97f4a7c15ULL) >> 56) & (VSW_FDB_LEN - 1)];
+}
+
+
+/* Remember which port a source MAC lives behind. */
+static void
+vswitch_learn(vswitch_t *sw, const uint8_t *src)
+{
+    uint64_t mac = vswitch_mac(src);
+    uint64_t entry = mac | ((uint64_t) (sw->port + 1) << 48);
+    atomic_ullong *fdb;
+
+    if (src[0] & 0x01)
+	return;
+
+    fdb = vswitch_fdb_entry(sw, mac);
+    if (atomic_load_explicit(fdb, memory_order_relaxed) != entry)
+	atomic_store_explicit(fdb, entry, memory_order_relaxed);
+}
+
+
+/* Returns the port behind a destination MAC, or -1 to flood. */
+static int
+vswitch_lookup(vswitch_t *sw, const uint8_t *dst)
+{
+    uint64_t mac = vswitch_mac(dst);
+    uint64_t entry;
+    int port;
+
+    if (dst[0] & 0x01)
+	return -1;
+
+    entry = atomic_load_explicit(vswitch_fdb_entry(sw, mac), memory_order_relaxed);
+    if ((entry & VSW_FDB_MAC) != mac)
+	return -1;
+
+    port = (int) (entry >> 48) - 1;
+    if ((port < 0) || (port >= VSW_PORTS) ||
+	(atomic_load_explicit(&sw->shm->port[port].state, memory_order_relaxed) != VSW_PORT_USED))
+	return -1;
+
+    return port;
+}
+
+
+/* Forget everything learned for our port, it may belong to someone else now. */
+static void
+vswitch_forget(vswitch_t *sw)
+{
+    uint64_t entry;
+    int i;
+
+    for (i = 0; i < VSW_FDB_LEN; i++) {
+	entry = atomic_load_explicit(&sw->shm->fdb[i], memory_order_relaxed);
+	if ((int) (entry >> 48) == (sw->port + 1))
+		atomic_compare_exchange_strong(&sw->shm->fdb[i], &entry, 0);
+    }
+}
+
+
+static void
+vswitch_ring(vswitch_t *sw, int port)
+{
+    vsw_port_t *p = &sw->shm->port[port];
+
+    if (!atomic_exchange(&p->sleeping, 0))
+	return;
+
+#ifdef _WIN32
+    SetEvent(sw->bell[port]);
+#else
+    (void) sendto(sw->sock, "", 1, MSG_DONTWAIT, (struct sockaddr *) &sw->bell[port], sizeof(struct sockaddr_un));
+#endif
+}
+
+
+/* Wait for a doorbell, from another port or from our own adapter. */
+static void
+vswitch_sleep(vswitch_t *sw)
+{
+#ifdef _WIN32
+    WaitForSingleObject(sw->bell[sw->port], VSW_IDLE_MS);
+#else
+    struct pollfd pfd = { .fd = sw->sock, .events = POLLIN };
+    char junk[16];
+
+    if (poll(&pfd, 1, VSW_IDLE_MS) > 0) {
+	while (recv(sw->sock, junk, sizeof(junk), MSG_DONTWAIT) > 0)
+		;
+    }
+#endif
+    atomic_store(&sw->shm->port[sw->port].sleeping, 0);
+}
+
+
+/* Take the frames meant for us from everyone else's ring. */
+static int
+vswitch_receive(vswitch_t *sw)
+{
+    const netcard_t *card = sw->card;
+    vsw_port_t *p;
+    vsw_frame_t *f;
+    uint32_t head, seq;
+    int i, n, port, len, ret = 0;
+
+    for (i = 0; i < VSW_PORTS; i++) {
+	p = &sw->shm->port[i];
+	if ((i == sw->port) || (atomic_load_explicit(&p->state, memory_order_relaxed) != VSW_PORT_USED))
+		continue;
+
+	head = atomic_load_explicit(&p->head, memory_order_acquire);
+	if ((head - sw->rd[i]) > VSW_RING_LEN) {
+		/* Lapped, the oldest frames are gone. */
+		sw->dropped += (head - sw->rd[i]) - VSW_RING_LEN;
+		sw->rd[i] = head - VSW_RING_LEN;
+	}
+
+	for (n = 0; (n < VSW_BUDGET) && (sw->rd[i] != head); n++, sw->rd[i]++) {
+		f = &p->ring[sw->rd[i] & (VSW_RING_LEN - 1)];
+		seq = atomic_load_explicit(&f->seq, memory_order_acquire);
+		if (seq != ((sw->rd[i] + 1) << 1)) {
+			sw->dropped++;
+			continue;
+		}
+
+		port = f->port;
+		len = f->len;
+		if (((port != -1) && (port != sw->port)) || (len <= 0) || (len > VSW_FRAME_MAX))
+			continue;
+
+		memcpy(sw->buf, f->data, len);
+		/* The writer may have lapped us while we copied. */
+		atomic_thread_fence(memory_order_acquire);
+		if (atomic_load_explicit(&f->seq, memory_order_relaxed) != seq) {
+			sw->dropped++;
+			continue;
+		}
+
+		network_queue_put(card, NET_QUEUE_RX, sw->buf, len);
+		ret++;
+	}
+    }
+
+    return ret;
+}
+
+
+/* Handle the receiving of frames from the switch. */
+static void
+poll_thread(void *arg)
+{
+    vswitch_t *sw = (vswitch_t *) arg;
+    const netcard_t *card = sw->card;
+    vsw_port_t *self = &sw->shm->port[sw->port];
+    uint64_t now, beat = 0;
+    int rx, tx, i;
+
+    vswitch_log("VSWITCH: polling started.\n");
+    thread_set_event(sw->poll_state);
+
+    while (!sw->stop) {
+	now = vswitch_now_ms();
+	if ((now - beat) >= (VSW_STALE_MS / 4)) {
+		atomic_store_explicit(&self->heartbeat, now, memory_order_relaxed);
+		beat = now;
+	}
+
+	if ((card->set_link_state && card->set_link_state(card->priv)) || (card->wait && card->wait(card->priv))) {
+		/* The card is not taking frames, skip what was sent meanwhile. */
+		for (i = 0; i < VSW_PORTS; i++)
+			sw->rd[i] = atomic_load_explicit(&sw->shm->port[i].head, memory_order_acquire);
+		rx = 0;
+	} else
+		rx = vswitch_receive(sw);
+
+	/* Wait for the next packet to arrive - network_do_tx() is called from there. */
+	tx = network_tx_queue_check(card);
+
+	if (!rx && !tx) {
+		/* Announce the nap, then look once more so no doorbell is missed. */
+		atomic_store(&self->sleeping, 1);
+		atomic_thread_fence(memory_order_seq_cst);
+		if (vswitch_receive(sw) || network_tx_queue_check(card))
+			atomic_store(&self->sleeping, 0);
+		else
+			vswitch_sleep(sw);
+	}
+    }
+
+    vswitch_log("VSWITCH: polling stopped.\n");
+    thread_set_event(sw->poll_state);
+}
+
+
+/* Map the switch segment, creating it if we are the first to use the name. */
+static int
+vswitch_map(vswitch_t *sw)
+{
+    char path[512];
+    int i;
+
+#ifdef _WIN32
+    snprintf(path, sizeof(path), "Local\\86Box-vswitch-%s", sw->name);
+    sw->map = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+				 0, sizeof(vsw_shm_t), path);
+    if (sw->map == NULL)
+	return 0;
+    sw->shm = (vsw_shm_t *) MapViewOfFile(sw->map, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(vsw_shm_t));
+    if (sw->shm == NULL) {
+	CloseHandle(sw->map);
+	sw->map = NULL;
+	return 0;
+    }
+
+    for (i = 0; i < VSW_PORTS; i++) {
+	snprintf(path, sizeof(path), "Local\\86Box-vswitch-%s-%i", sw->name, i);
+	sw->bell[i] = CreateEventA(NULL, FALSE, FALSE, path);
+    }
+#else
+    const char *dir = getenv("TMPDIR");
+    struct stat st;
+    void *p;
+    int fd;
+
+    /* Prefer a memory-backed directory when the host has one. */
+    if (!stat("/dev/shm", &st) && S_ISDIR(st.st_mode))
+	dir = "/dev/shm";
+    else if ((dir == NULL) || (dir[0] == '\0'))
+	dir = "/tmp";
+    strncpy(sw->dir, dir, sizeof(sw->dir) - 1);
+
+    snprintf(path, sizeof(path), "%s/86box-vswitch-%s", sw->dir, sw->name);
+    fd = open(path, O_RDWR | O_CREAT, 0600);
+    if (fd < 0)
+	return 0;
+    /* A new file reads as zeroes, which is an empty switch. */
+    if (ftruncate(fd, sizeof(vsw_shm_t)) != 0) {
+	close(fd);
+	return 0;
+    }
+    p = mmap(NULL, sizeof(vsw_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+	return 0;
+    sw->shm = (vsw_shm_t *) p;
+
+    for (i = 0; i < VSW_PORTS; i++) {
+	sw->bell[i].sun_family = AF_UNIX;
+	snprintf(sw->bell[i].sun_path, sizeof(sw->bell[i].sun_path), "%s/86box-vswitch-%s.%i",
+		 sw->dir, sw->name, i);
+    }
+    sw->sock = -1;
+#endif
+
+    return 1;
+}
+
+
+static void
+vswitch_unmap(vswitch_t *sw)
+{
+#ifdef _WIN32
+    int i;
+
+    for (i = 0; i < VSW_PORTS; i++) {
+	if (sw->bell[i] != NULL)
+		CloseHandle(sw->bell[i]);
+    }
+    if (sw->shm != NULL)
+	UnmapViewOfFile(sw->shm);
+    if (sw->map != NULL)
+	CloseHandle(sw->map);
+#else
+    if (sw->sock >= 0) {
+	close(sw->sock);
+	unlink(sw->bell[sw->port].sun_path);
+    }
+    if (sw->shm != NULL)
+	munmap(sw->shm, sizeof(vsw_shm_t));
+#endif
+    sw->shm = NULL;
+}
+
+
+/* Claim a free port, or one whose owner has gone away without leaving. */
+static int
+vswitch_join(vswitch_t *sw)
+{
+    vsw_port_t *p;
+    uint64_t now = vswitch_now_ms(), beat;
+    unsigned int state;
+    int i;
+
+    for (i = 0; i < VSW_PORTS; i++) {
+	p = &sw->shm->port[i];
+	/* Look alive before the port shows as used, or another joiner could
+	   see it used with an old heartbeat and take it over as well. */
+	if (atomic_load(&p->state) == VSW_PORT_FREE) {
+		atomic_store(&p->heartbeat, now);
+		state = VSW_PORT_FREE;
+		if (atomic_compare_exchange_strong(&p->state, &state, VSW_PORT_USED))
+			break;
+	}
+
+	beat = atomic_load(&p->heartbeat);
+	if (((now - beat) > VSW_STALE_MS) && atomic_compare_exchange_strong(&p->heartbeat, &beat, now)) {
+		vswitch_log("VSWITCH: taking over stale port %i\n", i);
+		break;
+	}
+    }
+    if (i == VSW_PORTS)
+	return 0;
+
+    sw->port = i;
+    atomic_store(&p->heartbeat, now);
+    atomic_store(&p->sleeping, 0);
+    vswitch_forget(sw);
+
+    /* Start with what is sent from now on. */
+    for (i = 0; i < VSW_PORTS; i++)
+	sw->rd[i] = atomic_load(&sw->shm->port[i].head);
+
+#ifndef _WIN32
+    sw->sock = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (sw->sock >= 0) {
+	unlink(sw->bell[sw->port].sun_path);
+	if (bind(sw->sock, (struct sockaddr *) &sw->bell[sw->port], sizeof(struct sockaddr_un)) != 0)
+		vswitch_log("VSWITCH: no doorbell, polling only\n");
+	(void) fcntl(sw->sock, F_SETFL, O_NONBLOCK);
+    }
+#endif
+
+    return 1;
+}
+
+
+static void
+vswitch_leave(vswitch_t *sw)
+{
+    vswitch_forget(sw);
+    atomic_store(&sw->shm->port[sw->port].state, VSW_PORT_FREE);
+}
+
+
+/* Close up shop. */
+static void
+net_vswitch_close(void *priv)
+{
+    vswitch_t *sw = (vswitch_t *) priv;
+
+    if (sw == NULL) return;
+
+    vswitch_log("VSWITCH: closing.\n");
+
+    /* Tell the polling thread to shut down. */
+    sw->stop = 1;
+    atomic_thread_fence(memory_order_seq_cst);
+    vswitch_ring(sw, sw->port);
+
+    if (sw->poll_tid != NULL) {
+	/* Wait for the thread to finish. */
+	thread_wait_event(sw->poll_state, -1);
+    }
+    if (sw->poll_state != NULL)
+	thread_destroy_event(sw->poll_state);
+
+    if (sw->dropped)
+	vswitch_log("VSWITCH: %u frames lost on port %i\n", sw->dropped, sw->port);
+
+    vswitch_leave(sw);
+    vswitch_unmap(sw);
+    free(sw);
+}
+
+
+/*
+ * Connect an adapter to a virtual switch.
+ *
+ * The host device name of the adapter is used as the switch name;
+ * adapters without one end up on the switch named "default".
+ */
+static void *
+net_vswitch_init(const netcard_t *card, const uint8_t *mac, void *priv)
+{
+    const char *name = (const char *) priv;
+    unsigned int version = 0;
+    vswitch_t *sw;
+    int i;
+
+    sw = (vswitch_t *) calloc(1, sizeof(vswitch_t));
+    if (sw == NULL)
+	return(NULL);
+    sw->card = card;
+
+    if ((name == NULL) || (name[0] == '\0') || !strcmp(name, "none"))
+	name = "default";
+    /* Keep the name usable as a file and socket name. */
+    for (i = 0; (i < VSW_NAME_MAX) && (name[i] != '\0'); i++) {
+	if (((name[i] >= 'a') && (name[i] <= 'z')) || ((name[i] >= 'A') && (name[i] <= 'Z')) ||
+	    ((name[i] >= '0') && (name[i] <= '9')) || (name[i] == '-'))
+		sw->name[i] = name[i];
+	else
+		sw->name[i] = '_';
+    }
+
+    if (!vswitch_map(sw)) {
+	vswitch_log("VSWITCH: unable to map switch '%s'\n", sw->name);
+	free(sw);
+	return(NULL);
+    }
+
+    if (!atomic_compare_exchange_strong(&sw->shm->version, &version, VSW_VERSION) &&
+	(version != VSW_VERSION)) {
+	vswitch_log("VSWITCH: switch '%s' has version %u, expected %u\n", sw->name, version, VSW_VERSION);
+	vswitch_unmap(sw);
+	free(sw);
+	return(NULL);
+    }
+
+    if (!vswitch_join(sw)) {
+	vswitch_log("VSWITCH: switch '%s' is full\n", sw->name);
+	vswitch_unmap(sw);
+	free(sw);
+	return(NULL);
+    }
+
+    vswitch_log("VSWITCH: adapter %i on switch '%s' port %i\n", card->card_num + 1, sw->name, sw->port);
+
+    sw->poll_state = thread_create_event();
+    sw->poll_tid = thread_create(poll_thread, sw);
+    thread_wait_event(sw->poll_state, -1);
+    thread_reset_event(sw->poll_state);
+
+    return(sw);
+}
+
+
+/* Send a frame out of our port. */
+static void
+net_vswitch_in(void *priv, uint8_t *bufp, int len)
+{
+    vswitch_t *sw = (vswitch_t *) priv;
+    vsw_port_t *self = &sw->shm->port[sw->port];
+    vsw_frame_t *f;
+    uint32_t head;
+    int i, port;
+
+    if ((len < 14) || (len > VSW_FRAME_MAX))
+	return;
+
+    vswitch_learn(sw, bufp + 6);
+    port = vswitch_lookup(sw, bufp);
+    if (port == sw->port)
+	return;
+
+    head = atomic_load_explicit(&self->head, memory_order_relaxed);
+    f = &self->ring[head & (VSW_RING_LEN - 1)];
+
+    /* Readers check the sequence before and after copying. */
+    atomic_store_explicit(&f->seq, ((head + 1) << 1) - 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    memcpy(f->data, bufp, len);
+    f->port = port;
+    f->len = len;
+    atomic_store_explicit(&f->seq, (head + 1) << 1, memory_order_release);
+    atomic_store_explicit(&self->head, head + 1, memory_order_release);
+
+    if (port >= 0)
+	vswitch_ring(sw, port);
+    else for (i = 0; i < VSW_PORTS; i++) {
+	if ((i != sw->port) && (atomic_load_explicit(&sw->shm->port[i].state, memory_order_relaxed) == VSW_PORT_USED))
+		vswitch_ring(sw, i);
+    }
+}
+
+
+/* The adapter has frames for us, wake our own thread if it sleeps. */
+static void
+net_vswitch_notify_in(void *priv)
+{
+    vswitch_t *sw = (vswitch_t *) priv;
+
+    atomic_thread_fence(memory_order_seq_cst);
+    vswitch_ring(sw, sw->port);
+}
+
+
+const netdrv_t net_vswitch_drv = {
+    .init = net_vswitch_init,
+    .in = net_vswitch_in,
+    .close = net_vswitch_close,
+    .notify_in = net_vswitch_notify_in
+};
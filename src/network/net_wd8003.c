@@ -632,7 +632,9 @@ wd_init(const device_t *info)
 	dev->ram_addr = device_get_config_hex20("ram_addr");
     }
 
-    dev->dp8390 = device_add(&dp8390_device);
+    dev->dp8390 = device_add_inst(&dp8390_device, network_card_inst());
+    if (dev->dp8390 == NULL)
+	fatal("%s: unable to add the DP8390 core\n", dev->name);
     dev->dp8390->priv = dev;
     dev->dp8390->interrupt = wd_interrupt;
     dp8390_set_defaults(dev->dp8390, DP8390_FLAG_CHECK_CR | DP8390_FLAG_CLEAR_IRQ);
@@ -714,7 +716,7 @@ wd_init(const device_t *info)
     mem_mapping_disable(&dev->ram_mapping);
 
     /* Attach ourselves to the network module. */
-    network_attach(dev->dp8390, dev->dp8390->physaddr, dp8390_rx, NULL, NULL);
+    dev->dp8390->card = network_attach(dev->dp8390, dev->dp8390->physaddr, dp8390_rx, NULL, NULL);
 
     if (!(dev->board_chip & WE_ID_BUS_MCA)) {
 	wdlog("%s: attached IO=0x%X IRQ=%d, RAM addr=0x%06x\n", dev->name,
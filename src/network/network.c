@@ -8,9 +8,10 @@
  *
  *		Implementation of the network module.
  *
- * NOTE		The definition of the netcard_t is currently not optimal;
- *		it should be malloc'ed and then linked to the NETCARD def.
- *		Will be done later.
+ *		Up to NET_CARD_MAX adapters can be configured; each one is
+ *		a separate device instance with its own provider, packet
+ *		queues and receive timer, so adapters never wait on each
+ *		other.
  *
  *
  *
@@ -86,57 +87,73 @@ static const device_t net_none_device = {
 };
 
 
-static netcard_t net_cards[] = {
+static const device_t *net_cards[] = {
 // clang-format off
-    { &net_none_device,           NULL },
-    { &threec503_device,          NULL },
-    { &pcnet_am79c960_device,     NULL },
-    { &pcnet_am79c961_device,     NULL },
-    { &ne1000_device,             NULL },
-    { &ne2000_device,             NULL },
-    { &pcnet_am79c960_eb_device,  NULL },
-    { &rtl8019as_device,          NULL },
-    { &wd8003e_device,            NULL },
-    { &wd8003eb_device,           NULL },
-    { &wd8013ebt_device,          NULL },
-    { &plip_device,               NULL },
-    { &ethernext_mc_device,       NULL },
-    { &wd8003eta_device,          NULL },
-    { &wd8003ea_device,           NULL },
-    { &pcnet_am79c973_device,     NULL },
-    { &pcnet_am79c970a_device,    NULL },
-    { &rtl8029as_device,          NULL },
-    { &pcnet_am79c960_vlb_device, NULL },
-    { NULL,                       NULL }
+    &net_none_device,
+    &threec503_device,
+    &pcnet_am79c960_device,
+    &pcnet_am79c961_device,
+    &ne1000_device,
+    &ne2000_device,
+    &pcnet_am79c960_eb_device,
+    &rtl8019as_device,
+    &wd8003e_device,
+    &wd8003eb_device,
+    &wd8013ebt_device,
+    &plip_device,
+    &ethernext_mc_device,
+    &wd8003eta_device,
+    &wd8003ea_device,
+    &pcnet_am79c973_device,
+    &pcnet_am79c970a_device,
+    &rtl8029as_device,
+    &pcnet_am79c960_vlb_device,
+    NULL
 // clang-format off
 };
 
 
+/* Single producer, single consumer ring of preallocated packets. */
+typedef struct {
+    netpkt_t		*pkts;
+    atomic_uint		head, tail;
+    uint32_t		dropped;
+} netqueue_t;
+
+/* Transmitted frames that did not fit in the ring, oldest first. */
+typedef struct nettx_spill_t {
+    struct nettx_spill_t *next;
+    int			len;
+    uint8_t		data[];
+} nettx_spill_t;
+
+/* Per-adapter state; the card and providers only see the netcard_t. */
+typedef struct {
+    netcard_t		card;		/* must be first */
+    netqueue_t		queues[NET_QUEUE_COUNT];
+    nettx_spill_t	*tx_spill, *tx_spill_last;
+    pc_timer_t		timer;
+    double		byte_time,
+			rx_delay,
+			rx_credit;
+} netcard_state_t;
+
+
 /* Global variables. */
-int		network_type;
 int		network_ndev;
-int		network_card;
-char		network_host[522];
 netdev_t	network_devs[32];
-int		network_rx_pause = 0,
-		network_tx_pause = 0;
+netcard_conf_t	net_cards_conf[NET_CARD_MAX];
+int		network_tx_pause = 0;
 
 
 /* Local variables. */
 static volatile atomic_int	net_wait = 0;
-static mutex_t		*network_mutex;
-static uint8_t		*network_mac;
-static uint8_t		network_timer_active = 0;
-static pc_timer_t	network_rx_queue_timer;
-static netpkt_t		*first_pkt[3] = { NULL, NULL, NULL },
-			*last_pkt[3] = { NULL, NULL, NULL };
-static netpkt_t		queued_pkt;
+static netcard_state_t	*net_card_states[NET_CARD_MAX];
+static int		net_card_current = 0;
 
 
 #ifdef ENABLE_NETWORK_LOG
 int network_do_log = ENABLE_NETWORK_LOG;
-static FILE *network_dump = NULL;
-static mutex_t *network_dump_mutex;
 
 
 static void
@@ -150,56 +167,11 @@ network_log(const char *fmt, ...)
 	va_end(ap);
     }
 }
-
-
-static void
-network_dump_packet(netpkt_t *pkt)
-{
-    if (!network_dump)
-	return;
-
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    struct {
-	uint32_t ts_sec, ts_usec, incl_len, orig_len;
-    } pcap_packet_hdr = {
-	tv.tv_sec, tv.tv_usec, pkt->len, pkt->len
-    };
-
-    if (network_dump_mutex)
-	thread_wait_mutex(network_dump_mutex);
-
-    size_t written;
-    if ((written = fwrite(&pcap_packet_hdr, 1, sizeof(pcap_packet_hdr), network_dump)) < sizeof(pcap_packet_hdr)) {
-	network_log("NETWORK: failed to write dump packet header\n");
-	fseek(network_dump, -written, SEEK_CUR);
-    } else {
-	if ((written = fwrite(pkt->data, 1, pkt->len, network_dump)) < pkt->len) {
-		network_log("NETWORK: failed to write dump packet data\n");
-		fseek(network_dump, -written - sizeof(pcap_packet_hdr), SEEK_CUR);
-	}
-	fflush(network_dump);
-    }
-
-    if (network_dump_mutex)
-	thread_release_mutex(network_dump_mutex);
-}
 #else
 #define network_log(fmt, ...)
-#define network_dump_packet(pkt)
 #endif
 
 
-void
-network_wait(uint8_t wait)
-{
-    if (wait)
-	thread_wait_mutex(network_mutex);
-      else
-	thread_release_mutex(network_mutex);
-}
-
-
 /*
  * Initialize the configured network cards.
  *
@@ -213,8 +185,7 @@ network_init(void)
     int i;
 
     /* Initialize to a known state. */
-    network_type = NET_TYPE_NONE;
-    network_card = 0;
+    memset(net_cards_conf, 0x00, sizeof(net_cards_conf));
 
     /* Create a first device entry that's always there, as needed by UI. */
     strcpy(network_devs[0].device, "none");
@@ -225,177 +196,224 @@ network_init(void)
     i = net_pcap_prepare(&network_devs[network_ndev]);
     if (i > 0)
 	network_ndev += i;
-
-#ifdef ENABLE_NETWORK_LOG
-    /* Start packet dump. */
-    network_dump = fopen("network.pcap", "wb");
-
-    struct {
-	uint32_t magic_number;
-	uint16_t version_major, version_minor;
-	int32_t	 thiszone;
-	uint32_t sigfigs, snaplen, network;
-    } pcap_hdr = {
-	0xa1b2c3d4,
-	2, 4,
-	0,
-	0, 65535, 1
-    };
-    fwrite(&pcap_hdr, sizeof(pcap_hdr), 1, network_dump);
-    fflush(network_dump);
-#endif
 }
 
 
-void
-network_queue_put(int tx, void *priv, uint8_t *data, int len)
+/*
+ * The packet queues are fixed rings of preallocated slots with a single
+ * producer and a single consumer each: the provider's poll thread feeds
+ * the receive queue and the emulation thread drains it from the timer,
+ * while the card fills the transmit queue and the poll thread drains it.
+ * Packets are written once into their slot and read from it in place.
+ */
+static int
+network_queue_init(netqueue_t *queue)
 {
-    netpkt_t *temp;
+    queue->pkts = (netpkt_t *) calloc(NET_QUEUE_LEN, sizeof(netpkt_t));
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+    queue->dropped = 0;
 
-    temp = (netpkt_t *) calloc(sizeof(netpkt_t), 1);
-    temp->priv = priv;
-    memcpy(temp->data, data, len);
-    temp->len = len;
-    temp->prev = last_pkt[tx];
-    temp->next = NULL;
-
-    if (last_pkt[tx] != NULL)
-	last_pkt[tx]->next = temp;
-    last_pkt[tx] = temp;
-
-    if (first_pkt[tx] == NULL)
-	first_pkt[tx] = temp;
+    return (queue->pkts != NULL);
 }
 
 
 static void
-network_queue_get(int tx, netpkt_t *pkt)
+network_queue_close(netqueue_t *queue)
 {
-    netpkt_t *temp;
+    if (queue->dropped)
+	network_log("NETWORK: %u packets dropped on a full queue\n", queue->dropped);
 
-    temp = first_pkt[tx];
+    free(queue->pkts);
+    queue->pkts = NULL;
+}
 
-    if (temp == NULL) {
-	memset(pkt, 0x00, sizeof(netpkt_t));
-	return;
-    }
 
-    memcpy(pkt, temp, sizeof(netpkt_t));
+/* Returns 0 if the ring is full. */
+static int
+network_queue_try_put(netqueue_t *queue, uint8_t *data, int len)
+{
+    unsigned int head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    netpkt_t *pkt;
+
+    if ((head - atomic_load_explicit(&queue->tail, memory_order_acquire)) >= NET_QUEUE_LEN)
+	return 0;
+
+    pkt = &queue->pkts[head & (NET_QUEUE_LEN - 1)];
+    memcpy(pkt->data, data, len);
+    pkt->len = len;
 
-    first_pkt[tx] = temp->next;
-    free(temp);
+    atomic_store_explicit(&queue->head, head + 1, memory_order_release);
 
-    if (first_pkt[tx] == NULL)
-	last_pkt[tx] = NULL;
+    return 1;
 }
 
 
-static void
-network_queue_transmit(int tx)
+void
+network_queue_put(const netcard_t *card, int queue_num, uint8_t *data, int len)
 {
-    netpkt_t *temp;
-
-    temp = first_pkt[tx];
+    netqueue_t *queue = &((netcard_state_t *) card)->queues[queue_num];
 
-    if (temp == NULL)
+    if ((queue->pkts == NULL) || (len <= 0) || (len > NET_MAX_FRAME))
 	return;
 
-    if (temp->len > 0) {
-	network_dump_packet(temp);
-	/* Why on earth is this not a function pointer?! */
-	switch(network_type) {
-		case NET_TYPE_PCAP:
-			net_pcap_in(temp->data, temp->len);
-			break;
+    /* The consumer is behind, drop the packet like a full FIFO would. */
+    if (!network_queue_try_put(queue, data, len))
+	queue->dropped++;
+}
 
-		case NET_TYPE_SLIRP:
-			net_slirp_in(temp->data, temp->len);
-			break;
-	}
-    }
 
-    first_pkt[tx] = temp->next;
-    free(temp);
+/*
+ * The card considers a frame sent as soon as network_tx() returns, so
+ * it never holds back for the provider. Frames that find the transmit
+ * ring full wait here instead of being dropped, and move into the ring
+ * from the timer as the provider frees slots. Returns 1 if the provider
+ * has new frames.
+ */
+static int
+network_tx_spill_flush(netcard_state_t *state)
+{
+    netqueue_t *queue = &state->queues[NET_QUEUE_TX];
+    nettx_spill_t *spill;
+    int moved = 0;
+
+    while ((spill = state->tx_spill) != NULL) {
+	if (!network_queue_try_put(queue, spill->data, spill->len))
+		break;
 
-    if (first_pkt[tx] == NULL)
-	last_pkt[tx] = NULL;
+	state->tx_spill = spill->next;
+	if (state->tx_spill == NULL)
+		state->tx_spill_last = NULL;
+	free(spill);
+	moved = 1;
+    }
+
+    return moved;
 }
 
 
 static void
-network_queue_copy(int dest, int src)
+network_tx_spill_free(netcard_state_t *state)
 {
-    netpkt_t *temp, *temp2;
+    nettx_spill_t *spill;
 
-    temp = first_pkt[src];
+    while ((spill = state->tx_spill) != NULL) {
+	state->tx_spill = spill->next;
+	free(spill);
+    }
+    state->tx_spill_last = NULL;
+}
 
-    if (temp == NULL)
-	return;
 
-    temp2 = (netpkt_t *) calloc(sizeof(netpkt_t), 1);
-    temp2->priv = temp->priv;
-    memcpy(temp2->data, temp->data, temp->len);
-    temp2->len = temp->len;
-    temp2->prev = last_pkt[dest];
-    temp2->next = NULL;
+/* Returns the oldest packet up to limit without removing it, or NULL. */
+static netpkt_t *
+network_queue_peek(netqueue_t *queue, unsigned int limit)
+{
+    unsigned int tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
 
-    if (last_pkt[dest] != NULL)
-	last_pkt[dest]->next = temp2;
-    last_pkt[dest] = temp2;
+    if ((queue->pkts == NULL) || (tail == limit))
+	return NULL;
 
-    if (first_pkt[dest] == NULL)
-	first_pkt[dest] = temp2;
+    return &queue->pkts[tail & (NET_QUEUE_LEN - 1)];
+}
 
-    first_pkt[src] = temp->next;
-    free(temp);
 
-    if (first_pkt[src] == NULL)
-	last_pkt[src] = NULL;
+static void
+network_queue_advance(netqueue_t *queue)
+{
+    atomic_fetch_add_explicit(&queue->tail, 1, memory_order_release);
 }
 
 
-static void
-network_queue_clear(int tx)
+/* Time a frame occupies the link in us, counting preamble, FCS and the
+   inter-frame gap, or 0 when the link rate is unlimited. */
+static double
+network_wire_time(netcard_state_t *state, int len)
 {
-    netpkt_t *temp = first_pkt[tx], *temp2;
+    if (state->byte_time == 0.0)
+	return 0.0;
 
-    if (temp == NULL)
-	return;
+    return ((double) (MAX(len, 60) + 24)) * state->byte_time;
+}
 
-    do {
-	temp2 = temp->next;
-	free(temp);
-	temp = temp2;
-    } while (temp != NULL);
 
-    first_pkt[tx] = last_pkt[tx] = NULL;
+static void
+network_update_rate(netcard_state_t *state)
+{
+    int link_rate = net_cards_conf[state->card.card_num].link_rate;
+    uint32_t kbps;
+
+    if (link_rate < 0)
+	kbps = 0;
+    else if (link_rate > 0)
+	kbps = link_rate * 1000;
+    else
+	kbps = state->card.link_speed;
+
+    state->byte_time = kbps ? (8000.0 / (double) kbps) : 0.0;
 }
 
 
 static void
 network_rx_queue(void *priv)
 {
-    int ret = 1;
+    netcard_state_t *state = (netcard_state_t *) priv;
+    netcard_t *card = &state->card;
+    netqueue_t *queue = &state->queues[NET_QUEUE_RX];
+    netpkt_t *pkt = NULL;
+    double cost = 0.0, delay;
+    int n, refused = 0;
+
+    /* Link time that has passed since the last tick. */
+    state->rx_credit += state->rx_delay;
+
+    if (card->rx_pause) {
+	state->rx_credit = 0.0;
+	delay = NET_RX_IDLE_US;
+    } else {
+	/* Deliver as many frames as the link rate allows and the card takes. */
+	for (n = 0; n < NET_BATCH; n++) {
+		pkt = network_queue_peek(queue, atomic_load_explicit(&queue->head, memory_order_acquire));
+		if (pkt == NULL)
+			break;
 
-    if (network_rx_pause || !thread_test_mutex(network_mutex)) {
-	timer_on_auto(&network_rx_queue_timer, 0.762939453125 * 2.0 * 128.0);
-	return;
-    }
+		cost = network_wire_time(state, pkt->len);
+		if (cost > state->rx_credit)
+			break;
+
+		/* A packet the card could not take yet is offered again later. */
+		if (!card->rx(card->priv, pkt->data, pkt->len)) {
+			refused = 1;
+			break;
+		}
+		if (net_capture_on)
+			net_capture_frame(card, NET_CAPTURE_RX, pkt->data, pkt->len);
 
-    if (queued_pkt.len == 0)
-	network_queue_get(0, &queued_pkt);
-    if (queued_pkt.len > 0) {
-	network_dump_packet(&queued_pkt);
-	ret = net_cards[network_card].rx(queued_pkt.priv, queued_pkt.data, queued_pkt.len);
+		state->rx_credit -= cost;
+		network_queue_advance(queue);
+	}
+
+	if (pkt == NULL) {
+		/* Idle, do not bank link time for a later burst. */
+		state->rx_credit = 0.0;
+		delay = NET_RX_IDLE_US;
+	} else if (refused) {
+		state->rx_credit = 0.0;
+		delay = MAX(cost, NET_RX_IDLE_US);
+	} else
+		delay = cost - state->rx_credit;
     }
-    timer_on_auto(&network_rx_queue_timer, 0.762939453125 * 2.0 * ((queued_pkt.len >= 128) ? ((double) queued_pkt.len) : 128.0));
-    if (ret)
-	queued_pkt.len = 0;
 
-    /* Transmission. */
-    network_queue_copy(1, 2);
+    /* Transmission: move frames that found the ring full along. */
+    if (state->tx_spill != NULL) {
+	if (network_tx_spill_flush(state) && card->drv && card->drv->notify_in)
+		card->drv->notify_in(card->drv_priv);
+	if (state->tx_spill != NULL)
+		delay = MIN(delay, NET_RX_MIN_US);
+    }
 
-    network_wait(0);
+    state->rx_delay = MAX(delay, NET_RX_MIN_US);
+    timer_on_auto(&state->timer, state->rx_delay);
 }
 
 
@@ -404,83 +422,144 @@ network_rx_queue(void *priv)
  *
  * This function is called by a hardware driver ("card") after it has
  * finished initializing itself, to link itself to the platform support
- * modules.
+ * modules. The adapter slot is the one network_reset() is adding the
+ * card for; the returned handle is passed back to network_tx().
  */
-void
+netcard_t *
 network_attach(void *dev, uint8_t *mac, NETRXCB rx, NETWAITCB wait, NETSETLINKSTATE set_link_state)
 {
-    if (network_card == 0) return;
+    netcard_conf_t *conf = &net_cards_conf[net_card_current];
+    netcard_state_t *state;
+    netcard_t *card;
+    int i;
+
+    state = (netcard_state_t *) calloc(1, sizeof(netcard_state_t));
+    if (state == NULL)
+	fatal("NETWORK: Unable to allocate adapter %i\n", net_card_current + 1);
+    card = &state->card;
 
     /* Save the card's info. */
-    net_cards[network_card].priv = dev;
-    net_cards[network_card].rx = rx;
-    net_cards[network_card].wait = wait;
-    net_cards[network_card].set_link_state = set_link_state;
-    network_mac = mac;
+    card->device = net_cards[conf->device_num];
+    card->priv = dev;
+    card->rx = rx;
+    card->wait = wait;
+    card->set_link_state = set_link_state;
+    card->link_speed = NET_LINK_SPEED_DEFAULT;
+    card->card_num = net_card_current;
+    network_update_rate(state);
 
     network_set_wait(0);
 
+    /* Start with empty queues, before the provider's thread runs. */
+    for (i = 0; i < NET_QUEUE_COUNT; i++) {
+	if (!network_queue_init(&state->queues[i]))
+		fatal("NETWORK: Unable to allocate the packet queues\n");
+    }
+
     /* Activate the platform module. */
-    switch(network_type) {
+    switch(conf->net_type) {
 	case NET_TYPE_PCAP:
-		(void)net_pcap_reset(&net_cards[network_card], network_mac);
+		card->drv = &net_pcap_drv;
 		break;
 
 	case NET_TYPE_SLIRP:
-		(void)net_slirp_reset(&net_cards[network_card], network_mac);
+		card->drv = &net_slirp_drv;
+		break;
+
+	case NET_TYPE_VSWITCH:
+		card->drv = &net_vswitch_drv;
 		break;
     }
+    if (card->drv != NULL) {
+	card->drv_priv = card->drv->init(card, mac, conf->host_dev_name);
+	if (card->drv_priv == NULL) {
+		/* Tell user we can't do this (at the moment.) */
+		ui_msgbox_header(MBX_ERROR, (wchar_t *) IDS_2093, (wchar_t *) IDS_2129);
+
+		// FIXME: we should ask in the dialog if they want to
+		//	  reconfigure or quit, and throw them into the
+		//	  Settings dialog if yes.
+
+		/* Leave the card in place, but disconnected. */
+		conf->net_type = NET_TYPE_NONE;
+		card->drv = NULL;
+	}
+    }
+
+    timer_add(&state->timer, network_rx_queue, state, 0);
+    state->rx_credit = 0.0;
+    state->rx_delay = NET_RX_IDLE_US;
+    timer_on_auto(&state->timer, state->rx_delay);
+
+    net_card_states[card->card_num] = state;
 
-    first_pkt[0] = first_pkt[1] = first_pkt[2] = NULL;
-    last_pkt[0] = last_pkt[1] = last_pkt[2] = NULL;
-    memset(&queued_pkt, 0x00, sizeof(netpkt_t));
-    memset(&network_rx_queue_timer, 0x00, sizeof(pc_timer_t));
-    timer_add(&network_rx_queue_timer, network_rx_queue, NULL, 0);
-    /* 10 mbps. */
-    timer_on_auto(&network_rx_queue_timer, 0.762939453125 * 2.0);
-    network_timer_active = 1;
+    return card;
 }
 
 
-/* Stop the network timer. */
+/* Called by a card after network_attach() with its rated speed in kbit/s. */
 void
-network_timer_stop(void)
+network_set_link_speed(netcard_t *card, uint32_t kbps)
 {
-    if (network_timer_active) {
-	timer_stop(&network_rx_queue_timer);
-	memset(&network_rx_queue_timer, 0x00, sizeof(pc_timer_t));
-	network_timer_active = 0;
-    }
+    if (card == NULL) return;
+
+    card->link_speed = kbps;
+    network_update_rate((netcard_state_t *) card);
 }
 
 
-/* Stop any network activity. */
+/* Shut down one adapter, called from the card's close handler. */
 void
-network_close(void)
+network_detach(netcard_t *card)
 {
-    network_timer_stop();
+    netcard_state_t *state = (netcard_state_t *) card;
+    int i;
 
-    /* If already closed, do nothing. */
-    if (network_mutex == NULL) return;
+    if (card == NULL) return;
 
-    /* Force-close the PCAP module. */
-    net_pcap_close();
+    timer_stop(&state->timer);
 
-    /* Force-close the SLIRP module. */
-    net_slirp_close();
+    /* Stop the provider first, its thread uses the queues. */
+    if (card->drv != NULL)
+	card->drv->close(card->drv_priv);
 
-    /* Close the network thread mutex. */
-    thread_close_mutex(network_mutex);
-    network_mutex = NULL;
-    network_mac = NULL;
-#ifdef ENABLE_NETWORK_LOG
-    thread_close_mutex(network_dump_mutex);
-    network_dump_mutex = NULL;
-#endif
+    for (i = 0; i < NET_QUEUE_COUNT; i++)
+	network_queue_close(&state->queues[i]);
+    network_tx_spill_free(state);
+
+    if (net_card_states[card->card_num] == state)
+	net_card_states[card->card_num] = NULL;
+
+    network_log("NETWORK: adapter %i closed.\n", card->card_num + 1);
+
+    free(state);
+}
+
+
+/* Stop the network timers. */
+void
+network_timer_stop(void)
+{
+    int i;
+
+    for (i = 0; i < NET_CARD_MAX; i++) {
+	if (net_card_states[i] != NULL)
+		timer_stop(&net_card_states[i]->timer);
+    }
+}
+
+
+/* Stop any network activity. */
+void
+network_close(void)
+{
+    int i;
 
-    /* Here is where we clear the queues. */
-    network_queue_clear(0);
-    network_queue_clear(1);
+    /* Normally the cards have detached already when they were closed. */
+    for (i = 0; i < NET_CARD_MAX; i++) {
+	if (net_card_states[i] != NULL)
+		network_detach(&net_card_states[i]->card);
+    }
 
     network_log("NETWORK: closed.\n");
 }
@@ -497,85 +576,93 @@ network_close(void)
 void
 network_reset(void)
 {
-    int i = -1;
-
-    network_log("NETWORK: reset (type=%d, card=%d)\n",
-				network_type, network_card);
+    netcard_conf_t *conf;
+    int i;
 
     ui_sb_update_icon(SB_NETWORK, 0);
 
     /* Just in case.. */
     network_close();
 
-    /* If no active card, we're done. */
-    if ((network_type==NET_TYPE_NONE) || (network_card==0)) return;
+    for (i = 0; i < NET_CARD_MAX; i++) {
+	conf = &net_cards_conf[i];
 
-    network_mutex = thread_create_mutex();
-#ifdef ENABLE_NETWORK_LOG
-    network_dump_mutex = thread_create_mutex();
-#endif
+	network_log("NETWORK: reset adapter %i (type=%d, card=%d)\n",
+		    i + 1, conf->net_type, conf->device_num);
 
-    /* Initialize the platform module. */
-    switch(network_type) {
-	case NET_TYPE_PCAP:
-		i = net_pcap_init();
-		break;
+	/* If no active card, we're done with this slot. */
+	if ((conf->net_type == NET_TYPE_NONE) || (conf->device_num == 0))
+		continue;
 
-	case NET_TYPE_SLIRP:
-		i = net_slirp_init();
-		break;
-    }
-
-    if (i < 0) {
-	/* Tell user we can't do this (at the moment.) */
-	ui_msgbox_header(MBX_ERROR, (wchar_t *) IDS_2093, (wchar_t *) IDS_2129);
-
-	// FIXME: we should ask in the dialog if they want to
-	//	  reconfigure or quit, and throw them into the
-	//	  Settings dialog if yes.
+	network_log("NETWORK: set up adapter %i for %s, card='%s'\n", i + 1,
+		    (conf->net_type == NET_TYPE_SLIRP) ? "SLiRP" :
+		    ((conf->net_type == NET_TYPE_VSWITCH) ? "VSwitch" : "Pcap"),
+		    net_cards[conf->device_num]->name);
 
-	/* Disable network. */
-	network_type = NET_TYPE_NONE;
-
-	return;
-    }
-
-    network_log("NETWORK: set up for %s, card='%s'\n",
-	(network_type==NET_TYPE_SLIRP)?"SLiRP":"Pcap",
-			net_cards[network_card].device->name);
-
-    /* Add the (new?) card to the I/O system. */
-    if (net_cards[network_card].device) {
-	network_log("NETWORK: adding device '%s'\n",
-		net_cards[network_card].device->name);
-	device_add(net_cards[network_card].device);
+	/* Add the (new?) card to the I/O system, each slot is its own instance. */
+	net_card_current = i;
+	device_add_inst(net_cards[conf->device_num], i + 1);
     }
+    net_card_current = 0;
 }
 
 
-/* Queue a packet for transmission to one of the network providers. */
+/* Pass a packet on to the adapter's provider, without pacing. */
 void
-network_tx(uint8_t *bufp, int len)
+network_tx(netcard_t *card, uint8_t *bufp, int len)
 {
+    netcard_state_t *state = (netcard_state_t *) card;
+    nettx_spill_t *spill;
+
+    if ((card == NULL) || (len <= 0) || (len > NET_MAX_FRAME)) return;
+
     ui_sb_update_icon(SB_NETWORK, 1);
 
-    network_queue_put(2, NULL, bufp, len);
+    if (net_capture_on)
+	net_capture_frame(card, NET_CAPTURE_TX, bufp, len);
+
+    /* Keep the order: once frames are waiting, new ones queue behind them. */
+    if ((state->tx_spill != NULL) || !network_queue_try_put(&state->queues[NET_QUEUE_TX], bufp, len)) {
+	spill = (nettx_spill_t *) malloc(sizeof(nettx_spill_t) + len);
+	if (spill == NULL)
+		fatal("NETWORK: Unable to allocate a transmit buffer\n");
+	spill->next = NULL;
+	spill->len = len;
+	memcpy(spill->data, bufp, len);
+	if (state->tx_spill_last != NULL)
+		state->tx_spill_last->next = spill;
+	else
+		state->tx_spill = spill;
+	state->tx_spill_last = spill;
+    }
+
+    if (card->drv && card->drv->notify_in)
+	card->drv->notify_in(card->drv_priv);
 
     ui_sb_update_icon(SB_NETWORK, 0);
 }
 
 
-/* Actually transmit the packet. */
+/* Actually transmit the queued packets, called by the provider. */
 int
-network_tx_queue_check(void)
+network_tx_queue_check(const netcard_t *card)
 {
-    if ((first_pkt[1] == NULL) && (last_pkt[1] == NULL))
+    netcard_state_t *state = (netcard_state_t *) card;
+    netqueue_t *queue = &state->queues[NET_QUEUE_TX];
+    unsigned int head = atomic_load_explicit(&queue->head, memory_order_acquire);
+    netpkt_t *pkt;
+
+    if (network_queue_peek(queue, head) == NULL)
 	return 0;
 
     if (network_tx_pause)
 	return 1;
 
-    network_queue_transmit(1);
+    while ((pkt = network_queue_peek(queue, head)) != NULL) {
+	card->drv->in(card->drv_priv, pkt->data, pkt->len);
+	network_queue_advance(queue);
+    }
+
     return 1;
 }
 
@@ -600,9 +687,14 @@ network_dev_to_id(char *devname)
 int
 network_available(void)
 {
-    if ((network_type == NET_TYPE_NONE) || (network_card == 0)) return(0);
+    int i;
 
-    return(1);
+    for (i = 0; i < NET_CARD_MAX; i++) {
+	if ((net_cards_conf[i].net_type != NET_TYPE_NONE) && (net_cards_conf[i].device_num != 0))
+		return(1);
+    }
+
+    return(0);
 }
 
 
@@ -610,8 +702,8 @@ network_available(void)
 int
 network_card_available(int card)
 {
-    if (net_cards[card].device)
-	return(device_available(net_cards[card].device));
+    if (net_cards[card])
+	return(device_available(net_cards[card]));
 
     return(1);
 }
@@ -621,7 +713,7 @@ network_card_available(int card)
 const device_t *
 network_card_getdevice(int card)
 {
-    return(net_cards[card].device);
+    return(net_cards[card]);
 }
 
 
@@ -629,9 +721,9 @@ network_card_getdevice(int card)
 int
 network_card_has_config(int card)
 {
-    if (! net_cards[card].device) return(0);
+    if (! net_cards[card]) return(0);
 
-    return(device_has_config(net_cards[card].device) ? 1 : 0);
+    return(device_has_config(net_cards[card]) ? 1 : 0);
 }
 
 
@@ -639,7 +731,7 @@ network_card_has_config(int card)
 char *
 network_card_get_internal_name(int card)
 {
-    return device_get_internal_name(net_cards[card].device);
+    return device_get_internal_name(net_cards[card]);
 }
 
 
@@ -649,8 +741,8 @@ network_card_get_from_internal_name(char *s)
 {
     int c = 0;
 
-    while (net_cards[c].device != NULL) {
-	if (! strcmp((char *)net_cards[c].device->internal_name, s))
+    while (net_cards[c] != NULL) {
+	if (! strcmp((char *)net_cards[c]->internal_name, s))
 		return(c);
 	c++;
     }
@@ -666,6 +758,18 @@ network_set_wait(int wait)
 }
 
 
+/*
+ * Device instance for the parts of the adapter being added, such as its
+ * DP8390 core. Taken from the adapter slot so that it is unique whatever
+ * the mix of cards, and the same again after a hard reset.
+ */
+int
+network_card_inst(void)
+{
+    return(net_card_current + 1);
+}
+
+
 int
 network_get_wait(void)
 {
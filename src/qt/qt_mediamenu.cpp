@@ -401,7 +401,7 @@ void MediaMenu::cdromMount(int i) {
         QString(),
         QString(),
         tr("CD-ROM images") %
-        util::DlgFilter({ "iso","cue" }) %
+        util::DlgFilter({ "iso","cso","cue" }) %
         tr("All files") %
         util::DlgFilter({ "*" }, true));
 
@@ -80,6 +80,7 @@ extern "C" {
 #        define NOMINMAX
 #    endif
 #    include <windows.h>
+#    include <psapi.h>
 #    include <86box/win.h>
 #else
 #    include <strings.h>
@@ -329,6 +330,73 @@ plat_munmap(void *ptr, size_t size)
 #endif
 }
 
+void
+plat_madvise_huge(void *ptr, size_t size)
+{
+#if defined Q_OS_LINUX && defined MADV_HUGEPAGE
+    madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+}
+
+void
+plat_mdiscard(void *ptr, size_t size)
+{
+    /* Hand the pages back to the host; they read back as zero. */
+#if defined Q_OS_WINDOWS
+    VirtualFree(ptr, size, MEM_DECOMMIT);
+    VirtualAlloc(ptr, size, MEM_COMMIT, PAGE_READWRITE);
+#elif defined Q_OS_LINUX
+    madvise(ptr, size, MADV_DONTNEED);
+#elif defined Q_OS_UNIX
+    mmap(ptr, size, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE | MAP_FIXED, -1, 0);
+#endif
+}
+
+size_t
+plat_mresident(void *ptr, size_t size)
+{
+    size_t ret = 0;
+#if defined Q_OS_WINDOWS
+    PSAPI_WORKING_SET_EX_INFORMATION *info;
+    size_t n = (size + 4095) >> 12;
+
+    info = (PSAPI_WORKING_SET_EX_INFORMATION *) malloc(n * sizeof(PSAPI_WORKING_SET_EX_INFORMATION));
+    if (info == nullptr)
+        return size;
+    for (size_t i = 0; i < n; i++)
+        info[i].VirtualAddress = (uint8_t *) ptr + (i << 12);
+    if (QueryWorkingSetEx(GetCurrentProcess(), info, n * sizeof(PSAPI_WORKING_SET_EX_INFORMATION))) {
+        for (size_t i = 0; i < n; i++)
+            if (info[i].VirtualAttributes.Valid)
+                ret += 4096;
+    } else
+        ret = size;
+    free(info);
+#elif defined Q_OS_UNIX
+#    if defined Q_OS_LINUX
+    unsigned char *vec;
+#    else
+    char *vec;
+#    endif
+    size_t pg = sysconf(_SC_PAGESIZE);
+    size_t n  = (size + pg - 1) / pg;
+
+    vec = (decltype(vec)) malloc(n);
+    if (vec == nullptr)
+        return size;
+    if (mincore(ptr, size, vec) == 0) {
+        for (size_t i = 0; i < n; i++)
+            if (vec[i] & 1)
+                ret += pg;
+    } else
+        ret = size;
+    free(vec);
+#else
+    ret = size;
+#endif
+    return ret;
+}
+
 void
 plat_pause(int p)
 {
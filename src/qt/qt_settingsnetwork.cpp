@@ -17,6 +17,8 @@
 #include "qt_settingsnetwork.hpp"
 #include "ui_qt_settingsnetwork.h"
 
+#include <algorithm>
+
 extern "C" {
 #include <86box/86box.h>
 #include <86box/device.h>
@@ -30,8 +32,9 @@ extern "C" {
 static void enableElements(Ui::SettingsNetwork *ui) {
     int netType = ui->comboBoxNetwork->currentData().toInt();
     ui->comboBoxPcap->setEnabled(netType == NET_TYPE_PCAP);
+    ui->lineEditSwitch->setEnabled(netType == NET_TYPE_VSWITCH);
 
-    bool adaptersEnabled = netType == NET_TYPE_SLIRP ||
+    bool adaptersEnabled = netType == NET_TYPE_SLIRP || netType == NET_TYPE_VSWITCH ||
                            (netType == NET_TYPE_PCAP && ui->comboBoxPcap->currentData().toInt() > 0);
     ui->comboBoxAdapter->setEnabled(adaptersEnabled);
     ui->pushButtonConfigure->setEnabled(adaptersEnabled && ui->comboBoxAdapter->currentIndex() > 0 && network_card_has_config(ui->comboBoxAdapter->currentData().toInt()));
@@ -43,48 +46,106 @@ SettingsNetwork::SettingsNetwork(QWidget *parent) :
 {
     ui->setupUi(this);
 
+    for (int i = 0; i < NET_CARD_MAX; i++) {
+        adapters.append({ net_cards_conf[i].net_type, net_cards_conf[i].device_num, net_cards_conf[i].host_dev_name });
+    }
+
     auto* model = ui->comboBoxNetwork->model();
     Models::AddEntry(model, tr("None"), NET_TYPE_NONE);
     Models::AddEntry(model, "PCap", NET_TYPE_PCAP);
     Models::AddEntry(model, "SLiRP", NET_TYPE_SLIRP);
-    ui->comboBoxNetwork->setCurrentIndex(network_type);
+    Models::AddEntry(model, tr("Virtual switch"), NET_TYPE_VSWITCH);
 
-    int selectedRow = 0;
     model = ui->comboBoxPcap->model();
-    QString currentPcapDevice = network_host;
     for (int c = 0; c < network_ndev; c++) {
-
         Models::AddEntry(model, tr(network_devs[c].description), c);
-        if (QString(network_devs[c].device) == currentPcapDevice) {
+    }
+
+    onCurrentMachineChanged(machine);
+
+    /* Selecting the first slot loads it into the controls. */
+    model = ui->comboBoxSlot->model();
+    for (int i = 0; i < NET_CARD_MAX; i++) {
+        Models::AddEntry(model, tr("Adapter %1").arg(i + 1), i);
+    }
+    ui->comboBoxSlot->setCurrentIndex(0);
+}
+
+SettingsNetwork::~SettingsNetwork()
+{
+    delete ui;
+}
+
+void SettingsNetwork::loadAdapter(int slot) {
+    const auto& adapter = adapters[slot];
+
+    ui->comboBoxNetwork->setCurrentIndex(std::max(ui->comboBoxNetwork->findData(adapter.netType), 0));
+
+    int selectedRow = 0;
+    for (int c = 0; c < network_ndev; c++) {
+        if (QString(network_devs[c].device) == adapter.hostDevice) {
             selectedRow = c;
         }
     }
     ui->comboBoxPcap->setCurrentIndex(-1);
     ui->comboBoxPcap->setCurrentIndex(selectedRow);
 
-    onCurrentMachineChanged(machine);
+    /* A virtual switch keeps its name where a host interface would be. */
+    if (adapter.netType == NET_TYPE_VSWITCH && adapter.hostDevice != "none") {
+        ui->lineEditSwitch->setText(adapter.hostDevice);
+    } else {
+        ui->lineEditSwitch->clear();
+    }
+
+    ui->comboBoxAdapter->setCurrentIndex(-1);
+    ui->comboBoxAdapter->setCurrentIndex(std::max(ui->comboBoxAdapter->findData(adapter.deviceNum), 0));
+
     enableElements(ui);
 }
 
-SettingsNetwork::~SettingsNetwork()
-{
-    delete ui;
+void SettingsNetwork::storeAdapter(int slot) {
+    auto& adapter = adapters[slot];
+
+    adapter.netType = ui->comboBoxNetwork->currentData().toInt();
+    if (adapter.netType == NET_TYPE_VSWITCH) {
+        adapter.hostDevice = ui->lineEditSwitch->text().trimmed();
+        if (adapter.hostDevice.isEmpty()) {
+            adapter.hostDevice = "none";
+        }
+    } else {
+        adapter.hostDevice = network_devs[ui->comboBoxPcap->currentData().toInt()].device;
+    }
+    if (ui->comboBoxAdapter->currentIndex() >= 0) {
+        adapter.deviceNum = ui->comboBoxAdapter->currentData().toInt();
+    }
 }
 
 void SettingsNetwork::save() {
-    network_type = ui->comboBoxNetwork->currentData().toInt();
-    memset(network_host, '\0', sizeof(network_host));
-    strcpy(network_host, network_devs[ui->comboBoxPcap->currentData().toInt()].device);
-    network_card = ui->comboBoxAdapter->currentData().toInt();
+    if (currentSlot >= 0) {
+        storeAdapter(currentSlot);
+    }
+
+    for (int i = 0; i < NET_CARD_MAX; i++) {
+        net_cards_conf[i].net_type = adapters[i].netType;
+        net_cards_conf[i].device_num = adapters[i].deviceNum;
+        memset(net_cards_conf[i].host_dev_name, '\0', sizeof(net_cards_conf[i].host_dev_name));
+        strncpy(net_cards_conf[i].host_dev_name, adapters[i].hostDevice.toUtf8().constData(), sizeof(net_cards_conf[i].host_dev_name) - 1);
+    }
 }
 
 void SettingsNetwork::onCurrentMachineChanged(int machineId) {
     this->machineId = machineId;
 
+    /* Keep what is selected for the slot being shown. */
+    if (currentSlot >= 0) {
+        storeAdapter(currentSlot);
+    }
+
     auto* model = ui->comboBoxAdapter->model();
     auto removeRows = model->rowCount();
     int c = 0;
     int selectedRow = 0;
+    int deviceNum = (currentSlot >= 0) ? adapters[currentSlot].deviceNum : 0;
     while (true) {
         auto name = DeviceConfig::DeviceName(network_card_getdevice(c), network_card_get_internal_name(c), 1);
         if (name.isEmpty()) {
@@ -93,7 +154,7 @@ void SettingsNetwork::onCurrentMachineChanged(int machineId) {
 
         if (network_card_available(c) && device_is_valid(network_card_getdevice(c), machineId)) {
             int row = Models::AddEntry(model, name, c);
-            if (c == network_card) {
+            if (c == deviceNum) {
                 selectedRow = row - removeRows;
             }
         }
@@ -106,6 +167,18 @@ void SettingsNetwork::onCurrentMachineChanged(int machineId) {
     ui->comboBoxAdapter->setCurrentIndex(selectedRow);
 }
 
+void SettingsNetwork::on_comboBoxSlot_currentIndexChanged(int index) {
+    if (index < 0) {
+        return;
+    }
+
+    if (currentSlot >= 0) {
+        storeAdapter(currentSlot);
+    }
+    currentSlot = index;
+    loadAdapter(currentSlot);
+}
+
 void SettingsNetwork::on_comboBoxNetwork_currentIndexChanged(int index) {
     if (index < 0) {
         return;
@@ -123,7 +196,7 @@ void SettingsNetwork::on_comboBoxAdapter_currentIndexChanged(int index) {
 }
 
 void SettingsNetwork::on_pushButtonConfigure_clicked() {
-    DeviceConfig::ConfigureDevice(network_card_getdevice(ui->comboBoxAdapter->currentData().toInt()), 0, qobject_cast<Settings*>(Settings::settings));
+    DeviceConfig::ConfigureDevice(network_card_getdevice(ui->comboBoxAdapter->currentData().toInt()), std::max(currentSlot, 0) + 1, qobject_cast<Settings*>(Settings::settings));
 }
 
 
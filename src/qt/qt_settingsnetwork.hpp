@@ -2,6 +2,7 @@
 #define QT_SETTINGSNETWORK_HPP
 
 #include <QWidget>
+#include <QVector>
 
 namespace Ui {
 class SettingsNetwork;
@@ -26,10 +27,22 @@ private slots:
     void on_comboBoxNetwork_currentIndexChanged(int index);
 
     void on_comboBoxPcap_currentIndexChanged(int index);
+    void on_comboBoxSlot_currentIndexChanged(int index);
 
 private:
+    struct Adapter {
+        int netType;
+        int deviceNum;
+        QString hostDevice;
+    };
+
+    void loadAdapter(int slot);
+    void storeAdapter(int slot);
+
     Ui::SettingsNetwork *ui;
     int machineId = 0;
+    int currentSlot = -1;
+    QVector<Adapter> adapters;
 };
 
 #endif // QT_SETTINGSNETWORK_HPP
@@ -18,6 +18,7 @@
 #    include <86box/thread.h>
 #    include <86box/sound.h>
 #    include <86box/ui.h>
+#    include <86box/capture.h>
 
 #    define FLUID_CHORUS_DEFAULT_N     3
 #    define FLUID_CHORUS_DEFAULT_LEVEL 2.0f
@@ -110,7 +111,6 @@ typedef struct fluidsynth {
     int       buf_size;
     float    *buffer;
     int16_t  *buffer_int16;
-    int       midi_pos;
 
     int on;
 } fluidsynth_t;
@@ -127,11 +127,8 @@ void
 fluidsynth_poll(void)
 {
     fluidsynth_t *data = &fsdev;
-    data->midi_pos++;
-    if (data->midi_pos == 48000 / RENDER_RATE) {
-        data->midi_pos = 0;
-        thread_set_event(data->event);
-    }
+    /* Called every SOUND_MIDI_SAMPLES, one render chunk each. */
+    thread_set_event(data->event);
 }
 
 static void
@@ -154,6 +151,8 @@ fluidsynth_thread(void *param)
                 f_fluid_synth_write_float(data->synth, buf_size / (2 * sizeof(float)), buf, 0, 2, buf, 1, 2);
             buf_pos += buf_size;
             if (buf_pos >= data->buf_size) {
+                if (capture_on)
+                    capture_stream(CAPTURE_STREAM_MIDI, data->samplerate, data->buffer, data->buf_size / (2 * sizeof(float)));
                 givealbuffer_midi(data->buffer, data->buf_size / sizeof(float));
                 buf_pos = 0;
             }
@@ -164,6 +163,8 @@ fluidsynth_thread(void *param)
                 f_fluid_synth_write_s16(data->synth, buf_size / (2 * sizeof(int16_t)), buf, 0, 2, buf, 1, 2);
             buf_pos += buf_size;
             if (buf_pos >= data->buf_size) {
+                if (capture_on)
+                    capture_stream(CAPTURE_STREAM_MIDI, data->samplerate, data->buffer_int16, data->buf_size / (2 * sizeof(int16_t)));
                 givealbuffer_midi(data->buffer_int16, data->buf_size / sizeof(int16_t));
                 buf_pos = 0;
             }
@@ -1,3 +1,4 @@
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -13,6 +14,7 @@
 #include <86box/rom.h>
 #include <86box/sound.h>
 #include <86box/ui.h>
+#include <86box/capture.h>
 #include <mt32emu/c_interface/c_interface.h>
 
 extern void givealbuffer_midi(void *buf, uint32_t size);
@@ -136,7 +138,11 @@ static uint32_t samplerate   = 44100;
 static int      buf_size     = 0;
 static float   *buffer       = NULL;
 static int16_t *buffer_int16 = NULL;
-static int      midi_pos     = 0;
+
+/* Chunks requested by the sound timer and chunks rendered by the
+   thread; MIDI events are stamped against the former. */
+static atomic_uint chunks_polled   = 0;
+static unsigned    chunks_rendered = 0;
 
 static void
 display_mt32_message(void *instance_data, const char *message)
@@ -169,11 +175,9 @@ mt32_stream_int16(int16_t *stream, int len)
 void
 mt32_poll()
 {
-    midi_pos++;
-    if (midi_pos == 48000 / RENDER_RATE) {
-        midi_pos = 0;
-        thread_set_event(event);
-    }
+    /* Called every SOUND_MIDI_SAMPLES, one render chunk each. */
+    atomic_fetch_add_explicit(&chunks_polled, 1, memory_order_release);
+    thread_set_event(event);
 }
 
 static void
@@ -190,40 +194,65 @@ mt32_thread(void *param)
         thread_wait_event(event, -1);
         thread_reset_event(event);
 
-        if (sound_is_float) {
-            buf = (float *) ((uint8_t *) buffer + buf_pos);
-            memset(buf, 0, bsize);
-            mt32_stream(buf, bsize / (2 * sizeof(float)));
-            buf_pos += bsize;
-            if (buf_pos >= buf_size) {
-                givealbuffer_midi(buffer, buf_size / sizeof(float));
-                buf_pos = 0;
-            }
-        } else {
-            buf16 = (int16_t *) ((uint8_t *) buffer_int16 + buf_pos);
-            memset(buf16, 0, bsize);
-            mt32_stream_int16(buf16, bsize / (2 * sizeof(int16_t)));
-            buf_pos += bsize;
-            if (buf_pos >= buf_size) {
-                givealbuffer_midi(buffer_int16, buf_size / sizeof(int16_t));
-                buf_pos = 0;
+        /* Render every chunk polled so far, so coalesced wakeups do not
+           let the synth fall behind the event timestamps. */
+        while (mt32_on && (chunks_rendered != atomic_load_explicit(&chunks_polled, memory_order_acquire))) {
+            if (sound_is_float) {
+                buf = (float *) ((uint8_t *) buffer + buf_pos);
+                memset(buf, 0, bsize);
+                mt32_stream(buf, bsize / (2 * sizeof(float)));
+                buf_pos += bsize;
+                if (buf_pos >= buf_size) {
+                    if (capture_on)
+                        capture_stream(CAPTURE_STREAM_MIDI, samplerate, buffer, buf_size / (2 * sizeof(float)));
+                    givealbuffer_midi(buffer, buf_size / sizeof(float));
+                    buf_pos = 0;
+                }
+            } else {
+                buf16 = (int16_t *) ((uint8_t *) buffer_int16 + buf_pos);
+                memset(buf16, 0, bsize);
+                mt32_stream_int16(buf16, bsize / (2 * sizeof(int16_t)));
+                buf_pos += bsize;
+                if (buf_pos >= buf_size) {
+                    if (capture_on)
+                        capture_stream(CAPTURE_STREAM_MIDI, samplerate, buffer_int16, buf_size / (2 * sizeof(int16_t)));
+                    givealbuffer_midi(buffer_int16, buf_size / sizeof(int16_t));
+                    buf_pos = 0;
+                }
             }
+            chunks_rendered++;
         }
     }
 }
 
+/* Output timestamp of the current emulated instant. The thread renders
+   chunk n once chunk n + 1 has been polled, so events land one chunk
+   late but at the right offset within it. */
+static mt32emu_bit32u
+mt32_timestamp(void)
+{
+    uint32_t chunk = samplerate / RENDER_RATE;
+    uint32_t pos   = (uint32_t) sound_get_midi_pos();
+    uint32_t ts;
+
+    ts = atomic_load_explicit(&chunks_polled, memory_order_relaxed) * chunk;
+    ts += (uint32_t) (((uint64_t) pos * chunk) / SOUND_MIDI_SAMPLES);
+
+    return mt32emu_convert_output_to_synth_timestamp(context, ts);
+}
+
 void
 mt32_msg(uint8_t *val)
 {
     if (context)
-        mt32_check("mt32emu_play_msg", mt32emu_play_msg(context, *(uint32_t *) val), MT32EMU_RC_OK);
+        mt32_check("mt32emu_play_msg_at", mt32emu_play_msg_at(context, *(uint32_t *) val, mt32_timestamp()), MT32EMU_RC_OK);
 }
 
 void
 mt32_sysex(uint8_t *data, unsigned int len)
 {
     if (context)
-        mt32_check("mt32emu_play_sysex", mt32emu_play_sysex(context, data, len), MT32EMU_RC_OK);
+        mt32_check("mt32emu_play_sysex_at", mt32emu_play_sysex_at(context, data, len, mt32_timestamp()), MT32EMU_RC_OK);
 }
 
 void *
@@ -277,6 +306,9 @@ mt32emu_init(char *control_rom, char *pcm_rom)
 
     mt32_on = 1;
 
+    atomic_store(&chunks_polled, 0);
+    chunks_rendered = 0;
+
     start_event = thread_create_event();
 
     event    = thread_create_event();
@@ -34,10 +34,10 @@
 #include <86box/midi.h>
 #include <86box/sound.h>
 
-#define FREQ   48000
-#define BUFLEN SOUNDBUFLEN
+#define FREQ   sound_out_rate
+#define BUFLEN sound_out_buflen
 
-ALuint        buffers[4];      /* front and back buffers */
+ALuint        buffers[SOUND_MAX_BUFFERS]; /* output queue, grown and shrunk at runtime */
 ALuint        buffers_cd[4];   /* front and back buffers */
 ALuint        buffers_midi[4]; /* front and back buffers */
 static ALuint source[3];       /* audio source */
@@ -46,6 +46,7 @@ static int         midi_freq     = 44100;
 static int         midi_buf_size = 4410;
 static int         initialized   = 0;
 static int         sources       = 2;
+static int         buffers_num   = 4;
 static ALCcontext *Context;
 static ALCdevice  *Device;
 
@@ -101,7 +102,7 @@ closeal(void)
     if (sources == 3)
         alDeleteBuffers(4, buffers_midi);
     alDeleteBuffers(4, buffers_cd);
-    alDeleteBuffers(4, buffers);
+    alDeleteBuffers(buffers_num, buffers);
 
     alutExit();
 
@@ -115,6 +116,8 @@ inital(void)
     int16_t *buf_int16 = NULL, *cd_buf_int16 = NULL, *midi_buf_int16 = NULL;
     int      c;
 
+    sound_stats_t stats;
+
     char *mdn;
     int   init_midi = 0;
 
@@ -142,7 +145,9 @@ inital(void)
             midi_buf_int16 = (int16_t *) malloc(midi_buf_size * sizeof(int16_t));
     }
 
-    alGenBuffers(4, buffers);
+    sound_get_stats(&stats);
+    buffers_num = stats.target;
+    alGenBuffers(buffers_num, buffers);
     alGenBuffers(4, buffers_cd);
     if (init_midi)
         alGenBuffers(4, buffers_midi);
@@ -172,31 +177,36 @@ inital(void)
 
     if (sound_is_float) {
         memset(buf, 0, BUFLEN * 2 * sizeof(float));
-        memset(cd_buf, 0, BUFLEN * 2 * sizeof(float));
+        memset(cd_buf, 0, CD_BUFLEN * 2 * sizeof(float));
         if (init_midi)
             memset(midi_buf, 0, midi_buf_size * sizeof(float));
     } else {
         memset(buf_int16, 0, BUFLEN * 2 * sizeof(int16_t));
-        memset(cd_buf_int16, 0, BUFLEN * 2 * sizeof(int16_t));
+        memset(cd_buf_int16, 0, CD_BUFLEN * 2 * sizeof(int16_t));
         if (init_midi)
             memset(midi_buf_int16, 0, midi_buf_size * sizeof(int16_t));
     }
 
+    for (c = 0; c < buffers_num; c++) {
+        if (sound_is_float)
+            alBufferData(buffers[c], AL_FORMAT_STEREO_FLOAT32, buf, BUFLEN * 2 * sizeof(float), FREQ);
+        else
+            alBufferData(buffers[c], AL_FORMAT_STEREO16, buf_int16, BUFLEN * 2 * sizeof(int16_t), FREQ);
+    }
+
     for (c = 0; c < 4; c++) {
         if (sound_is_float) {
-            alBufferData(buffers[c], AL_FORMAT_STEREO_FLOAT32, buf, BUFLEN * 2 * sizeof(float), FREQ);
             alBufferData(buffers_cd[c], AL_FORMAT_STEREO_FLOAT32, cd_buf, CD_BUFLEN * 2 * sizeof(float), CD_FREQ);
             if (init_midi)
                 alBufferData(buffers_midi[c], AL_FORMAT_STEREO_FLOAT32, midi_buf, midi_buf_size * sizeof(float), midi_freq);
         } else {
-            alBufferData(buffers[c], AL_FORMAT_STEREO16, buf_int16, BUFLEN * 2 * sizeof(int16_t), FREQ);
             alBufferData(buffers_cd[c], AL_FORMAT_STEREO16, cd_buf_int16, CD_BUFLEN * 2 * sizeof(int16_t), CD_FREQ);
             if (init_midi)
                 alBufferData(buffers_midi[c], AL_FORMAT_STEREO16, midi_buf_int16, midi_buf_size * sizeof(int16_t), midi_freq);
         }
     }
 
-    alSourceQueueBuffers(source[0], 4, buffers);
+    alSourceQueueBuffers(source[0], buffers_num, buffers);
     alSourceQueueBuffers(source[1], 4, buffers_cd);
     if (init_midi)
         alSourceQueueBuffers(source[2], 4, buffers_midi);
@@ -220,11 +230,48 @@ inital(void)
     initialized = 1;
 }
 
+static void
+al_buffer_data(ALuint buffer, void *buf, int size, int freq)
+{
+    if (sound_is_float)
+        alBufferData(buffer, AL_FORMAT_STEREO_FLOAT32, buf, size * sizeof(float), freq);
+    else
+        alBufferData(buffer, AL_FORMAT_STEREO16, buf, size * sizeof(int16_t), freq);
+}
+
+/* Bring the output queue towards the depth asked for by the sound core.
+   A new buffer goes in as silence, which is the extra cushion. */
+static void
+al_adapt_queue(int size, int freq, int processed, int target)
+{
+    ALuint buffer;
+    void  *silence;
+    int    c;
+
+    if ((target > buffers_num) && (buffers_num < SOUND_MAX_BUFFERS)) {
+        silence = calloc(size, sound_is_float ? sizeof(float) : sizeof(int16_t));
+        alGenBuffers(1, &buffers[buffers_num]);
+        al_buffer_data(buffers[buffers_num], silence, size, freq);
+        alSourceQueueBuffers(source[0], 1, &buffers[buffers_num]);
+        buffers_num++;
+        free(silence);
+    } else if ((target < buffers_num) && (processed >= 2)) {
+        alSourceUnqueueBuffers(source[0], 1, &buffer);
+        alDeleteBuffers(1, &buffer);
+        for (c = 0; c < buffers_num; c++) {
+            if (buffers[c] == buffer) {
+                buffers[c] = buffers[--buffers_num];
+                break;
+            }
+        }
+    }
+}
+
 void
 givealbuffer_common(void *buf, uint8_t src, int size, int freq)
 {
-    int    processed;
-    int    state;
+    int    processed, queued;
+    int    state, underrun = 0;
     ALuint buffer;
     double gain;
 
@@ -235,19 +282,21 @@ givealbuffer_common(void *buf, uint8_t src, int size, int freq)
 
     if (state == 0x1014) {
         alSourcePlay(source[src]);
+        underrun = 1;
     }
 
     alGetSourcei(source[src], AL_BUFFERS_PROCESSED, &processed);
+    if (src == 0) {
+        alGetSourcei(source[src], AL_BUFFERS_QUEUED, &queued);
+        al_adapt_queue(size, freq, processed, sound_out_report(queued - processed, underrun));
+        alGetSourcei(source[src], AL_BUFFERS_PROCESSED, &processed);
+    }
     if (processed >= 1) {
         gain = pow(10.0, (double) sound_gain / 20.0);
         alListenerf(AL_GAIN, gain);
 
         alSourceUnqueueBuffers(source[src], 1, &buffer);
-
-        if (sound_is_float)
-            alBufferData(buffer, AL_FORMAT_STEREO_FLOAT32, buf, size * sizeof(float), freq);
-        else
-            alBufferData(buffer, AL_FORMAT_STEREO16, buf, size * sizeof(int16_t), freq);
+        al_buffer_data(buffer, buf, size, freq);
 
         alSourceQueueBuffers(source[src], 1, &buffer);
     }
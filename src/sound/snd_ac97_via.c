@@ -499,6 +499,7 @@ ac97_via_update_stereo(ac97_via_t *dev, ac97_via_sgd_t *sgd)
 {
     int32_t l = (((sgd->out_l * sgd->vol_l) >> 15) * dev->master_vol_l) >> 15,
             r = (((sgd->out_r * sgd->vol_r) >> 15) * dev->master_vol_r) >> 15;
+    int     pos = sound_get_pos();
 
     if (l < -32768)
         l = -32768;
@@ -509,7 +510,7 @@ ac97_via_update_stereo(ac97_via_t *dev, ac97_via_sgd_t *sgd)
     else if (r > 32767)
         r = 32767;
 
-    for (; sgd->pos < sound_pos_global; sgd->pos++) {
+    for (; sgd->pos < pos; sgd->pos++) {
         sgd->buffer[sgd->pos * 2]     = l;
         sgd->buffer[sgd->pos * 2 + 1] = r;
     }
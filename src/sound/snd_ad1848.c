@@ -414,7 +414,9 @@ ad1848_speed_changed(ad1848_t *ad1848)
 void
 ad1848_update(ad1848_t *ad1848)
 {
-    for (; ad1848->pos < sound_pos_global; ad1848->pos++) {
+    int pos = sound_get_pos();
+
+    for (; ad1848->pos < pos; ad1848->pos++) {
         ad1848->buffer[ad1848->pos * 2]     = ad1848->out_l;
         ad1848->buffer[ad1848->pos * 2 + 1] = ad1848->out_r;
     }
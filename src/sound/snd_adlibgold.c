@@ -580,7 +580,9 @@ adgold_read(uint16_t addr, void *p)
 void
 adgold_update(adgold_t *adgold)
 {
-    for (; adgold->pos < sound_pos_global; adgold->pos++) {
+    int pos = sound_get_pos();
+
+    for (; adgold->pos < pos; adgold->pos++) {
         adgold->mma_buffer[0][adgold->pos] = adgold->mma_buffer[1][adgold->pos] = 0;
 
         if (adgold->adgold_mma_regs[0][9] & 0x20)
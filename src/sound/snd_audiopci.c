@@ -1816,6 +1816,7 @@ static void
 es1371_update(es1371_t *dev)
 {
     int32_t l, r;
+    int     pos = sound_get_pos();
 
     l = (dev->dac[0].out_l * dev->dac[0].vol_l) >> 12;
     l += ((dev->dac[1].out_l * dev->dac[1].vol_l) >> 12);
@@ -1837,7 +1838,7 @@ es1371_update(es1371_t *dev)
     else if (r > 32767)
         r = 32767;
 
-    for (; dev->pos < sound_pos_global; dev->pos++) {
+    for (; dev->pos < pos; dev->pos++) {
         dev->buffer[dev->pos * 2]     = l;
         dev->buffer[dev->pos * 2 + 1] = r;
     }
@@ -14,7 +14,9 @@
 void
 cms_update(cms_t *cms)
 {
-    for (; cms->pos < sound_pos_global; cms->pos++) {
+    int pos = sound_get_pos();
+
+    for (; cms->pos < pos; cms->pos++) {
         int     c, d;
         int16_t out_l = 0, out_r = 0;
 
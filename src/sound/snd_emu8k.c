@@ -1464,11 +1464,60 @@ emu8k_outb(uint16_t addr, uint8_t val, void *p)
         emu8k_outw(addr, val, p);
 }
 
+/*
+ * The chorus and reverb run every sample even when nothing feeds them.
+ * Once the input has been silent for EMU8K_FX_QUIET_SAMPLES the tail
+ * is taken to have died out: whatever the integer feedback still leaves
+ * in the delay lines is cleared and from then on only the positions
+ * move. All-zero delay lines look the same from any position.
+ */
+#define EMU8K_FX_QUIET_SAMPLES (44100 * 5)
+
+static int
+emu8k_buffer_is_silent(const int32_t *buf, int count)
+{
+    int pos;
+
+    for (pos = 0; pos < count; pos++) {
+        if (buf[pos])
+            return 0;
+    }
+
+    return 1;
+}
+
+static int
+emu8k_chorus_skip(int32_t *inbuf, emu8k_chorus_eng_t *engine, int count)
+{
+    if (!emu8k_buffer_is_silent(inbuf, count)) {
+        engine->quiet = 0;
+        return 0;
+    }
+
+    if (engine->quiet < EMU8K_FX_QUIET_SAMPLES) {
+        engine->quiet += count;
+        if (engine->quiet < EMU8K_FX_QUIET_SAMPLES)
+            return 0;
+        memset(engine->chorus_left_buffer, 0, sizeof(engine->chorus_left_buffer));
+        memset(engine->chorus_right_buffer, 0, sizeof(engine->chorus_right_buffer));
+    }
+
+    engine->write = (engine->write + count) % EMU8K_LFOCHORUS_SIZE;
+    engine->lfo_pos.addr += engine->lfo_inc.addr * count;
+    engine->lfo_pos.int_address &= 0xFFFF;
+
+    return 1;
+}
+
 /* TODO: This is not a correct emulation, just a workalike implementation. */
 void
 emu8k_work_chorus(int32_t *inbuf, int32_t *outbuf, emu8k_chorus_eng_t *engine, int count)
 {
     int pos;
+
+    if (emu8k_chorus_skip(inbuf, engine, count))
+        return;
+
     for (pos = 0; pos < count; pos++) {
         double lfo_inter1 = chortable[engine->lfo_pos.int_address];
         // double lfo_inter2 = chortable[(engine->lfo_pos.int_address+1)&0xFFFF];
@@ -1588,11 +1637,70 @@ emu8k_reverb_damper_work(emu8k_reverb_combfilter_t *comb, int32_t in)
     return comb->filterstore;
 }
 
+static void
+emu8k_reverb_comb_clear(emu8k_reverb_combfilter_t *comb)
+{
+    memset(comb->reflection, 0, sizeof(comb->reflection));
+    comb->filterstore = 0;
+}
+
+/* Move a delay line on by count samples, the same way the work functions do. */
+static void
+emu8k_reverb_comb_skip(emu8k_reverb_combfilter_t *comb, int count)
+{
+    if (comb->read_pos >= comb->bufsize) {
+        comb->read_pos = 0;
+        count--;
+    }
+
+    if (comb->bufsize > 0)
+        comb->read_pos = (comb->read_pos + count) % comb->bufsize;
+}
+
+static int
+emu8k_reverb_skip(int32_t *inbuf, emu8k_reverb_eng_t *engine, int count)
+{
+    int c;
+
+    if (!emu8k_buffer_is_silent(inbuf, count)) {
+        engine->quiet = 0;
+        return 0;
+    }
+
+    if (engine->quiet < EMU8K_FX_QUIET_SAMPLES) {
+        engine->quiet += count;
+        if (engine->quiet < EMU8K_FX_QUIET_SAMPLES)
+            return 0;
+        for (c = 0; c < 6; c++)
+            emu8k_reverb_comb_clear(&engine->reflections[c]);
+        for (c = 0; c < 8; c++)
+            emu8k_reverb_comb_clear(&engine->allpass[c]);
+        emu8k_reverb_comb_clear(&engine->tailL);
+        emu8k_reverb_comb_clear(&engine->tailR);
+        engine->damper.filterstore = 0;
+    }
+
+    for (c = 0; c < 6; c++)
+        emu8k_reverb_comb_skip(&engine->reflections[c], count);
+    emu8k_reverb_comb_skip(&engine->tailL, count);
+    emu8k_reverb_comb_skip(&engine->tailR, count);
+    emu8k_reverb_comb_skip(&engine->allpass[1], count);
+    emu8k_reverb_comb_skip(&engine->allpass[2], count);
+    emu8k_reverb_comb_skip(&engine->allpass[5], count);
+    emu8k_reverb_comb_skip(&engine->allpass[6], count);
+
+    return 1;
+}
+
 /* TODO: This is not a correct emulation, just a workalike implementation. */
 void
 emu8k_work_reverb(int32_t *inbuf, int32_t *outbuf, emu8k_reverb_eng_t *engine, int count)
 {
     int pos;
+
+    if (emu8k_reverb_skip(inbuf, engine, count))
+        return;
+
     if (engine->link_return_type) {
         for (pos = 0; pos < count; pos++) {
             int32_t dat1, dat2, in, in2;
@@ -1659,7 +1767,7 @@ emu8k_vol_slide(emu8k_slide_t *slide, int32_t target)
 void
 emu8k_update(emu8k_t *emu8k)
 {
-    int new_pos = (sound_pos_global * 44100) / 48000;
+    int new_pos = (sound_get_pos() * 44100) / 48000;
     if (emu8k->pos >= new_pos)
         return;
 
@@ -30,7 +30,9 @@ typedef struct dss_t {
 static void
 dss_update(dss_t *dss)
 {
-    for (; dss->pos < sound_pos_global; dss->pos++)
+    int pos = sound_get_pos();
+
+    for (; dss->pos < pos; dss->pos++)
         dss->buffer[dss->pos] = (int8_t) (dss->dac_val ^ 0x80) * 0x40;
 }
 
@@ -251,15 +251,17 @@ opl2_init(opl_t *dev)
 void
 opl2_update(opl_t *dev)
 {
-    if (dev->pos >= sound_pos_global) {
+    int pos = sound_get_pos();
+
+    if (dev->pos >= pos) {
         return;
     }
 
     nuked_generate_stream(dev->opl,
                           &dev->buffer[dev->pos * 2],
-                          sound_pos_global - dev->pos);
+                          pos - dev->pos);
 
-    for (; dev->pos < sound_pos_global; dev->pos++) {
+    for (; dev->pos < pos; dev->pos++) {
         dev->buffer[dev->pos * 2] /= 2;
         dev->buffer[(dev->pos * 2) + 1] = dev->buffer[dev->pos * 2];
     }
@@ -298,14 +300,16 @@ opl3_init(opl_t *dev)
 void
 opl3_update(opl_t *dev)
 {
-    if (dev->pos >= sound_pos_global)
+    int pos = sound_get_pos();
+
+    if (dev->pos >= pos)
         return;
 
     nuked_generate_stream(dev->opl,
                           &dev->buffer[dev->pos * 2],
-                          sound_pos_global - dev->pos);
+                          pos - dev->pos);
 
-    for (; dev->pos < sound_pos_global; dev->pos++) {
+    for (; dev->pos < pos; dev->pos++) {
         dev->buffer[dev->pos * 2] /= 2;
         dev->buffer[(dev->pos * 2) + 1] /= 2;
     }
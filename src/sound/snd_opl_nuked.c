@@ -276,9 +276,20 @@ static const uint8_t ch_slot[18] = {
 };
 
 // Envelope generator
-typedef int16_t (*env_sinfunc)(uint16_t phase, uint16_t envelope);
+/*
+ * The waveforms only depend on the phase, so each one is reduced to
+ * a 1024-entry table of log-sin attenuation with the sign in bit 15,
+ * built once from the functions below. The per-sample work is then
+ * one lookup and env_calc_exp(), with no indirect call per slot.
+ */
+#define WF_NEG 0x8000
+
+typedef uint16_t (*env_sinfunc)(uint16_t phase);
 typedef void (*env_genfunc)(slot_t *slot);
 
+static uint16_t wf_tab[8][1024];
+static int      wf_tab_init = 0;
+
 static int16_t
 env_calc_exp(uint32_t level)
 {
@@ -288,8 +299,8 @@ env_calc_exp(uint32_t level)
     return ((exprom[level & 0xff] << 1) >> (level >> 8));
 }
 
-static int16_t
-env_calc_sin0(uint16_t phase, uint16_t env)
+static uint16_t
+env_calc_sin0(uint16_t phase)
 {
     uint16_t out = 0;
     uint16_t neg = 0;
@@ -297,18 +308,18 @@ env_calc_sin0(uint16_t phase, uint16_t env)
     phase &= 0x3ff;
 
     if (phase & 0x0200)
-        neg = 0xffff;
+        neg = WF_NEG;
 
     if (phase & 0x0100)
         out = logsinrom[(phase & 0xff) ^ 0xff];
     else
         out = logsinrom[phase & 0xff];
 
-    return (env_calc_exp(out + (env << 3)) ^ neg);
+    return (out | neg);
 }
 
-static int16_t
-env_calc_sin1(uint16_t phase, uint16_t env)
+static uint16_t
+env_calc_sin1(uint16_t phase)
 {
     uint16_t out = 0;
 
@@ -321,11 +332,11 @@ env_calc_sin1(uint16_t phase, uint16_t env)
     else
         out = logsinrom[phase & 0xff];
 
-    return (env_calc_exp(out + (env << 3)));
+    return (out);
 }
 
-static int16_t
-env_calc_sin2(uint16_t phase, uint16_t env)
+static uint16_t
+env_calc_sin2(uint16_t phase)
 {
     uint16_t out = 0;
 
@@ -336,11 +347,11 @@ env_calc_sin2(uint16_t phase, uint16_t env)
     else
         out = logsinrom[phase & 0xff];
 
-    return (env_calc_exp(out + (env << 3)));
+    return (out);
 }
 
-static int16_t
-env_calc_sin3(uint16_t phase, uint16_t env)
+static uint16_t
+env_calc_sin3(uint16_t phase)
 {
     uint16_t out = 0;
 
@@ -351,11 +362,11 @@ env_calc_sin3(uint16_t phase, uint16_t env)
     else
         out = logsinrom[phase & 0xff];
 
-    return (env_calc_exp(out + (env << 3)));
+    return (out);
 }
 
-static int16_t
-env_calc_sin4(uint16_t phase, uint16_t env)
+static uint16_t
+env_calc_sin4(uint16_t phase)
 {
     uint16_t out = 0;
     uint16_t neg = 0;
@@ -363,7 +374,7 @@ env_calc_sin4(uint16_t phase, uint16_t env)
     phase &= 0x03ff;
 
     if ((phase & 0x0300) == 0x0100)
-        neg = 0xffff;
+        neg = WF_NEG;
 
     if (phase & 0x0200)
         out = 0x1000;
@@ -372,11 +383,11 @@ env_calc_sin4(uint16_t phase, uint16_t env)
     else
         out = logsinrom[(phase << 1) & 0xff];
 
-    return (env_calc_exp(out + (env << 3)) ^ neg);
+    return (out | neg);
 }
 
-static int16_t
-env_calc_sin5(uint16_t phase, uint16_t env)
+static uint16_t
+env_calc_sin5(uint16_t phase)
 {
     uint16_t out = 0;
 
@@ -389,24 +400,24 @@ env_calc_sin5(uint16_t phase, uint16_t env)
     else
         out = logsinrom[(phase << 1) & 0xff];
 
-    return (env_calc_exp(out + (env << 3)));
+    return (out);
 }
 
-static int16_t
-env_calc_sin6(uint16_t phase, uint16_t env)
+static uint16_t
+env_calc_sin6(uint16_t phase)
 {
     uint16_t neg = 0;
 
     phase &= 0x03ff;
 
     if (phase & 0x0200)
-        neg = 0xffff;
+        neg = WF_NEG;
 
-    return (env_calc_exp(env << 3) ^ neg);
+    return (neg);
 }
 
-static int16_t
-env_calc_sin7(uint16_t phase, uint16_t env)
+static uint16_t
+env_calc_sin7(uint16_t phase)
 {
     uint16_t out = 0;
     uint16_t neg = 0;
@@ -414,13 +425,13 @@ env_calc_sin7(uint16_t phase, uint16_t env)
     phase &= 0x03ff;
 
     if (phase & 0x0200) {
-        neg   = 0xffff;
+        neg   = WF_NEG;
         phase = (phase & 0x01ff) ^ 0x01ff;
     }
 
     out = phase << 3;
 
-    return (env_calc_exp(out + (env << 3)) ^ neg);
+    return (out | neg);
 }
 
 static const env_sinfunc env_sin[8] = {
@@ -434,6 +445,19 @@ static const env_sinfunc env_sin[8] = {
     env_calc_sin7
 };
 
+static void
+wf_tab_build(void)
+{
+    int wf, phase;
+
+    for (wf = 0; wf < 8; wf++) {
+        for (phase = 0; phase < 1024; phase++)
+            wf_tab[wf][phase] = env_sin[wf](phase);
+    }
+
+    wf_tab_init = 1;
+}
+
 static void
 env_update_ksl(slot_t *slot)
 {
@@ -713,8 +737,10 @@ slot_write_e0(slot_t *slot, uint8_t data)
 static void
 slot_generate(slot_t *slot)
 {
-    slot->out = env_sin[slot->reg_wf](slot->pg_phase_out + *slot->mod,
-                                      slot->eg_out);
+    uint16_t wf  = wf_tab[slot->reg_wf][(uint16_t) (slot->pg_phase_out + *slot->mod) & 0x3ff];
+    uint16_t neg = (wf & WF_NEG) ? 0xffff : 0x0000;
+
+    slot->out = env_calc_exp((wf & ~WF_NEG) + ((uint16_t) slot->eg_out << 3)) ^ neg;
 }
 
 static void
@@ -1309,6 +1335,9 @@ nuked_init(uint32_t samplerate)
     nuked_t *dev;
     uint8_t  i;
 
+    if (!wf_tab_init)
+        wf_tab_build();
+
     dev = (nuked_t *) malloc(sizeof(nuked_t));
     memset(dev, 0x00, sizeof(nuked_t));
 
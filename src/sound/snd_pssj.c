@@ -112,7 +112,9 @@ pssj_read(uint16_t port, void *p)
 static void
 pssj_update(pssj_t *pssj)
 {
-    for (; pssj->pos < sound_pos_global; pssj->pos++)
+    int pos = sound_get_pos();
+
+    for (; pssj->pos < pos; pssj->pos++)
         pssj->buffer[pssj->pos] = (((int8_t) (pssj->dac_val ^ 0x80) * 0x20) * pssj->amplitude) / 15;
 }
 
@@ -0,0 +1,219 @@
+/*
+ * 86Box	A hypervisor and IBM PC system emulator that specializes in
+ *		running old operating systems and software designed for IBM
+ *		PC systems and compatibles from 1981 through fairly recent
+ *		system designs based on the PCI bus.
+ *
+ *		This file is part of the 86Box distribution.
+ *
+ *		Shared polyphase resampler.
+ *
+ *		Input frames are pushed at the device's native rate and
+ *		output frames pulled at an arbitrary rate. Each output frame
+ *		costs a fixed number of taps per channel, taken from a table
+ *		of windowed-sinc phases built when the rates change; the
+ *		inner loop is a plain dot product the compiler vectorizes.
+ */
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+#include <86box/86box.h>
+#include <86box/snd_resampler.h>
+
+#ifndef M_PI
+#    define M_PI 3.14159265358979323846
+#endif
+
+#define RS_TAPS     16   /* Taps per output frame when upsampling. */
+#define RS_MAX_TAPS 64
+#define RS_PHASES   256
+#define RS_BUFLEN   8192 /* Input frames per channel. */
+#define RS_MAX_CH   2
+
+struct resampler_t {
+    int channels;
+    int in_rate, out_rate;
+    int taps;
+
+    uint64_t step; /* 32.32 input frames per output frame */
+    uint32_t frac;
+    int      pos, filled;
+
+    float  coef[RS_PHASES][RS_MAX_TAPS];
+    float  last[RS_MAX_CH];
+    float *buf[RS_MAX_CH];
+};
+
+static void
+resampler_build(resampler_t *rs)
+{
+    double fc = (rs->out_rate < rs->in_rate) ? ((double) rs->out_rate / (double) rs->in_rate) : 1.0;
+    double t, w, h, gain;
+    int    p, k;
+
+    /* Widen the kernel when decimating so the stopband stays put. */
+    rs->taps = (int) ceil(RS_TAPS / fc);
+    rs->taps = (rs->taps + 3) & ~3;
+    if (rs->taps > RS_MAX_TAPS)
+        rs->taps = RS_MAX_TAPS;
+
+    for (p = 0; p < RS_PHASES; p++) {
+        gain = 0.0;
+        for (k = 0; k < rs->taps; k++) {
+            t = (double) (k - (rs->taps / 2 - 1)) - ((double) p / (double) RS_PHASES);
+            w = 0.42 + 0.5 * cos((2.0 * M_PI * t) / (double) rs->taps) + 0.08 * cos((4.0 * M_PI * t) / (double) rs->taps);
+            h = (t == 0.0) ? 1.0 : (sin(M_PI * fc * t) / (M_PI * fc * t));
+
+            rs->coef[p][k] = (float) (w * h);
+            gain += w * h;
+        }
+        for (k = 0; k < rs->taps; k++)
+            rs->coef[p][k] /= (float) gain;
+        for (; k < RS_MAX_TAPS; k++)
+            rs->coef[p][k] = 0.0f;
+    }
+}
+
+void
+resampler_set_rates(resampler_t *rs, int in_rate, int out_rate)
+{
+    if ((in_rate <= 0) || (out_rate <= 0))
+        return;
+    if ((rs->in_rate == in_rate) && (rs->out_rate == out_rate))
+        return;
+
+    rs->in_rate  = in_rate;
+    rs->out_rate = out_rate;
+    rs->step     = ((uint64_t) in_rate << 32) / (uint64_t) out_rate;
+
+    resampler_build(rs);
+}
+
+/* Group delay of the filter, in input frames. */
+int
+resampler_latency(resampler_t *rs)
+{
+    return rs->taps / 2 - 1;
+}
+
+/* Drops all pending input and fills the history with `prime` copies of
+   `frame` (or silence), so output resumes without a step. */
+void
+resampler_reset(resampler_t *rs, int prime, const int16_t *frame)
+{
+    int c, i;
+
+    if (prime > (RS_BUFLEN / 2))
+        prime = RS_BUFLEN / 2;
+
+    for (c = 0; c < rs->channels; c++) {
+        rs->last[c] = frame ? (float) frame[c] : 0.0f;
+        for (i = 0; i < prime; i++)
+            rs->buf[c][i] = rs->last[c];
+    }
+
+    rs->pos    = 0;
+    rs->frac   = 0;
+    rs->filled = prime;
+}
+
+void
+resampler_push(resampler_t *rs, const int16_t *frame)
+{
+    int c;
+
+    if (rs->filled >= RS_BUFLEN) {
+        /* Nobody is pulling; keep the newest half. */
+        for (c = 0; c < rs->channels; c++)
+            memmove(rs->buf[c], &rs->buf[c][RS_BUFLEN / 2], (RS_BUFLEN / 2) * sizeof(float));
+        rs->filled -= RS_BUFLEN / 2;
+        rs->pos = (rs->pos > (RS_BUFLEN / 2)) ? (rs->pos - (RS_BUFLEN / 2)) : 0;
+    }
+
+    for (c = 0; c < rs->channels; c++) {
+        rs->last[c]            = (float) frame[c];
+        rs->buf[c][rs->filled] = rs->last[c];
+    }
+    rs->filled++;
+}
+
+/* Produces up to `frames` interleaved output frames. With `hold` set, an
+   underrun repeats the last input frame instead of stopping short. */
+int
+resampler_pull(resampler_t *rs, float *out, int frames, int hold)
+{
+    const float *coef;
+    const float *in;
+    uint64_t     next;
+    float        acc;
+    int          c, k, n;
+
+    for (n = 0; n < frames; n++) {
+        if ((rs->pos + rs->taps) > rs->filled) {
+            if (!hold || (rs->filled >= RS_BUFLEN))
+                break;
+            for (c = 0; c < rs->channels; c++)
+                rs->buf[c][rs->filled] = rs->last[c];
+            rs->filled++;
+            n--;
+            continue;
+        }
+
+        coef = rs->coef[rs->frac >> 24];
+        for (c = 0; c < rs->channels; c++) {
+            in  = &rs->buf[c][rs->pos];
+            acc = 0.0f;
+            for (k = 0; k < rs->taps; k++)
+                acc += in[k] * coef[k];
+            out[n * rs->channels + c] = acc;
+        }
+
+        next     = (uint64_t) rs->frac + rs->step;
+        rs->pos += (int) (next >> 32);
+        rs->frac = (uint32_t) next;
+    }
+
+    /* Slide the consumed input out of the way. */
+    if (rs->pos > 0) {
+        if (rs->pos > rs->filled)
+            rs->pos = rs->filled;
+        for (c = 0; c < rs->channels; c++)
+            memmove(rs->buf[c], &rs->buf[c][rs->pos], (rs->filled - rs->pos) * sizeof(float));
+        rs->filled -= rs->pos;
+        rs->pos = 0;
+    }
+
+    return n;
+}
+
+resampler_t *
+resampler_init(int channels, int in_rate, int out_rate)
+{
+    resampler_t *rs = calloc(1, sizeof(resampler_t));
+    int          c;
+
+    if (channels > RS_MAX_CH)
+        channels = RS_MAX_CH;
+    rs->channels = channels;
+    for (c = 0; c < channels; c++)
+        rs->buf[c] = calloc(RS_BUFLEN, sizeof(float));
+
+    resampler_set_rates(rs, in_rate, out_rate);
+    resampler_reset(rs, resampler_latency(rs), NULL);
+
+    return rs;
+}
+
+void
+resampler_close(resampler_t *rs)
+{
+    int c;
+
+    for (c = 0; c < rs->channels; c++)
+        free(rs->buf[c]);
+    free(rs);
+}
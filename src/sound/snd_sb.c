@@ -340,11 +340,12 @@ sb_get_buffer_sb16_awe32(int32_t *buffer, int len, void *p)
 {
     sb_t              *sb    = (sb_t *) p;
     sb_ct1745_mixer_t *mixer = &sb->mixer_sb16;
-    int                c, dsp_rec_pos = sb->dsp.record_pos_write;
-    int                c_emu8k, c_record;
+    int                c, c_emu8k;
     int32_t            in_l, in_r;
     double             out_l = 0.0, out_r = 0.0;
     double             bass_treble;
+    float              dsp_out[SOUNDBUFLEN * 2];
+    int                resampled;
 
     if (sb->opl_enabled)
         opl3_update(&sb->opl);
@@ -353,6 +354,7 @@ sb_get_buffer_sb16_awe32(int32_t *buffer, int len, void *p)
         emu8k_update(&sb->emu8k);
 
     sb_dsp_update(&sb->dsp);
+    resampled = sb_dsp_resample_get(&sb->dsp, dsp_out, len);
 
     for (c = 0; c < len * 2; c += 2) {
         out_l = 0.0, out_r = 0.0;
@@ -376,7 +378,11 @@ sb_get_buffer_sb16_awe32(int32_t *buffer, int len, void *p)
         in_r = (mixer->input_selector_right & INPUT_MIDI_L) ? ((int32_t) out_l) : 0 + (mixer->input_selector_right & INPUT_MIDI_R) ? ((int32_t) out_r)
                                                                                                                                    : 0;
 
-        if (mixer->output_filter) {
+        if (mixer->output_filter && resampled) {
+            /* DMA playback, already band-limited by the resampler. */
+            out_l += (((double) dsp_out[c]) * mixer->voice_l) / 3.0;
+            out_r += (((double) dsp_out[c + 1]) * mixer->voice_r) / 3.0;
+        } else if (mixer->output_filter) {
             /* We divide by 3 to get the volume down to normal. */
             out_l += (low_fir_sb16(0, 0, (double) sb->dsp.buffer[c]) * mixer->voice_l) / 3.0;
             out_r += (low_fir_sb16(0, 1, (double) sb->dsp.buffer[c + 1]) * mixer->voice_r) / 3.0;
@@ -427,7 +433,6 @@ sb_get_buffer_sb16_awe32(int32_t *buffer, int len, void *p)
         }
 
         if (sb->dsp.sb_enable_i) {
-            c_record = dsp_rec_pos + ((c * sb->dsp.sb_freq) / 48000);
             in_l <<= mixer->input_gain_L;
             in_r <<= mixer->input_gain_R;
 
@@ -442,16 +447,14 @@ sb_get_buffer_sb16_awe32(int32_t *buffer, int len, void *p)
             else if (in_r > 32767)
                 in_r = 32767;
 
-            sb->dsp.record_buffer[c_record & 0xffff]       = in_l;
-            sb->dsp.record_buffer[(c_record + 1) & 0xffff] = in_r;
+            sb_dsp_record_add(&sb->dsp, in_l, in_r);
         }
 
         buffer[c] += (int32_t) (out_l * mixer->output_gain_L);
         buffer[c + 1] += (int32_t) (out_r * mixer->output_gain_R);
     }
 
-    sb->dsp.record_pos_write += ((len * sb->dsp.sb_freq) / 24000);
-    sb->dsp.record_pos_write &= 0xffff;
+    sb_dsp_record_update(&sb->dsp, len);
 
     sb->pos = 0;
 
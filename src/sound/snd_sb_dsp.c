@@ -23,6 +23,7 @@
 #include <86box/pic.h>
 #include <86box/snd_azt2316a.h>
 #include <86box/sound.h>
+#include <86box/snd_resampler.h>
 #include <86box/timer.h>
 #include <86box/snd_sb.h>
 
@@ -343,6 +344,25 @@ sb_add_data(sb_dsp_t *dsp, uint8_t v)
     dsp->sb_read_wp &= 0xff;
 }
 
+/* DMA playback on the SB16 feeds the resampler at the programmed rate,
+   primed so that its output lines up with the current buffer position. */
+static void
+sb_dsp_resample_start(sb_dsp_t *dsp)
+{
+    int16_t frame[2];
+
+    if (!dsp->resampler || (dsp->sb_freq <= 0))
+        return;
+
+    resampler_set_rates(dsp->resampler, dsp->sb_freq, 48000);
+    if (!dsp->resample) {
+        frame[0] = dsp->sbdatl;
+        frame[1] = dsp->sbdatr;
+        resampler_reset(dsp->resampler, resampler_latency(dsp->resampler) + ((sound_get_pos() * dsp->sb_freq) / 48000), frame);
+        dsp->resample = 1;
+    }
+}
+
 void
 sb_start_dma(sb_dsp_t *dsp, int dma8, int autoinit, uint8_t format, int len)
 {
@@ -362,6 +382,7 @@ sb_start_dma(sb_dsp_t *dsp, int dma8, int autoinit, uint8_t format, int len)
             timer_set_delay_u64(&dsp->output_timer, dsp->sblatcho);
         dsp->sbleftright = dsp->sbleftright_default;
         dsp->sbdacpos    = 0;
+        sb_dsp_resample_start(dsp);
     } else {
         dsp->sb_16_length   = dsp->sb_16_origlength = len;
         dsp->sb_16_format   = format;
@@ -373,6 +394,7 @@ sb_start_dma(sb_dsp_t *dsp, int dma8, int autoinit, uint8_t format, int len)
         dsp->sb_16_output = 1;
         if (!timer_is_enabled(&dsp->output_timer))
             timer_set_delay_u64(&dsp->output_timer, dsp->sblatcho);
+        sb_dsp_resample_start(dsp);
     }
 }
 
@@ -568,6 +590,8 @@ sb_exec_command(sb_dsp_t *dsp)
             if ((dsp->sb_freq != temp) && (dsp->sb_type >= SB16))
                 recalc_sb16_filter(0, temp);
             dsp->sb_freq = temp;
+            if (dsp->resample)
+                resampler_set_rates(dsp->resampler, dsp->sb_freq, 48000);
             break;
         case 0x41: /* Set output sampling rate */
         case 0x42: /* Set input sampling rate */
@@ -581,6 +605,8 @@ sb_exec_command(sb_dsp_t *dsp)
                 dsp->sb_timei = dsp->sb_timeo;
                 if (dsp->sb_freq != temp && dsp->sb_type >= SB16)
                     recalc_sb16_filter(0, dsp->sb_freq);
+                if (dsp->resample)
+                    resampler_set_rates(dsp->resampler, dsp->sb_freq, 48000);
                 dsp->sb_8051_ram[0x13] = dsp->sb_freq & 0xff;
                 dsp->sb_8051_ram[0x14] = (dsp->sb_freq >> 8) & 0xff;
             }
@@ -1141,6 +1167,11 @@ sb_dsp_init(sb_dsp_t *dsp, int type, int subtype, void *parent)
     recalc_sb16_filter(0, 3200 * 2);
     recalc_sb16_filter(1, 44100);
 
+    if (type >= SB16) {
+        dsp->resampler     = resampler_init(2, 22050, 48000);
+        dsp->rec_resampler = resampler_init(2, 48000, 22050);
+    }
+
     /* Initialize SB16 8051 RAM and ASP internal RAM */
     memset(dsp->sb_8051_ram, 0x00, sizeof(dsp->sb_8051_ram));
     dsp->sb_8051_ram[0x0e] = 0xff;
@@ -1199,6 +1230,7 @@ pollsb(void *p)
     sb_dsp_t *dsp = (sb_dsp_t *) p;
     int       tempi, ref;
     int       data[2];
+    int16_t   frame[2];
 
     timer_advance_u64(&dsp->output_timer, dsp->sblatcho);
     if (dsp->sb_8_enable && !dsp->sb_8_pause && dsp->sb_pausetime < 0 && dsp->sb_8_output) {
@@ -1449,6 +1481,13 @@ pollsb(void *p)
             sb_dsp_log("SB pause over\n");
         }
     }
+
+    /* One frame per output tick, whether or not it changed. */
+    if (dsp->resample) {
+        frame[0] = dsp->muted ? 0 : dsp->sbdatl;
+        frame[1] = dsp->muted ? 0 : dsp->sbdatr;
+        resampler_push(dsp->resampler, frame);
+    }
 }
 
 void
@@ -1555,17 +1594,84 @@ sb_poll_i(void *p)
 void
 sb_dsp_update(sb_dsp_t *dsp)
 {
+    int pos = sound_get_pos();
+
     if (dsp->muted) {
         dsp->sbdatl = 0;
         dsp->sbdatr = 0;
     }
-    for (; dsp->pos < sound_pos_global; dsp->pos++) {
+    for (; dsp->pos < pos; dsp->pos++) {
         dsp->buffer[dsp->pos * 2]     = dsp->sbdatl;
         dsp->buffer[dsp->pos * 2 + 1] = dsp->sbdatr;
     }
 }
 
+/* Returns the resampled DMA output for the buffer, or 0 when the DSP is
+   not playing through the resampler and the caller should filter the
+   regular buffer instead. */
+int
+sb_dsp_resample_get(sb_dsp_t *dsp, float *buf, int len)
+{
+    if (!dsp->resample)
+        return 0;
+
+    resampler_pull(dsp->resampler, buf, len, 1);
+
+    /* Playback is over; the held last frame matches sbdatl/sbdatr, so
+       switching back to the regular buffer is seamless. */
+    if (!(dsp->sb_8_enable && dsp->sb_8_output) && !(dsp->sb_16_enable && dsp->sb_16_output))
+        dsp->resample = 0;
+
+    return 1;
+}
+
+void
+sb_dsp_record_add(sb_dsp_t *dsp, int16_t l, int16_t r)
+{
+    int16_t frame[2] = { l, r };
+
+    if (dsp->rec_resampler)
+        resampler_push(dsp->rec_resampler, frame);
+}
+
+/* Converts the mixer input gathered during the buffer to the recording
+   rate and appends it to the record buffer. */
+void
+sb_dsp_record_update(sb_dsp_t *dsp, int len)
+{
+    float buf[SOUNDBUFLEN * 2];
+    float v;
+    int   c, n;
+
+    if (!dsp->rec_resampler || !dsp->sb_enable_i || (dsp->sb_freq <= 0)) {
+        dsp->record_pos_write += ((len * dsp->sb_freq) / 24000);
+        dsp->record_pos_write &= 0xffff;
+        return;
+    }
+
+    resampler_set_rates(dsp->rec_resampler, 48000, dsp->sb_freq);
+    n = resampler_pull(dsp->rec_resampler, buf, SOUNDBUFLEN, 0);
+
+    for (c = 0; c < n * 2; c++) {
+        /* The filter can overshoot full scale input. */
+        v = buf[c];
+        if (v < -32768.0f)
+            v = -32768.0f;
+        else if (v > 32767.0f)
+            v = 32767.0f;
+
+        dsp->record_buffer[dsp->record_pos_write] = (int16_t) v;
+        dsp->record_pos_write                     = (dsp->record_pos_write + 1) & 0xffff;
+    }
+}
+
 void
 sb_dsp_close(sb_dsp_t *dsp)
 {
+    if (dsp->resampler)
+        resampler_close(dsp->resampler);
+    if (dsp->rec_resampler)
+        resampler_close(dsp->rec_resampler);
+    dsp->resampler     = NULL;
+    dsp->rec_resampler = NULL;
 }
@@ -23,7 +23,9 @@ static float volslog[16] = {
 void
 sn76489_update(sn76489_t *sn76489)
 {
-    for (; sn76489->pos < sound_pos_global; sn76489->pos++) {
+    int pos = sound_get_pos();
+
+    for (; sn76489->pos < pos; sn76489->pos++) {
         int     c;
         int16_t result = 0;
 
@@ -53,14 +53,15 @@ speaker_update(void)
 {
     int32_t val;
     double  amplitude;
+    int     pos = sound_get_pos();
 
     amplitude = ((speaker_count / 64.0) * 10240.0) - 5120.0;
 
     if (amplitude > 5120.0)
         amplitude = 5120.0;
 
-    if (speaker_pos < sound_pos_global) {
-        for (; speaker_pos < sound_pos_global; speaker_pos++) {
+    if (speaker_pos < pos) {
+        for (; speaker_pos < pos; speaker_pos++) {
             if (speaker_gated && was_speaker_enable) {
                 if ((speaker_mode == 0) || (speaker_mode == 4))
                     val = (int32_t) amplitude;
@@ -12,46 +12,64 @@
 #include <86box/io.h>
 #include <86box/snd_resid.h>
 #include <86box/sound.h>
+#include <86box/snd_synth_thread.h>
 
 typedef struct ssi2001_t {
-    void   *psid;
-    int16_t buffer[SOUNDBUFLEN * 2];
-    int     pos;
-    int     gameport_enabled;
+    void           *psid;
+    synth_thread_t *synth;
+    int             gameport_enabled;
+
+    /* The write-only registers read back the last value written. */
+    uint8_t bus_value;
 } ssi2001_t;
 
 static void
-ssi2001_update(ssi2001_t *ssi2001)
+ssi2001_render(int16_t *buf, int len, void *p)
 {
-    if (ssi2001->pos >= sound_pos_global)
-        return;
+    ssi2001_t *ssi2001 = (ssi2001_t *) p;
 
-    sid_fillbuf(&ssi2001->buffer[ssi2001->pos], sound_pos_global - ssi2001->pos, ssi2001->psid);
-    ssi2001->pos = sound_pos_global;
+    sid_fillbuf(buf, len, ssi2001->psid);
+}
+
+static void
+ssi2001_render_write(uint32_t data, void *p)
+{
+    ssi2001_t *ssi2001 = (ssi2001_t *) p;
+
+    sid_write(data >> 8, data & 0xff, ssi2001->psid);
+}
+
+static uint32_t
+ssi2001_render_read(uint32_t data, void *p)
+{
+    ssi2001_t *ssi2001 = (ssi2001_t *) p;
+
+    return sid_read(data, ssi2001->psid);
 }
 
 static void
 ssi2001_get_buffer(int32_t *buffer, int len, void *p)
 {
     ssi2001_t *ssi2001 = (ssi2001_t *) p;
+    int16_t   *buf     = synth_thread_get_buffer(ssi2001->synth);
     int        c;
 
-    ssi2001_update(ssi2001);
-
     for (c = 0; c < len * 2; c++)
-        buffer[c] += ssi2001->buffer[c >> 1] / 2;
-
-    ssi2001->pos = 0;
+        buffer[c] += buf[c >> 1] / 2;
 }
 
 static uint8_t
 ssi2001_read(uint16_t addr, void *p)
 {
     ssi2001_t *ssi2001 = (ssi2001_t *) p;
+    int        reg     = addr & 0x1f;
 
-    ssi2001_update(ssi2001);
+    /* POTX, POTY, OSC3 and ENV3 follow the output, so the worker has to
+       catch up and read them live. */
+    if ((reg >= 0x19) && (reg <= 0x1c))
+        return synth_thread_read(ssi2001->synth, reg);
 
-    return sid_read(addr, p);
+    return ssi2001->bus_value;
 }
 
 static void
@@ -59,8 +77,8 @@ ssi2001_write(uint16_t addr, uint8_t val, void *p)
 {
     ssi2001_t *ssi2001 = (ssi2001_t *) p;
 
-    ssi2001_update(ssi2001);
-    sid_write(addr, val, p);
+    ssi2001->bus_value = val;
+    synth_thread_write(ssi2001->synth, (addr << 8) | val);
 }
 
 void *
@@ -71,6 +89,7 @@ ssi2001_init(const device_t *info)
 
     ssi2001->psid = sid_init();
     sid_reset(ssi2001->psid);
+    ssi2001->synth = synth_thread_init(1, ssi2001_render, ssi2001_render_write, ssi2001_render_read, ssi2001);
     uint16_t addr             = device_get_config_hex16("base");
     ssi2001->gameport_enabled = device_get_config_int("gameport");
     io_sethandler(addr, 0x0020, ssi2001_read, NULL, NULL, ssi2001_write, NULL, NULL, ssi2001);
@@ -85,6 +104,7 @@ ssi2001_close(void *p)
 {
     ssi2001_t *ssi2001 = (ssi2001_t *) p;
 
+    synth_thread_close(ssi2001->synth);
     sid_close(ssi2001->psid);
 
     free(ssi2001);
@@ -0,0 +1,227 @@
+/*
+ * 86Box	A hypervisor and IBM PC system emulator that specializes in
+ *		running old operating systems and software designed for IBM
+ *		PC systems and compatibles from 1981 through fairly recent
+ *		system designs based on the PCI bus.
+ *
+ *		This file is part of the 86Box distribution.
+ *
+ *		Threaded synthesizer wrapper.
+ *
+ *		The emulation thread only queues timestamped events; the
+ *		worker renders up to each event's position before applying
+ *		it, so the output is sample-identical to rendering inline.
+ *		The finished buffer is handed back one sound buffer later.
+ */
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+#include <86box/86box.h>
+#include <86box/plat.h>
+#include <86box/thread.h>
+#include <86box/sound.h>
+#include <86box/snd_synth_thread.h>
+
+#define SYNTH_QUEUE_SIZE 4096 /* Must be a power of two. */
+
+enum {
+    SYNTH_EV_WRITE = 0,
+    SYNTH_EV_READ,
+    SYNTH_EV_BLOCK
+};
+
+typedef struct {
+    uint8_t  type;
+    uint16_t pos;
+    uint32_t data;
+} synth_event_t;
+
+struct synth_thread_t {
+    int channels;
+    void (*render)(int16_t *buf, int len, void *priv);
+    void (*write)(uint32_t data, void *priv);
+    uint32_t (*read)(uint32_t data, void *priv);
+    void *priv;
+
+    synth_event_t queue[SYNTH_QUEUE_SIZE];
+    atomic_uint   head, tail;
+
+    int16_t    *buffer[2];
+    int         cur, pos;
+    atomic_uint blocks_done;
+    unsigned    blocks;
+
+    thread_t  *thread;
+    event_t   *wake_event, *done_event, *read_event;
+    uint32_t   read_val;
+    atomic_int on;
+};
+
+static void
+synth_thread_render(synth_thread_t *st, int pos)
+{
+    if (pos > sound_buflen)
+        pos = sound_buflen;
+    if (pos <= st->pos)
+        return;
+
+    st->render(&st->buffer[st->cur][st->pos * st->channels], pos - st->pos, st->priv);
+    st->pos = pos;
+}
+
+static void
+synth_thread_run(void *param)
+{
+    synth_thread_t *st = (synth_thread_t *) param;
+    synth_event_t  *ev;
+    unsigned        tail;
+    int             on;
+
+    while (1) {
+        thread_wait_event(st->wake_event, -1);
+        thread_reset_event(st->wake_event);
+
+        /* Read before draining, so events queued ahead of close are
+           still applied. */
+        on = atomic_load(&st->on);
+
+        tail = atomic_load_explicit(&st->tail, memory_order_relaxed);
+        while (tail != atomic_load_explicit(&st->head, memory_order_acquire)) {
+            ev = &st->queue[tail & (SYNTH_QUEUE_SIZE - 1)];
+
+            synth_thread_render(st, ev->pos);
+
+            switch (ev->type) {
+                case SYNTH_EV_WRITE:
+                    st->write(ev->data, st->priv);
+                    break;
+
+                case SYNTH_EV_READ:
+                    st->read_val = st->read(ev->data, st->priv);
+                    thread_set_event(st->read_event);
+                    break;
+
+                case SYNTH_EV_BLOCK:
+                    st->cur ^= 1;
+                    st->pos = 0;
+                    atomic_fetch_add_explicit(&st->blocks_done, 1, memory_order_release);
+                    break;
+            }
+
+            atomic_store_explicit(&st->tail, ++tail, memory_order_release);
+        }
+
+        /* Room in the queue and maybe a finished block for the producer. */
+        thread_set_event(st->done_event);
+
+        if (!on)
+            break;
+    }
+}
+
+static void
+synth_thread_push(synth_thread_t *st, uint8_t type, int pos, uint32_t data)
+{
+    unsigned head = atomic_load_explicit(&st->head, memory_order_relaxed);
+
+    /* Queue full, let the worker catch up. The event is reset before
+       the check so that a batch finishing in between is not missed. */
+    while ((head - atomic_load_explicit(&st->tail, memory_order_acquire)) >= SYNTH_QUEUE_SIZE) {
+        thread_reset_event(st->done_event);
+        if ((head - atomic_load_explicit(&st->tail, memory_order_acquire)) < SYNTH_QUEUE_SIZE)
+            break;
+        thread_set_event(st->wake_event);
+        thread_wait_event(st->done_event, -1);
+    }
+
+    st->queue[head & (SYNTH_QUEUE_SIZE - 1)].type = type;
+    st->queue[head & (SYNTH_QUEUE_SIZE - 1)].pos  = pos;
+    st->queue[head & (SYNTH_QUEUE_SIZE - 1)].data = data;
+    atomic_store_explicit(&st->head, head + 1, memory_order_release);
+}
+
+void
+synth_thread_write(synth_thread_t *st, uint32_t data)
+{
+    synth_thread_push(st, SYNTH_EV_WRITE, sound_get_pos(), data);
+}
+
+/* Renders up to the current position and performs the read there, for
+   registers that follow the synthesizer's output. Blocks until the
+   worker has answered. */
+uint32_t
+synth_thread_read(synth_thread_t *st, uint32_t data)
+{
+    thread_reset_event(st->read_event);
+    synth_thread_push(st, SYNTH_EV_READ, sound_get_pos(), data);
+    thread_set_event(st->wake_event);
+    thread_wait_event(st->read_event, -1);
+
+    return st->read_val;
+}
+
+/* Ends the current buffer and returns the previous one, which the
+   worker has normally finished long ago. */
+int16_t *
+synth_thread_get_buffer(synth_thread_t *st)
+{
+    int16_t *buf = st->buffer[(st->blocks + 1) & 1];
+
+    synth_thread_push(st, SYNTH_EV_BLOCK, sound_buflen, 0);
+    thread_set_event(st->wake_event);
+
+    while ((int) (st->blocks - atomic_load_explicit(&st->blocks_done, memory_order_acquire)) > 0) {
+        thread_reset_event(st->done_event);
+        if ((int) (st->blocks - atomic_load_explicit(&st->blocks_done, memory_order_acquire)) <= 0)
+            break;
+        thread_wait_event(st->done_event, -1);
+    }
+    st->blocks++;
+
+    return buf;
+}
+
+synth_thread_t *
+synth_thread_init(int channels, void (*render)(int16_t *buf, int len, void *priv),
+                  void (*write)(uint32_t data, void *priv),
+                  uint32_t (*read)(uint32_t data, void *priv), void *priv)
+{
+    synth_thread_t *st = calloc(1, sizeof(synth_thread_t));
+
+    st->channels  = channels;
+    st->render    = render;
+    st->write     = write;
+    st->read      = read;
+    st->priv      = priv;
+    st->buffer[0] = calloc(SOUNDBUFLEN * channels, sizeof(int16_t));
+    st->buffer[1] = calloc(SOUNDBUFLEN * channels, sizeof(int16_t));
+
+    st->on         = 1;
+    st->wake_event = thread_create_event();
+    st->done_event = thread_create_event();
+    st->read_event = thread_create_event();
+    st->thread     = thread_create(synth_thread_run, st);
+
+    return st;
+}
+
+void
+synth_thread_close(synth_thread_t *st)
+{
+    atomic_store(&st->on, 0);
+    thread_set_event(st->wake_event);
+    thread_wait(st->thread);
+
+    thread_destroy_event(st->wake_event);
+    thread_destroy_event(st->done_event);
+    thread_destroy_event(st->read_event);
+
+    free(st->buffer[0]);
+    free(st->buffer[1]);
+    free(st);
+}
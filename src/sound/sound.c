@@ -18,6 +18,7 @@
  */
 #include <math.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -41,6 +42,8 @@
 #include <86box/sound.h>
 #include <86box/snd_opl.h>
 #include <86box/snd_sb_dsp.h>
+#include <86box/snd_resampler.h>
+#include <86box/capture.h>
 
 typedef struct {
     const device_t *device;
@@ -52,8 +55,9 @@ typedef struct {
 } sound_handler_t;
 
 int sound_card_current = 0;
-int sound_pos_global   = 0;
 int sound_gain         = 0;
+int sound_buflen       = 48000 / 50;
+int sound_out_buflen   = 48000 / 50;
 
 static sound_handler_t sound_handlers[8];
 
@@ -61,17 +65,48 @@ static thread_t  *sound_cd_thread_h;
 static event_t   *sound_cd_event;
 static event_t   *sound_cd_start_event;
 static int32_t   *outbuffer;
-static float     *outbuffer_ex;
-static int16_t   *outbuffer_ex_int16;
 static int        sound_handlers_num;
 static pc_timer_t sound_poll_timer;
 static uint64_t   sound_poll_latch;
+static uint64_t   sound_sample_latch;
+static int        sound_poll_base;
+static int        sound_midi_base;
+
+/* Mixed blocks handed from the CPU thread to the mixer thread. */
+#define SOUND_MIX_BLOCKS 4
+
+/* Output buffers are at most this long, at up to 96 kHz. */
+#define SOUND_OUT_MAX (SOUNDBUFLEN * 2)
+
+/* Seconds without an underrun before the output queue is shortened. */
+#define SOUND_STABLE_SECS 10
+
+static thread_t    *sound_mix_thread_h;
+static event_t     *sound_mix_event;
+static event_t     *sound_mix_start_event;
+static volatile int sound_mix_on = 0;
+static int32_t      sound_mix_ring[SOUND_MIX_BLOCKS][SOUNDBUFLEN * 2];
+static atomic_uint  sound_mix_head;
+static atomic_uint  sound_mix_tail;
+static float        sound_mix_out[SOUND_OUT_MAX * 2];
+static int16_t      sound_mix_out_int16[SOUND_OUT_MAX * 2];
+
+/* Conversion to an output rate other than 48 kHz. */
+static resampler_t *sound_mix_rs;
+static float        sound_mix_fifo[SOUND_OUT_MAX * 4];
+static int          sound_mix_fifo_len;
+
+/* Output queue controller, run from the mixer thread. */
+static sound_stats_t sound_stats;
+static int           sound_out_stable;
+static uint32_t      sound_out_logged;
+static uint32_t      sound_out_summed;
 
 static int16_t      cd_buffer[CDROM_NUM][CD_BUFLEN * 2];
 static float        cd_out_buffer[CD_BUFLEN * 2];
 static int16_t      cd_out_buffer_int16[CD_BUFLEN * 2];
 static unsigned int cd_vol_l, cd_vol_r;
-static int          cd_buf_update    = CD_BUFLEN / SOUNDBUFLEN;
+static int          cd_buf_frames    = 0;
 static volatile int cdaudioon        = 0;
 static int          cd_thread_enable = 0;
 
@@ -345,6 +380,9 @@ sound_cd_thread(void *param)
             }
         }
 
+        if (capture_on)
+            capture_stream(CAPTURE_STREAM_CD, CD_FREQ, sound_is_float ? (void *) cd_out_buffer : (void *) cd_out_buffer_int16, CD_BUFLEN);
+
         if (sound_is_float)
             givealbuffer_cd(cd_out_buffer);
         else
@@ -352,25 +390,203 @@ sound_cd_thread(void *param)
     }
 }
 
+/* Clamp and convert a mixed block; written so the compiler can vectorize it. */
 static void
-sound_realloc_buffers(void)
+sound_mix_convert(const int32_t *in, int len)
 {
-    if (outbuffer_ex != NULL) {
-        free(outbuffer_ex);
-        outbuffer_ex = NULL;
-    }
+    int     c;
+    int32_t v;
 
-    if (outbuffer_ex_int16 != NULL) {
-        free(outbuffer_ex_int16);
-        outbuffer_ex_int16 = NULL;
+    if (sound_is_float) {
+        for (c = 0; c < len * 2; c++)
+            sound_mix_out[c] = ((float) in[c]) * (1.0f / 32768.0f);
+    } else {
+        for (c = 0; c < len * 2; c++) {
+            v                      = in[c];
+            v                      = (v > 32767) ? 32767 : v;
+            v                      = (v < -32768) ? -32768 : v;
+            sound_mix_out_int16[c] = (int16_t) v;
+        }
     }
+}
+
+static void
+sound_mix_convert_float(const float *in, int len)
+{
+    int   c;
+    float v;
 
     if (sound_is_float) {
-        outbuffer_ex = calloc(SOUNDBUFLEN * 2, sizeof(float));
-        memset(outbuffer_ex, 0x00, SOUNDBUFLEN * 2 * sizeof(float));
+        for (c = 0; c < len * 2; c++)
+            sound_mix_out[c] = in[c] * (1.0f / 32768.0f);
     } else {
-        outbuffer_ex_int16 = calloc(SOUNDBUFLEN * 2, sizeof(int16_t));
-        memset(outbuffer_ex_int16, 0x00, SOUNDBUFLEN * 2 * sizeof(int16_t));
+        for (c = 0; c < len * 2; c++) {
+            v                      = in[c];
+            v                      = (v > 32767.0f) ? 32767.0f : v;
+            v                      = (v < -32768.0f) ? -32768.0f : v;
+            sound_mix_out_int16[c] = (int16_t) v;
+        }
+    }
+}
+
+static void
+sound_mix_give(void)
+{
+    if (sound_is_float)
+        givealbuffer(sound_mix_out);
+    else
+        givealbuffer(sound_mix_out_int16);
+}
+
+/* Resample a 48 kHz block to the output rate and hand over every full
+   output buffer that results. */
+static void
+sound_mix_resample(const int32_t *in)
+{
+    int16_t frame[2];
+    int32_t v;
+    int     c, n;
+
+    for (c = 0; c < sound_buflen * 2; c += 2) {
+        v        = in[c];
+        frame[0] = (v > 32767) ? 32767 : ((v < -32768) ? -32768 : v);
+        v        = in[c + 1];
+        frame[1] = (v > 32767) ? 32767 : ((v < -32768) ? -32768 : v);
+        resampler_push(sound_mix_rs, frame);
+    }
+
+    n = resampler_pull(sound_mix_rs, &sound_mix_fifo[sound_mix_fifo_len * 2],
+                       (SOUND_OUT_MAX * 2) - sound_mix_fifo_len, 0);
+    sound_mix_fifo_len += n;
+
+    while (sound_mix_fifo_len >= sound_out_buflen) {
+        sound_mix_convert_float(sound_mix_fifo, sound_out_buflen);
+        sound_mix_give();
+
+        sound_mix_fifo_len -= sound_out_buflen;
+        memmove(sound_mix_fifo, &sound_mix_fifo[sound_out_buflen * 2], sound_mix_fifo_len * 2 * sizeof(float));
+    }
+}
+
+/* Called by the output backend for every buffer it is given, with the
+   number of buffers it still has queued and whether it ran dry. Returns
+   the queue depth the backend should aim for: one more after each
+   underrun, one less after SOUND_STABLE_SECS without one. */
+int
+sound_out_report(int queued, int underrun)
+{
+    sound_stats.buffers++;
+    sound_stats.queued     = queued;
+    sound_stats.latency_ms = (queued * sound_out_buflen * 1000) / sound_out_rate;
+
+    if (underrun) {
+        sound_stats.underruns++;
+        sound_out_stable = 0;
+        if (sound_adaptive && (sound_stats.target < SOUND_MAX_BUFFERS))
+            sound_stats.target++;
+        /* Always logged, but at most once every SOUND_STABLE_SECS. */
+        if ((sound_stats.underruns == 1) ||
+            ((sound_stats.buffers - sound_out_logged) >= ((SOUND_STABLE_SECS * sound_out_rate) / sound_out_buflen))) {
+            pclog("SOUND: Output underrun (%u so far), queue target now %i buffers (%i ms)\n",
+                  sound_stats.underruns, sound_stats.target,
+                  (sound_stats.target * sound_out_buflen * 1000) / sound_out_rate);
+            sound_out_logged = sound_stats.buffers;
+        }
+    } else if (sound_adaptive && (++sound_out_stable >= ((SOUND_STABLE_SECS * sound_out_rate) / sound_out_buflen))) {
+        sound_out_stable = 0;
+        if (sound_stats.target > SOUND_MIN_BUFFERS)
+            sound_stats.target--;
+    }
+
+    return sound_stats.target;
+}
+
+void
+sound_get_stats(sound_stats_t *stats)
+{
+    *stats = sound_stats;
+}
+
+/* Log what the output did since the geometry was last applied. */
+static void
+sound_out_summary(void)
+{
+    if (sound_stats.buffers == sound_out_summed)
+        return;
+    sound_out_summed = sound_stats.buffers;
+
+    pclog("SOUND: %u buffers output, %u underruns, queue target %i buffers, %i ms queued\n",
+          sound_stats.buffers, sound_stats.underruns, sound_stats.target, sound_stats.latency_ms);
+}
+
+static void
+sound_mix_thread(void *param)
+{
+    unsigned int tail;
+
+    thread_set_event(sound_mix_start_event);
+
+    while (sound_mix_on) {
+        thread_wait_event(sound_mix_event, -1);
+        thread_reset_event(sound_mix_event);
+
+        tail = atomic_load_explicit(&sound_mix_tail, memory_order_relaxed);
+        while (tail != atomic_load_explicit(&sound_mix_head, memory_order_acquire)) {
+            if (sound_mix_rs)
+                sound_mix_resample(sound_mix_ring[tail % SOUND_MIX_BLOCKS]);
+            else {
+                sound_mix_convert(sound_mix_ring[tail % SOUND_MIX_BLOCKS], sound_buflen);
+                sound_mix_give();
+            }
+
+            atomic_store_explicit(&sound_mix_tail, ++tail, memory_order_release);
+        }
+    }
+}
+
+/* Wait for the mixer thread to hand over everything queued so far. */
+void
+sound_mix_flush(void)
+{
+    while (sound_mix_on && (atomic_load(&sound_mix_tail) != atomic_load(&sound_mix_head)))
+        plat_delay_ms(1);
+}
+
+static void
+sound_mix_thread_start(void)
+{
+    atomic_store(&sound_mix_head, 0);
+    atomic_store(&sound_mix_tail, 0);
+
+    sound_mix_on = 1;
+
+    sound_mix_start_event = thread_create_event();
+
+    sound_mix_event    = thread_create_event();
+    sound_mix_thread_h = thread_create(sound_mix_thread, NULL);
+
+    thread_wait_event(sound_mix_start_event, -1);
+    thread_reset_event(sound_mix_start_event);
+}
+
+void
+sound_mix_thread_end(void)
+{
+    if (sound_mix_on) {
+        sound_mix_on = 0;
+
+        sound_log("Waiting for mixer thread to terminate...\n");
+        thread_set_event(sound_mix_event);
+        thread_wait(sound_mix_thread_h);
+        sound_log("Mixer thread terminated...\n");
+        sound_out_summary();
+
+        thread_destroy_event(sound_mix_event);
+        sound_mix_event = NULL;
+        thread_destroy_event(sound_mix_start_event);
+        sound_mix_start_event = NULL;
+
+        sound_mix_thread_h = NULL;
     }
 }
 
@@ -380,9 +596,6 @@ sound_init(void)
     int i                      = 0;
     int available_cdrom_drives = 0;
 
-    outbuffer_ex       = NULL;
-    outbuffer_ex_int16 = NULL;
-
     outbuffer = NULL;
     outbuffer = calloc(SOUNDBUFLEN * 2, sizeof(int32_t));
     memset(outbuffer, 0x00, SOUNDBUFLEN * 2 * sizeof(int32_t));
@@ -408,6 +621,8 @@ sound_init(void)
         cdaudioon = 0;
 
     cd_thread_enable = available_cdrom_drives ? 1 : 0;
+
+    sound_mix_thread_start();
 }
 
 void
@@ -427,68 +642,145 @@ sound_set_cd_audio_filter(void (*filter)(int channel, double *buffer, void *p),
     }
 }
 
+/* Current sample position within the output buffer, derived from the
+   emulated time elapsed since the last sound_poll(). */
+int
+sound_get_pos(void)
+{
+    uint64_t elapsed;
+    int      pos;
+
+    if (sound_poll_base >= sound_buflen)
+        return sound_buflen;
+    if (!sound_sample_latch)
+        return sound_poll_base;
+
+    elapsed = sound_poll_latch - timer_get_remaining_u64(&sound_poll_timer);
+    pos     = (int) (elapsed / sound_sample_latch);
+    if (pos >= SOUND_POLL_SAMPLES)
+        pos = SOUND_POLL_SAMPLES - 1;
+
+    return sound_poll_base + pos;
+}
+
+/* Sample position within the current MIDI poll period. */
+int
+sound_get_midi_pos(void)
+{
+    return sound_midi_base + (sound_get_pos() % SOUND_POLL_SAMPLES);
+}
+
 void
 sound_poll(void *priv)
 {
     timer_advance_u64(&sound_poll_timer, sound_poll_latch);
 
-    midi_poll();
+    sound_midi_base += SOUND_POLL_SAMPLES;
+    if (sound_midi_base >= SOUND_MIDI_SAMPLES) {
+        sound_midi_base = 0;
+        midi_poll();
+    }
 
-    sound_pos_global++;
-    if (sound_pos_global == SOUNDBUFLEN) {
-        int c;
+    sound_poll_base += SOUND_POLL_SAMPLES;
+    if (sound_poll_base >= sound_buflen) {
+        unsigned int head = atomic_load_explicit(&sound_mix_head, memory_order_relaxed);
+        int          full = (head - atomic_load_explicit(&sound_mix_tail, memory_order_acquire)) >= SOUND_MIX_BLOCKS;
+        int32_t     *buf  = full ? outbuffer : sound_mix_ring[head % SOUND_MIX_BLOCKS];
+        int          c;
 
-        memset(outbuffer, 0x00, SOUNDBUFLEN * 2 * sizeof(int32_t));
+        /* The sources still have to be run when the mixer is behind, the block is just dropped. */
+        memset(buf, 0x00, sound_buflen * 2 * sizeof(int32_t));
 
         for (c = 0; c < sound_handlers_num; c++)
-            sound_handlers[c].get_buffer(outbuffer, SOUNDBUFLEN, sound_handlers[c].priv);
+            sound_handlers[c].get_buffer(buf, sound_buflen, sound_handlers[c].priv);
 
-        for (c = 0; c < SOUNDBUFLEN * 2; c++) {
-            if (sound_is_float)
-                outbuffer_ex[c] = ((float) outbuffer[c]) / 32768.0;
-            else {
-                if (outbuffer[c] > 32767)
-                    outbuffer[c] = 32767;
-                if (outbuffer[c] < -32768)
-                    outbuffer[c] = -32768;
+        if (capture_on)
+            capture_audio(buf, sound_buflen);
 
-                outbuffer_ex_int16[c] = outbuffer[c];
-            }
+        if (!full) {
+            atomic_store_explicit(&sound_mix_head, head + 1, memory_order_release);
+            thread_set_event(sound_mix_event);
         }
 
-        if (sound_is_float)
-            givealbuffer(outbuffer_ex);
-        else
-            givealbuffer(outbuffer_ex_int16);
-
+        /* One CD buffer per CD_BUFLEN worth of output, whatever the buffer length. */
         if (cd_thread_enable) {
-            cd_buf_update--;
-            if (!cd_buf_update) {
-                cd_buf_update = (48000 / SOUNDBUFLEN) / (CD_FREQ / CD_BUFLEN);
+            cd_buf_frames += sound_buflen;
+            if (cd_buf_frames >= (48000 / (CD_FREQ / CD_BUFLEN))) {
+                cd_buf_frames -= 48000 / (CD_FREQ / CD_BUFLEN);
                 thread_set_event(sound_cd_event);
             }
         }
 
-        sound_pos_global = 0;
+        sound_poll_base = 0;
     }
 }
 
 void
 sound_speed_changed(void)
 {
-    sound_poll_latch = (uint64_t) ((double) TIMER_USEC * (1000000.0 / 48000.0));
+    sound_sample_latch = (uint64_t) ((double) TIMER_USEC * (1000000.0 / 48000.0));
+    sound_poll_latch   = sound_sample_latch * SOUND_POLL_SAMPLES;
+}
+
+/* Derive the buffer geometry from the configuration. Only called with
+   the mixer idle, as it also resets the output rate converter. */
+static void
+sound_apply_settings(void)
+{
+    sound_buflen = ((sound_buffer_ms * 48000) / 1000) / SOUND_POLL_SAMPLES * SOUND_POLL_SAMPLES;
+    if (sound_buflen < SOUND_POLL_SAMPLES)
+        sound_buflen = SOUND_POLL_SAMPLES;
+    else if (sound_buflen > SOUNDBUFLEN)
+        sound_buflen = SOUNDBUFLEN;
+
+    if (sound_out_rate < 8000)
+        sound_out_rate = 8000;
+    else if (sound_out_rate > 96000)
+        sound_out_rate = 96000;
+    sound_out_buflen = (int) (((int64_t) sound_buflen * sound_out_rate) / 48000);
+
+    if (sound_out_rate != 48000) {
+        if (!sound_mix_rs)
+            sound_mix_rs = resampler_init(2, 48000, sound_out_rate);
+        resampler_set_rates(sound_mix_rs, 48000, sound_out_rate);
+        resampler_reset(sound_mix_rs, resampler_latency(sound_mix_rs), NULL);
+    } else if (sound_mix_rs) {
+        resampler_close(sound_mix_rs);
+        sound_mix_rs = NULL;
+    }
+    sound_mix_fifo_len = 0;
+
+    sound_out_summary();
+    memset(&sound_stats, 0x00, sizeof(sound_stats_t));
+    sound_stats.target = sound_buffers;
+    if (sound_stats.target < SOUND_MIN_BUFFERS)
+        sound_stats.target = SOUND_MIN_BUFFERS;
+    else if (sound_stats.target > SOUND_MAX_BUFFERS)
+        sound_stats.target = SOUND_MAX_BUFFERS;
+    sound_out_stable = 0;
+    sound_out_logged = 0;
+    sound_out_summed = 0;
+
+    sound_log("Sound buffer %i frames (%i at %i Hz), %i queued\n",
+              sound_buflen, sound_out_buflen, sound_out_rate, sound_stats.target);
 }
 
 void
 sound_reset(void)
 {
-    sound_realloc_buffers();
+    /* The output is reinitialized below, let the mixer finish with it first. */
+    sound_mix_flush();
+
+    sound_apply_settings();
 
     midi_out_device_init();
     midi_in_device_init();
 
     inital();
 
+    sound_poll_base = 0;
+    sound_midi_base = 0;
+    cd_buf_frames   = 0;
     timer_add(&sound_poll_timer, sound_poll, NULL, 1);
 
     sound_handlers_num = 0;
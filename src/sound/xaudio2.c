@@ -47,14 +47,15 @@ static dllimp_t xaudio2_imports[] = {
 static int                     midi_freq     = 44100;
 static int                     midi_buf_size = 4410;
 static int                     initialized   = 0;
+static int                     started       = 0;
 static IXAudio2               *xaudio2       = NULL;
 static IXAudio2MasteringVoice *mastervoice   = NULL;
 static IXAudio2SourceVoice    *srcvoice      = NULL;
 static IXAudio2SourceVoice    *srcvoicemidi  = NULL;
 static IXAudio2SourceVoice    *srcvoicecd    = NULL;
 
-#define FREQ   48000
-#define BUFLEN SOUNDBUFLEN
+#define FREQ   sound_out_rate
+#define BUFLEN sound_out_buflen
 
 static void WINAPI
 OnVoiceProcessingPassStart(IXAudio2VoiceCallback *callback, uint32_t bytesRequired)
@@ -178,6 +179,7 @@ inital()
     }
 
     initialized = 1;
+    started     = 0;
     atexit(closeal);
 }
 
@@ -187,6 +189,7 @@ closeal()
     if (!initialized)
         return;
     initialized = 0;
+    started     = 0;
     IXAudio2SourceVoice_Stop(srcvoice, 0, XAUDIO2_COMMIT_NOW);
     IXAudio2SourceVoice_FlushSourceBuffers(srcvoice);
     IXAudio2SourceVoice_Stop(srcvoicecd, 0, XAUDIO2_COMMIT_NOW);
@@ -236,10 +239,82 @@ givealbuffer_common(void *buf, IXAudio2SourceVoice *sourcevoice, size_t buflen)
     IXAudio2SourceVoice_SubmitSourceBuffer(sourcevoice, &buffer, NULL);
 }
 
+static int
+givealbuffer_is_silent(const void *buf, size_t size)
+{
+    const uint8_t *p = (const uint8_t *) buf;
+    size_t         c;
+
+    for (c = 0; c < size; c++) {
+        if (p[c])
+            return 0;
+    }
+
+    return 1;
+}
+
+/* Copy a stereo block leaving out 'drop' frames spread evenly over it,
+   so that shortening the queue does not cut a run out of the audio.
+   Returns the number of frames copied. */
+static int
+givealbuffer_thin(void *dst, const void *src, int frames, int drop)
+{
+    size_t fsize = (sound_is_float ? sizeof(float) : sizeof(int16_t)) * 2;
+    int    step  = frames / drop;
+    int    c, n = 0;
+
+    for (c = 0; c < frames; c++) {
+        if (drop && ((c % step) == (step - 1))) {
+            drop--;
+            continue;
+        }
+        memcpy((uint8_t *) dst + (n * fsize), (const uint8_t *) src + (c * fsize), fsize);
+        n++;
+    }
+
+    return n;
+}
+
+/* XAudio2 queues without limit, so the queue depth asked for by the sound
+   core is kept by padding with silence after an underrun and, while the
+   queue is longer than needed, dropping silent blocks whole and thinning
+   the others by 1/64 of their frames. An empty queue before the first
+   block is not an underrun. */
 void
 givealbuffer(void *buf)
 {
+    XAUDIO2_VOICE_STATE state;
+    void               *silence, *thin;
+    size_t              size = (BUFLEN << 1) * (sound_is_float ? sizeof(float) : sizeof(int16_t));
+    int                 target, frames;
+
+    if (!initialized)
+        return;
+
+    IXAudio2SourceVoice_GetState(srcvoice, &state, XAUDIO2_VOICE_NOSAMPLESPLAYED);
+    target = sound_out_report(state.BuffersQueued, started && !state.BuffersQueued);
+
+    if (!state.BuffersQueued) {
+        silence = calloc(BUFLEN << 1, sound_is_float ? sizeof(float) : sizeof(int16_t));
+        while (++state.BuffersQueued < target)
+            givealbuffer_common(silence, srcvoice, BUFLEN << 1);
+        free(silence);
+    } else if ((state.BuffersQueued > target) && (BUFLEN >= 64)) {
+        started = 1;
+        if (givealbuffer_is_silent(buf, size))
+            return;
+
+        thin = malloc(size);
+        if (thin != NULL) {
+            frames = givealbuffer_thin(thin, buf, BUFLEN, BUFLEN >> 6);
+            givealbuffer_common(thin, srcvoice, frames << 1);
+            free(thin);
+            return;
+        }
+    }
+
     givealbuffer_common(buf, srcvoice, BUFLEN << 1);
+    started = 1;
 }
 
 void
@@ -413,6 +413,51 @@ plat_munmap(void *ptr, size_t size)
     munmap(ptr, size);
 }
 
+void
+plat_madvise_huge(void *ptr, size_t size)
+{
+#ifdef MADV_HUGEPAGE
+    madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+}
+
+void
+plat_mdiscard(void *ptr, size_t size)
+{
+    /* Hand the pages back to the host; they read back as zero. */
+#ifdef __linux__
+    madvise(ptr, size, MADV_DONTNEED);
+#else
+    mmap(ptr, size, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE | MAP_FIXED, -1, 0);
+#endif
+}
+
+size_t
+plat_mresident(void *ptr, size_t size)
+{
+#ifdef __linux__
+    unsigned char *vec;
+#else
+    char *vec;
+#endif
+    size_t pg = sysconf(_SC_PAGESIZE);
+    size_t n = (size + pg - 1) / pg;
+    size_t i, ret = 0;
+
+    vec = malloc(n);
+    if (vec == NULL)
+	return size;
+    if (mincore(ptr, size, vec) == 0) {
+	for (i = 0; i < n; i++)
+		if (vec[i] & 1)
+			ret += pg;
+    } else
+	ret = size;
+    free(vec);
+
+    return ret;
+}
+
 uint64_t
 plat_timer_read(void)
 {
@@ -72,6 +72,8 @@
 #include <86box/video.h>
 #include <86box/vid_svga.h>
 #include <86box/cli.h>
+#include <86box/capture.h>
+#include <86box/fbexport.h>
 
 #include <minitrace/minitrace.h>
 
@@ -495,6 +497,12 @@ video_blit_memtoscreen(int x, int y, int w, int h)
 
     video_wait_for_blit();
 
+    if (capture_on)
+	capture_video(x, y, w, h);
+
+    if (fbexport_on)
+	fbexport_frame(x, y, w, h);
+
     blit_data.busy = 1;
     blit_data.buffer_in_use = 1;
     blit_data.x = x;
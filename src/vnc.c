@@ -37,6 +37,9 @@
 #define VNC_MAX_X	2048
 #define VNC_MIN_Y	200
 #define VNC_MAX_Y	2048
+#define VNC_TILE	64		/* change tracking, same grid as ZRLE */
+#define VNC_TILES_X	(VNC_MAX_X / VNC_TILE)
+#define VNC_TILES_Y	(VNC_MAX_Y / VNC_TILE)
 
 
 static rfbScreenInfoPtr	rfb = NULL;
@@ -45,6 +48,7 @@ static int	updatingSize;
 static int	allowedX,
 		allowedY;
 static int	ptr_x, ptr_y, ptr_but;
+static uint8_t	dirty[VNC_TILES_Y][VNC_TILES_X];
 
 
 #ifdef ENABLE_VNC_LOG
@@ -166,20 +170,50 @@ vnc_display(rfbClientPtr cl)
 }
 
 
+/* Tell the clients about the changed tiles, merging runs on each row. */
+static void
+vnc_mark_dirty(void)
+{
+    int tx, ty, start;
+
+    for (ty = 0; ty < VNC_TILES_Y; ty++) {
+	for (tx = 0; tx < VNC_TILES_X; tx++) {
+		if (! dirty[ty][tx])
+			continue;
+
+		for (start = tx; (tx < VNC_TILES_X) && dirty[ty][tx]; tx++)
+			dirty[ty][tx] = 0;
+
+		if (((start * VNC_TILE) < allowedX) && ((ty * VNC_TILE) < allowedY))
+			rfbMarkRectAsModified(rfb, start * VNC_TILE, ty * VNC_TILE,
+					      MIN(tx * VNC_TILE, allowedX),
+					      MIN((ty + 1) * VNC_TILE, allowedY));
+	}
+    }
+}
+
+
 static void
 vnc_blit(int x, int y, int w, int h)
 {
-    uint32_t *p;
-    int yy;
+    uint32_t *p, *s;
+    int yy, tx, tw;
 
     if ((x < 0) || (y < 0) || (w <= 0) || (h <= 0) || (w > 2048) || (h > 2048) || (buffer32 == NULL))
 	return;
 
     for (yy=0; yy<h; yy++) {
 	p = (uint32_t *)&(((uint32_t *)rfb->frameBuffer)[yy*VNC_MAX_X]);
-
-	if ((y+yy) >= 0 && (y+yy) < VNC_MAX_Y)
-		video_copy(p, &(buffer32->line[yy]), w*sizeof(uint32_t));
+	s = &(buffer32->line[y+yy][x]);
+
+	/* Only copy, and later send, the parts that actually changed. */
+	for (tx=0; tx<w; tx+=VNC_TILE) {
+		tw = MIN(w - tx, VNC_TILE);
+		if (memcmp(p + tx, s + tx, tw*sizeof(uint32_t))) {
+			video_copy(p + tx, s + tx, tw*sizeof(uint32_t));
+			dirty[yy / VNC_TILE][tx / VNC_TILE] = 1;
+		}
+	}
     }
 
     if (screenshots)
@@ -187,8 +221,9 @@ vnc_blit(int x, int y, int w, int h)
 
     video_blit_complete();
 
+    /* Changes made while a resize is pending are sent once it is done. */
     if (! updatingSize)
-	rfbMarkRectAsModified(rfb, 0,0, allowedX,allowedY);
+	vnc_mark_dirty();
 }
 
 
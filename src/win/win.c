@@ -35,6 +35,7 @@
 #include <direct.h>
 #include <wchar.h>
 #include <io.h>
+#include <psapi.h>
 #include <stdatomic.h>
 #define HAVE_STDARG_H
 #include <86box/86box.h>
@@ -941,6 +942,56 @@ plat_munmap(void *ptr, size_t size)
 }
 
 
+void
+plat_madvise_huge(void *ptr, size_t size)
+{
+    /* Large pages need SeLockMemoryPrivilege, which we do not ask for. */
+}
+
+
+void
+plat_mdiscard(void *ptr, size_t size)
+{
+    MEMORYSTATUSEX ms;
+
+    /* The pages have to be committed again right away, so leave them
+       alone unless the commit limit has room to spare. */
+    ms.dwLength = sizeof(ms);
+    if (!GlobalMemoryStatusEx(&ms) || (ms.ullAvailPageFile < ((DWORDLONG) size + (64 << 20))))
+	return;
+
+    /* Hand the pages back to the host; they read back as zero. */
+    if (!VirtualFree(ptr, size, MEM_DECOMMIT))
+	return;
+    if (VirtualAlloc(ptr, size, MEM_COMMIT, PAGE_READWRITE) == NULL)
+	fatal("Unable to recommit %u KB of guest RAM (error %lu)\n", (unsigned) (size >> 10), GetLastError());
+}
+
+
+size_t
+plat_mresident(void *ptr, size_t size)
+{
+    PSAPI_WORKING_SET_EX_INFORMATION *info;
+    size_t n = (size + 4095) >> 12;
+    size_t i, ret = 0;
+
+    info = malloc(n * sizeof(PSAPI_WORKING_SET_EX_INFORMATION));
+    if (info == NULL)
+	return size;
+    for (i = 0; i < n; i++)
+	info[i].VirtualAddress = (uint8_t *) ptr + (i << 12);
+    if (QueryWorkingSetEx(GetCurrentProcess(), info, n * sizeof(PSAPI_WORKING_SET_EX_INFORMATION))) {
+	for (i = 0; i < n; i++)
+		if (info[i].VirtualAttributes.Valid)
+			ret += 4096;
+    } else
+	ret = size;
+    free(info);
+
+    return ret;
+}
+
+
 uint64_t
 plat_timer_read(void)
 {
@@ -348,14 +348,14 @@ win_settings_init(void)
     temp_GUS = GUS;
     temp_float = sound_is_float;
 
-    /* Network category */
-    temp_net_type = network_type;
+    /* Network category, this dialog only edits the first adapter. */
+    temp_net_type = net_cards_conf[0].net_type;
     memset(temp_pcap_dev, 0, sizeof(temp_pcap_dev));
 #ifdef ENABLE_SETTINGS_LOG
-    assert(sizeof(temp_pcap_dev) == sizeof(network_host));
+    assert(sizeof(temp_pcap_dev) == sizeof(net_cards_conf[0].host_dev_name));
 #endif
-    memcpy(temp_pcap_dev, network_host, sizeof(network_host));
-    temp_net_card = network_card;
+    memcpy(temp_pcap_dev, net_cards_conf[0].host_dev_name, sizeof(net_cards_conf[0].host_dev_name));
+    temp_net_card = net_cards_conf[0].device_num;
 
     /* Ports category */
     for (i = 0; i < PARALLEL_MAX; i++) {
@@ -474,9 +474,9 @@ win_settings_changed(void)
     i = i || (sound_is_float != temp_float);
 
     /* Network category */
-    i = i || (network_type != temp_net_type);
-    i = i || strcmp(temp_pcap_dev, network_host);
-    i = i || (network_card != temp_net_card);
+    i = i || (net_cards_conf[0].net_type != temp_net_type);
+    i = i || strcmp(temp_pcap_dev, net_cards_conf[0].host_dev_name);
+    i = i || (net_cards_conf[0].device_num != temp_net_card);
 
     /* Ports category */
     for (j = 0; j < PARALLEL_MAX; j++) {
@@ -565,10 +565,13 @@ win_settings_save(void)
     sound_is_float = temp_float;
 
     /* Network category */
-    network_type = temp_net_type;
-    memset(network_host, '\0', sizeof(network_host));
-    strcpy(network_host, temp_pcap_dev);
-    network_card = temp_net_card;
+    /* There is no switch name field here, keep the one from the config. */
+    if ((temp_net_type != NET_TYPE_VSWITCH) || (net_cards_conf[0].net_type != NET_TYPE_VSWITCH)) {
+	memset(net_cards_conf[0].host_dev_name, '\0', sizeof(net_cards_conf[0].host_dev_name));
+	strcpy(net_cards_conf[0].host_dev_name, (temp_net_type == NET_TYPE_VSWITCH) ? "none" : temp_pcap_dev);
+    }
+    net_cards_conf[0].net_type = temp_net_type;
+    net_cards_conf[0].device_num = temp_net_card;
 
     /* Ports category */
     for (i = 0; i < PARALLEL_MAX; i++) {
@@ -1788,10 +1791,10 @@ static void network_recalc_combos(HWND hdlg)
 
     settings_enable_window(hdlg, IDC_COMBO_PCAP, temp_net_type == NET_TYPE_PCAP);
     settings_enable_window(hdlg, IDC_COMBO_NET,
-				 (temp_net_type == NET_TYPE_SLIRP) ||
+				 (temp_net_type == NET_TYPE_SLIRP) || (temp_net_type == NET_TYPE_VSWITCH) ||
 				 ((temp_net_type == NET_TYPE_PCAP) && (network_dev_to_id(temp_pcap_dev) > 0)));
     settings_enable_window(hdlg, IDC_CONFIGURE_NET, network_card_has_config(temp_net_card) &&
-				 ((temp_net_type == NET_TYPE_SLIRP) ||
+				 ((temp_net_type == NET_TYPE_SLIRP) || (temp_net_type == NET_TYPE_VSWITCH) ||
 				 ((temp_net_type == NET_TYPE_PCAP) && (network_dev_to_id(temp_pcap_dev) > 0))));
 
     ignore_change = 0;
@@ -1815,6 +1818,7 @@ win_settings_network_proc(HWND hdlg, UINT message, WPARAM wParam, LPARAM lParam)
 		settings_add_string(hdlg, IDC_COMBO_NET_TYPE, (LPARAM) L"None");
 		settings_add_string(hdlg, IDC_COMBO_NET_TYPE, (LPARAM) L"PCap");
 		settings_add_string(hdlg, IDC_COMBO_NET_TYPE, (LPARAM) L"SLiRP");
+		settings_add_string(hdlg, IDC_COMBO_NET_TYPE, (LPARAM) L"Virtual switch");
 		settings_set_cur_sel(hdlg, IDC_COMBO_NET_TYPE, temp_net_type);
 		settings_enable_window(hdlg, IDC_COMBO_PCAP, temp_net_type == NET_TYPE_PCAP);
 
@@ -1885,7 +1889,7 @@ win_settings_network_proc(HWND hdlg, UINT message, WPARAM wParam, LPARAM lParam)
 					return FALSE;
 
 				temp_net_card = settings_list_to_device[0][settings_get_cur_sel(hdlg, IDC_COMBO_NET)];
-				temp_deviceconfig |= deviceconfig_open(hdlg, (void *)network_card_getdevice(temp_net_card));
+				temp_deviceconfig |= deviceconfig_inst_open(hdlg, (void *)network_card_getdevice(temp_net_card), 1);
 				break;
 		}
 		return FALSE;